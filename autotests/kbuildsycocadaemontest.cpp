@@ -0,0 +1,123 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "../src/kbuildsycoca/kbuildsycocadaemon.h"
+
+#include <kbuildsycoca_p.h>
+#include <ksycoca.h>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTest>
+
+class KBuildSycocaDaemonTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+        QDir().mkpath(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/kservices5"));
+
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+
+    void testIsDaemonRunning()
+    {
+        const QString path = KSycoca::absoluteFilePath();
+        QVERIFY(!KBuildSycoca::isDaemonRunning(path));
+        QVERIFY(!KBuildSycoca::isDaemonRunning(QString()));
+        {
+            KBuildSycocaDaemon daemon(false);
+            QVERIFY(daemon.start());
+            QVERIFY(KBuildSycoca::isDaemonRunning(path));
+
+            // Only one daemon per database
+            KBuildSycocaDaemon other(false);
+            QVERIFY(!other.start());
+            QVERIFY(KBuildSycoca::isDaemonRunning(path));
+        }
+        QVERIFY(!KBuildSycoca::isDaemonRunning(path));
+    }
+
+    void testWatches()
+    {
+        KBuildSycocaDaemon daemon(false);
+        QVERIFY(daemon.start());
+
+        // The resource dirs, existing or not, and the mimeapps.list files, existing or not
+        const QStringList dirs = KBuildSycoca::factoryResourceDirs() + KSycoca::self()->allResourceDirs();
+        QVERIFY(!dirs.isEmpty());
+        for (const QString &dir : dirs) {
+            QVERIFY2(daemon.m_dirWatch.contains(dir), qPrintable(dir));
+        }
+        const QStringList files = KBuildSycoca::mimeAppsFiles();
+        QVERIFY(!files.isEmpty());
+        for (const QString &file : files) {
+            QVERIFY2(daemon.m_dirWatch.contains(file), qPrintable(file));
+        }
+    }
+
+    void testQuietPeriod()
+    {
+        KBuildSycocaDaemon daemon(false);
+        QSignalSpy spy(&daemon, &KBuildSycocaDaemon::rebuilt);
+        QElapsedTimer timer;
+        timer.start();
+
+        daemon.slotChanged(QString());
+        QVERIFY(daemon.m_rebuildTimer.isActive());
+        QCOMPARE(daemon.m_rebuildTimer.interval(), KBuildSycocaDaemon::s_quietPeriod);
+
+        // Another change starts the quiet period again
+        QTest::qWait(KBuildSycocaDaemon::s_quietPeriod / 2);
+        QVERIFY(spy.isEmpty());
+        daemon.slotChanged(QString());
+        QCOMPARE(daemon.m_rebuildTimer.interval(), KBuildSycocaDaemon::s_quietPeriod);
+
+        QVERIFY(spy.wait(KBuildSycocaDaemon::s_quietPeriod * 4));
+        QCOMPARE(spy.count(), 1);
+        QVERIFY(timer.elapsed() >= KBuildSycocaDaemon::s_quietPeriod);
+        QVERIFY(!daemon.m_pendingSince.isValid());
+    }
+
+    void testMaxDelay()
+    {
+        KBuildSycocaDaemon daemon(false);
+        QSignalSpy spy(&daemon, &KBuildSycocaDaemon::rebuilt);
+        QElapsedTimer timer;
+        timer.start();
+
+        // A change every 100 ms never leaves a quiet period
+        while (spy.isEmpty() && timer.elapsed() < 2 * KBuildSycocaDaemon::s_maxDelay) {
+            daemon.slotChanged(QString());
+            QTest::qWait(100);
+        }
+        QCOMPARE(spy.count(), 1);
+        // Timers may fire a bit early, see Qt::CoarseTimer
+        QVERIFY2(timer.elapsed() >= KBuildSycocaDaemon::s_maxDelay - 100, qPrintable(QString::number(timer.elapsed())));
+    }
+};
+
+QTEST_MAIN(KBuildSycocaDaemonTest)
+
+#include "kbuildsycocadaemontest.moc"
@@ -29,6 +29,7 @@
 #include <qtest.h>
 #include "setupxdgdirs.h"
 #include "kmimeassociations_p.h"
+#include "kmimeancestry_p.h"
 #include <kbuildsycoca_p.h>
 #include <ksycoca.h>
 #include "ksycoca_p.h"
@@ -36,6 +37,11 @@
 #include <QMimeType>
 #include <QSignalSpy>
 
+#include <time.h>
+#ifdef Q_OS_UNIX
+#include <utime.h>
+#endif
+
 // We need a factory that returns the same KService::Ptr every time it's asked for a given service.
 // Otherwise the changes to the service's serviceTypes by KMimeAssociationsTest have no effect
 class FakeServiceFactory : public KServiceFactory
@@ -274,6 +280,80 @@ private Q_SLOTS:
         }
     }
 
+    void testMimeAncestry()
+    {
+        const KMimeAncestry ancestry;
+        QMimeDatabase db;
+        const QStringList mimeTypes = ancestry.mimeTypes();
+        QCOMPARE(mimeTypes.count(), db.allMimeTypes().count());
+
+        // Parents come first, and are less deep
+        QSet<QString> earlier;
+        for (const QString &mimeType : mimeTypes) {
+            const QStringList parents = ancestry.parents(mimeType);
+            QCOMPARE(parents.isEmpty(), ancestry.depth(mimeType) == 0);
+            for (const QString &parent : parents) {
+                QVERIFY2(parent.isEmpty() || earlier.contains(parent), qPrintable(mimeType + QLatin1String(" before ") + parent));
+                QVERIFY(ancestry.depth(parent) < ancestry.depth(mimeType));
+            }
+            earlier.insert(mimeType);
+        }
+
+        // Same answers as QMimeType::inherits, including for aliases
+        const QStringList ancestors = { QStringLiteral("text/plain"), QStringLiteral("application/xml"),
+                                        QStringLiteral("application/zip"), QStringLiteral("application/octet-stream"),
+                                        QStringLiteral("text/x-c"), QStringLiteral("no/such-mimetype") };
+        for (const QString &mimeType : mimeTypes) {
+            const QMimeType mime = db.mimeTypeForName(mimeType);
+            for (const QString &ancestor : ancestors) {
+                QCOMPARE(ancestry.inherits(mimeType, ancestor), mime.inherits(ancestor));
+            }
+        }
+        QVERIFY(ancestry.inherits(QStringLiteral("text/x-java"), QStringLiteral("text/plain")));
+        QVERIFY(!ancestry.inherits(QStringLiteral("text/plain"), QStringLiteral("text/x-java")));
+        QCOMPARE(ancestry.depth(QStringLiteral("x-scheme-handler/mailto")), 0); // unknown to QMimeDatabase
+    }
+
+    void testOfferHash()
+    {
+        KService::List services;
+        for (int i = 0; i < 10; ++i) {
+            services.append(KService::Ptr(new KService(QStringLiteral("fake%1").arg(i), QStringLiteral("ls"), QString())));
+        }
+        const QString mime = QStringLiteral("text/plain");
+        KOfferHash offerHash;
+        for (int i = 0; i < services.count(); ++i) {
+            offerHash.addServiceOffer(mime, KServiceOffer(services.at(i), i, 0, true));
+        }
+        // Adding again only raises the preference
+        offerHash.addServiceOffer(mime, KServiceOffer(services.at(3), 100, 0, true));
+        offerHash.addServiceOffer(mime, KServiceOffer(services.at(4), 1, 0, true));
+        QList<KServiceOffer> offers = offerHash.offersFor(mime);
+        QCOMPARE(offers.count(), 10);
+        QCOMPARE(offers.at(3).preference(), 100);
+        QCOMPARE(offers.at(4).preference(), 4);
+
+        // Removing keeps the order of the other ones, also once enough were removed to compact the list
+        for (int i = 0; i < 8; ++i) {
+            offerHash.removeServiceOffer(mime, services.at(i * 3 % 10));
+            offers = offerHash.offersFor(mime);
+            QCOMPARE(offers.count(), 9 - i);
+            for (int j = 1; j < offers.count(); ++j) {
+                QVERIFY(offers.at(j - 1).preference() < offers.at(j).preference() || offers.at(j - 1).service() == services.at(3));
+            }
+            QVERIFY(offerHash.hasRemovedOffer(mime, services.at(i * 3 % 10)));
+        }
+        QCOMPARE(offers.count(), 2);
+        QCOMPARE(offers.at(0).service(), services.at(4));
+        QCOMPARE(offers.at(1).service(), services.at(7));
+
+        // A removed service can be added again, at the end
+        offerHash.addServiceOffer(mime, KServiceOffer(services.at(0), 50, 0, true));
+        offers = offerHash.offersFor(mime);
+        QCOMPARE(offers.count(), 3);
+        QCOMPARE(offers.at(2).service(), services.at(0));
+    }
+
     void testGlobalAndLocalFiles()
     {
         KOfferHash offerHash;
@@ -368,6 +448,77 @@ private Q_SLOTS:
         QVERIFY(offerListHasService(offers, fakeTextApplication, true));
     }
 
+    void testAliases()
+    {
+        // application/x-pdf and application/msword are aliases, resolved through
+        // the table of canonical names stored in ksycoca
+        const QStringList aliases = QStringList() << QStringLiteral("application/x-pdf") << QStringLiteral("application/msword");
+        QMimeDatabase db;
+        for (const QString &alias : aliases) {
+            const QString canonical = db.mimeTypeForName(alias).name();
+            QVERIFY(!canonical.isEmpty());
+            const QStringList aliasOffers = assembleServices(KMimeTypeTrader::self()->query(alias));
+            QVERIFY(!aliasOffers.isEmpty());
+            QCOMPARE(aliasOffers, assembleServices(KMimeTypeTrader::self()->query(canonical)));
+            const KService::Ptr preferred = KMimeTypeTrader::self()->preferredService(alias);
+            QVERIFY(preferred);
+            QVERIFY(preferred->hasMimeType(alias));
+            QVERIFY(preferred->hasMimeType(canonical));
+        }
+    }
+
+    void testPreferredServices()
+    {
+        QStringList mimeTypes = preferredApps.keys();
+        mimeTypes << QStringLiteral("application/x-pdf") << mimeTypes.first() << QStringLiteral("image/x-unknown-fake");
+        const QHash<QString, KService::Ptr> services = KMimeTypeTrader::self()->preferredServices(mimeTypes);
+        for (const QString &mimeType : qAsConst(mimeTypes)) {
+            const KService::Ptr expected = KMimeTypeTrader::self()->preferredService(mimeType);
+            const KService::Ptr service = services.value(mimeType);
+            QCOMPARE(service ? service->storageId() : QString(), expected ? expected->storageId() : QString());
+            QCOMPARE(services.contains(mimeType), bool(expected));
+        }
+    }
+
+    void testPrefilteredOffersDesktop()
+    {
+        // The fake applications have OnlyShowIn=KDE;UDE, kbuildsycoca stored that as a mask
+        const QStringList desktops = QStringList() << QStringLiteral("KDE") << QStringLiteral("UDE") << QStringLiteral("GNOME") << QStringLiteral("XFCE");
+        for (const QString &desktop : desktops) {
+            qputenv("XDG_CURRENT_DESKTOP", desktop.toLatin1());
+            const bool shown = desktop == QLatin1String("KDE") || desktop == QLatin1String("UDE");
+            const KService::List offers = KMimeTypeTrader::self()->query(QStringLiteral("text/plain"));
+            QCOMPARE(offerListHasService(offers, fakeTextApplication, false), shown);
+            for (const KService::Ptr &service : offers) {
+                QVERIFY(service->showInCurrentDesktop());
+                QVERIFY(service->hasServiceType(QStringLiteral("Application")));
+            }
+            const KService::Ptr preferred = KMimeTypeTrader::self()->preferredService(QStringLiteral("text/plain"));
+            QCOMPARE(preferred ? preferred->storageId() : QString(), offers.isEmpty() || !offers.first()->allowAsDefault() ? QString() : offers.first()->storageId());
+        }
+        qputenv("XDG_CURRENT_DESKTOP", "KDE");
+    }
+
+    void testPrecomputedVisibility()
+    {
+        // The service from ksycoca uses the masks computed by kbuildsycoca,
+        // the one parsed from the desktop file checks its properties
+        const KService::Ptr fromSycoca = KService::serviceByStorageId(QStringLiteral("faketextapplication.desktop"));
+        QVERIFY(fromSycoca);
+        const KService::Ptr fromFile(new KService(fakeTextApplication));
+        QVERIFY(fromFile->isValid());
+        const QStringList desktops = QStringList() << QStringLiteral("KDE") << QStringLiteral("UDE") << QStringLiteral("GNOME")
+                                                   << QStringLiteral("XFCE") << QStringLiteral("KDE;UDE") << QString();
+        for (const QString &desktop : desktops) {
+            qputenv("XDG_CURRENT_DESKTOP", desktop.toLatin1());
+            QCOMPARE(fromSycoca->showInCurrentDesktop(), fromFile->showInCurrentDesktop());
+            QCOMPARE(fromSycoca->showInCurrentDesktop(), desktop == QLatin1String("KDE") || desktop == QLatin1String("UDE"));
+        }
+        qputenv("XDG_CURRENT_DESKTOP", "KDE");
+        QCOMPARE(fromSycoca->showOnCurrentPlatform(), fromFile->showOnCurrentPlatform());
+        QCOMPARE(fromSycoca->noDisplay(), fromFile->noDisplay());
+    }
+
     void testRemoveAssociationFromParent()
     {
         // I removed kate from text/plain, and it would still appear in text/x-java.
@@ -451,6 +602,64 @@ private Q_SLOTS:
         QVERIFY(!offerListHasService(offers, fakeTextApplication, false));
     }
 
+    void testAssociationsOnlyChange()
+    {
+        // Only mimeapps.list changes: kbuildsycoca reuses the files it knows about
+        writeToMimeApps(QByteArray("[Default Applications]\n"
+                                   "image/jpeg=fakehtmlapplication.desktop;\n"));
+        KService::List offers = KMimeTypeTrader::self()->query(QStringLiteral("image/jpeg"));
+        QVERIFY(offerListHasService(offers, fakeHtmlApplication, true));
+        QCOMPARE(KMimeTypeTrader::self()->preferredService(QStringLiteral("image/jpeg"))->entryPath(), fakeHtmlApplication);
+        QVERIFY(offerListHasService(offers, fakeJpegApplication, true));
+
+        // A new application together with a new association: the apps dir changed, so it's seen
+        const QString fakeNewApplication = m_localApps + "fakenewjpegapplication.desktop";
+        writeAppDesktopFile(fakeNewApplication, QStringList() << QStringLiteral("image/jpeg"));
+        writeToMimeApps(QByteArray("[Default Applications]\n"
+                                   "image/jpeg=fakenewjpegapplication.desktop;\n"));
+        offers = KMimeTypeTrader::self()->query(QStringLiteral("image/jpeg"));
+        QVERIFY(offerListHasService(offers, fakeNewApplication, true));
+        QCOMPARE(KMimeTypeTrader::self()->preferredService(QStringLiteral("image/jpeg"))->entryPath(), fakeNewApplication);
+        QVERIFY(!offerListHasService(offers, fakeHtmlApplication, false));
+
+        QVERIFY(QFile::remove(fakeNewApplication));
+        writeToMimeApps(QByteArray());
+        offers = KMimeTypeTrader::self()->query(QStringLiteral("image/jpeg"));
+        QVERIFY(!offerListHasService(offers, fakeNewApplication, false));
+        QVERIFY(offerListHasService(offers, fakeJpegApplication, true));
+    }
+
+    void testModifiedFileWithAssociationsChange()
+    {
+        // A desktop file modified in place doesn't change the mtime of its dir
+        QFile desktopFile(fakeJpegApplication);
+        QVERIFY(desktopFile.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        desktopFile.write("[Desktop Entry]\n"
+                          "Name=FakeApplication\n"
+                          "Type=Application\n"
+                          "Exec=ls\n"
+                          "MimeType=image/png;\n");
+        desktopFile.close();
+#ifdef Q_OS_UNIX
+        // Don't depend on the mtime resolution: move it one minute ahead
+        struct utimbuf utbuf;
+        utbuf.actime = utbuf.modtime = time(nullptr) + 60;
+        QCOMPARE(utime(QFile::encodeName(fakeJpegApplication).constData(), &utbuf), 0);
+#endif
+        writeToMimeApps(QByteArray("[Default Applications]\n"
+                                   "image/png=fakejpegapplication.desktop;\n"));
+        KService::List offers = KMimeTypeTrader::self()->query(QStringLiteral("image/jpeg"));
+        QVERIFY(!offerListHasService(offers, fakeJpegApplication, false));
+        offers = KMimeTypeTrader::self()->query(QStringLiteral("image/png"));
+        QVERIFY(offerListHasService(offers, fakeJpegApplication, true));
+
+        // Put it back for other tests
+        writeAppDesktopFile(fakeJpegApplication, QStringList() << QStringLiteral("image/jpeg"));
+        writeToMimeApps(QByteArray());
+        offers = KMimeTypeTrader::self()->query(QStringLiteral("image/jpeg"));
+        QVERIFY(offerListHasService(offers, fakeJpegApplication, true));
+    }
+
 private:
     typedef QMap<QString /*mimetype*/, QStringList> ExpectedResultsMap;
 
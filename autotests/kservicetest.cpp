@@ -29,26 +29,35 @@
 #include <kdesktopfile.h>
 #include <ksycoca.h>
 #include <kbuildsycoca_p.h>
+#include <kservicefactory_p.h>
+#include "ksycoca_p.h"
 #include <../src/services/kserviceutil_p.h>
 #include <../src/services/ktraderparsetree_p.h>
+#include <../src/services/ktraderparseprogram_p.h>
 
 #include <kservicegroup.h>
 #include <kservicetypetrader.h>
+#include <kmimetypetrader.h>
 #include <kservicetype.h>
 #include <kservicetypeprofile.h>
 #include <kpluginmetadata.h>
 #include <kplugininfo.h>
 
 #include <qfile.h>
+#include <qfileinfo.h>
 #include <qstandardpaths.h>
 #include <qthread.h>
 #include <qsignalspy.h>
 
 #include <QTimer>
 #include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QLoggingCategory>
 #include <QMimeDatabase>
 
+#include <algorithm>
+
 QTEST_MAIN(KServiceTest)
 
 extern KSERVICE_EXPORT int ksycoca_ms_between_checks;
@@ -601,6 +610,136 @@ void KServiceTest::testSubseqConstraints()
   QVERIFY2(test("TRYHARDS", "try your hardest", 0), "uppercase pattern");
 }
 
+void KServiceTest::testTraderConstraintsProgram()
+{
+    if (!KSycoca::isAvailable()) {
+        QSKIP("ksycoca not available");
+    }
+
+    // The compiled program must give the same result as the parse tree, for every service
+    KService::List services = KServiceTypeTrader::self()->query(QStringLiteral("FakePluginType"));
+    services += KServiceTypeTrader::self()->query(QStringLiteral("FakeBasePart"));
+    QVERIFY(services.count() > 2);
+
+    const QStringList constraints = {
+        QStringLiteral("Library == 'faketextplugin'"),
+        QStringLiteral("Library != 'faketextplugin'"),
+        QStringLiteral("Library =~ 'fAkEteXtpLuGin'"),
+        QStringLiteral("Library !~ 'fAkEteXtpLuGin'"),
+        QStringLiteral("'textplugin' ~ Library"),
+        QStringLiteral("'teXtPluGin' ~~ Library"),
+        QStringLiteral("'txtlug' subseq Library"),
+        QStringLiteral("'tXtLuG' ~subseq Library"),
+        QStringLiteral("exist Library"),
+        QStringLiteral("not exist [X-KDE-TestList]"),
+        QStringLiteral("'item2' in [X-KDE-TestList]"),
+        QStringLiteral("'ITEM2' ~in [X-KDE-TestList]"),
+        QStringLiteral("(not exist [X-KDE-Version]) or ([X-KDE-Version] > 4.559 and [X-KDE-Version] < 4.561)"),
+        QStringLiteral("exist [X-KDE-Version] and [X-KDE-Version] >= 4"),
+        QStringLiteral("[X-KDE-Version] + 1 > 5"),
+        QStringLiteral("InitialPreference * 2 - 1 > 3"),
+        QStringLiteral("InitialPreference / 2 <= 2"),
+        QStringLiteral("max InitialPreference > 0.5"),
+        QStringLiteral("min InitialPreference < 0.5"),
+        QStringLiteral("true and (Library == 'fakepart' or Library == 'otherpart')"),
+        QStringLiteral("false or not (Library == 'fakepart')"),
+        QStringLiteral("Library"),
+        QStringLiteral("NoSuchProperty == 'foo'"),
+    };
+
+    for (const QString &constraint : constraints) {
+        const KTraderParse::ParseTreeBase::Ptr tree = KTraderParse::parseConstraints(constraint);
+        QVERIFY2(tree, qPrintable(constraint));
+        const KTraderParse::ParseProgram program(tree.data());
+        QVERIFY(program.instructionCount() > 0);
+        QMap<QString, KTraderParse::PreferencesMaxima> maxima; // shared, like applyProgram does
+        KService::List expectedMatches;
+        for (const KService::Ptr &service : qAsConst(services)) {
+            const int expected = KTraderParse::matchConstraint(tree.data(), service, services);
+            const int actual = KTraderParse::matchProgram(program, service, services);
+            QVERIFY2(actual == expected, qPrintable(constraint + QLatin1Char(' ') + service->entryPath()));
+            const int cached = KTraderParse::matchProgram(program, service, services, maxima);
+            QVERIFY2(cached == expected, qPrintable(constraint + QLatin1Char(' ') + service->entryPath()));
+            if (expected == 1) {
+                expectedMatches.append(service);
+            }
+        }
+
+        // Batch evaluation keeps the matching services, in order
+        KService::List filtered = services;
+        KTraderParse::applyProgram(program, filtered);
+        QCOMPARE(filtered, expectedMatches);
+
+        // Same for a list large enough to be evaluated by several threads
+        KService::List largeList;
+        KService::List largeExpected;
+        for (int i = 0; i < 100; ++i) {
+            largeList += services;
+            largeExpected += expectedMatches;
+        }
+        KServiceTypeTrader::applyConstraints(largeList, constraint);
+        QCOMPARE(largeList, largeExpected);
+    }
+
+    // Lists of doubles only come from JSON metadata
+    QJsonObject json;
+    json[QStringLiteral("X-KDE-TestDoubles")] = QJsonArray({1.5, 2.5});
+    const KPluginInfo info(KPluginMetaData(json, QStringLiteral("fakedoubleplugin")));
+    QVERIFY(info.isValid());
+    const KPluginInfo::List infos = {info};
+    const QStringList doubleConstraints = {
+        QStringLiteral("2.5 in [X-KDE-TestDoubles]"),
+        QStringLiteral("3.5 in [X-KDE-TestDoubles]"),
+    };
+    const QVector<int> doubleResults = {1, 0};
+    for (int i = 0; i < doubleConstraints.count(); ++i) {
+        const QString &constraint = doubleConstraints.at(i);
+        const KTraderParse::ParseTreeBase::Ptr tree = KTraderParse::parseConstraints(constraint);
+        QVERIFY2(tree, qPrintable(constraint));
+        const KTraderParse::ParseProgram program(tree.data());
+        QCOMPARE(KTraderParse::matchConstraintPlugin(tree.data(), info, infos), doubleResults.at(i));
+        QCOMPARE(KTraderParse::matchProgramPlugin(program, info, infos), doubleResults.at(i));
+    }
+
+    // An empty program matches everything, like a null tree
+    const KTraderParse::ParseProgram empty(nullptr);
+    QCOMPARE(KTraderParse::matchProgram(empty, services.first(), services), 1);
+}
+
+void KServiceTest::testPropertyIndexes()
+{
+    if (!KSycoca::isAvailable()) {
+        QSKIP("ksycoca not available");
+    }
+
+    KSycoca::self()->ensureCacheValid();
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    const KService::Ptr plugin = KService::serviceByDesktopPath(QStringLiteral("faketextplugin.desktop"));
+    QVERIFY(plugin);
+
+    QVector<qint32> offsets;
+    QVERIFY(factory->lookupPropertyIndex(QStringLiteral("Library"), KServiceFactory::PropertyEquals, QStringLiteral("faketextplugin"), offsets));
+    QCOMPARE(offsets, QVector<qint32>() << plugin->offset());
+    QVERIFY(factory->lookupPropertyIndex(QStringLiteral("Library"), KServiceFactory::PropertyExists, QString(), offsets));
+    QVERIFY(offsets.contains(plugin->offset()));
+    QVERIFY(std::is_sorted(offsets.constBegin(), offsets.constEnd()));
+    QVERIFY(factory->lookupPropertyIndex(QStringLiteral("Library"), KServiceFactory::PropertyEquals, QStringLiteral("nosuchlibrary"), offsets));
+    QVERIFY(offsets.isEmpty());
+    // Not indexed
+    QVERIFY(!factory->lookupPropertyIndex(QStringLiteral("X-KDE-Version"), KServiceFactory::PropertyExists, QString(), offsets));
+
+    // The indexes must not change the results
+    KService::List offers = KServiceTypeTrader::self()->query(QStringLiteral("FakePluginType"), QStringLiteral("exist Library and 'faketextplugin' == Library"));
+    QCOMPARE(offers.count(), 1);
+    QVERIFY(offerListHasService(offers, QStringLiteral("faketextplugin.desktop")));
+    offers = KServiceTypeTrader::self()->query(QStringLiteral("FakePluginType"), QStringLiteral("Library == 'nosuchlibrary'"));
+    QVERIFY(offers.isEmpty());
+    offers = KServiceTypeTrader::self()->query(QStringLiteral("FakeBasePart"), QStringLiteral("(exist Library) and ((Library == 'fakepart') or (Library == 'otherpart'))"));
+    QCOMPARE(offers.count(), 2);
+    QVERIFY(offerListHasService(offers, QStringLiteral("fakepart.desktop")));
+    QVERIFY(offerListHasService(offers, QStringLiteral("otherpart.desktop")));
+}
+
 void KServiceTest::testHasServiceType1() // with services constructed with a full path (rare)
 {
     QString fakepartPath = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QLatin1String("kservices5/") + "fakepart.desktop");
@@ -695,6 +834,198 @@ void KServiceTest::testDeleteServiceTypeProfile()
     QCOMPARE(offers[0]->entryPath(), m_firstOffer);
 }
 
+void KServiceTest::testPreferredServiceFirstOffer()
+{
+    // preferredService only decodes the first matching offer,
+    // it must still agree with the full query
+    const QStringList mimeTypes = QStringList() << QStringLiteral("text/plain") << QStringLiteral("text/html")
+                                  << QStringLiteral("application/pdf") << QStringLiteral("x-scheme-handler/unknown");
+    const QStringList genericServiceTypes = QStringList() << QStringLiteral("Application") << QStringLiteral("KParts/ReadOnlyPart");
+    for (const QString &mimeType : mimeTypes) {
+        for (const QString &genericServiceType : genericServiceTypes) {
+            const KService::List offers = KMimeTypeTrader::self()->query(mimeType, genericServiceType);
+            KService::Ptr expected;
+            if (!offers.isEmpty() && offers.first()->allowAsDefault()) {
+                expected = offers.first();
+            }
+            const KService::Ptr preferred = KMimeTypeTrader::self()->preferredService(mimeType, genericServiceType);
+            QCOMPARE(preferred ? preferred->entryPath() : QString(), expected ? expected->entryPath() : QString());
+        }
+    }
+
+    const QString serviceType = QStringLiteral("FakeBasePart");
+    QVERIFY(!KServiceTypeProfile::hasProfile(serviceType));
+    const KService::List offers = KServiceTypeTrader::self()->query(serviceType);
+    QVERIFY(!offers.isEmpty());
+    const KService::Ptr preferred = KServiceTypeTrader::self()->preferredService(serviceType);
+    if (offers.first()->allowAsDefault()) {
+        QVERIFY(preferred);
+        QCOMPARE(preferred->entryPath(), offers.first()->entryPath());
+    } else {
+        QVERIFY(!preferred);
+    }
+}
+
+void KServiceTest::testTraderResultCache()
+{
+    const QString serviceType = QStringLiteral("FakeBasePart");
+    const KService::List uncached = KServiceTypeTrader::self()->query(serviceType);
+    QVERIFY(!uncached.isEmpty());
+
+    KServiceTypeTrader::setResultCacheEnabled(true);
+    QVERIFY(KServiceTypeTrader::isResultCacheEnabled());
+    QVERIFY(KMimeTypeTrader::isResultCacheEnabled()); // the same cache
+    QCOMPARE(KServiceTypeTrader::resultCacheHitRate(), 0.0);
+
+    KService::List offers = KServiceTypeTrader::self()->query(serviceType);
+    QCOMPARE(offers, uncached);
+    offers = KServiceTypeTrader::self()->query(serviceType);
+    QCOMPARE(offers, uncached);
+    QCOMPARE(KServiceTypeTrader::resultCacheHitRate(), 0.5);
+
+    // Same for the mimetype trader, and for the preferred services
+    const KService::List parts = KMimeTypeTrader::self()->query(QStringLiteral("text/plain"), QStringLiteral("KParts/ReadOnlyPart"));
+    QCOMPARE(KMimeTypeTrader::self()->query(QStringLiteral("text/plain"), QStringLiteral("KParts/ReadOnlyPart")), parts);
+    const KService::Ptr preferred = KServiceTypeTrader::self()->preferredService(serviceType);
+    QCOMPARE(KServiceTypeTrader::self()->preferredService(serviceType), preferred);
+
+    // Modifying the profile invalidates the cache
+    KService::List services;
+    services.append(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    QVERIFY(services.first());
+    KServiceTypeProfile::writeServiceTypeProfile(serviceType, services, KService::List());
+    offers = KServiceTypeTrader::self()->query(serviceType);
+    QCOMPARE(offers.first()->entryPath(), QStringLiteral("fakepart.desktop"));
+    KServiceTypeProfile::deleteServiceTypeProfile(serviceType);
+    QCOMPARE(KServiceTypeTrader::self()->query(serviceType), uncached);
+
+    // So does closing the database
+    KSycoca::clearCaches();
+    const double hitRate = KServiceTypeTrader::resultCacheHitRate();
+    QCOMPARE(KServiceTypeTrader::self()->query(serviceType), uncached);
+    QVERIFY(KServiceTypeTrader::resultCacheHitRate() < hitRate);
+
+    KMimeTypeTrader::setResultCacheEnabled(false);
+    QVERIFY(!KServiceTypeTrader::isResultCacheEnabled());
+}
+
+void KServiceTest::testCompiledProfile()
+{
+    const QString serviceType = QStringLiteral("FakeBasePart");
+    const KService::Ptr preferredPart = KService::serviceByDesktopPath(QStringLiteral("preferredpart.desktop"));
+    const KService::Ptr fakePart = KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop"));
+    const KService::Ptr fakePart2 = KService::serviceByDesktopPath(QStringLiteral("fakepart2.desktop"));
+    QVERIFY(preferredPart);
+    QVERIFY(fakePart);
+    QVERIFY(fakePart2);
+
+    // kbuildsycoca stores the offers sorted according to the profile
+    KServiceTypeProfile::writeServiceTypeProfile(serviceType, KService::List() << preferredPart << fakePart, KService::List() << fakePart2);
+    runKBuildSycoca();
+    KService::List offers = KServiceTypeTrader::self()->query(serviceType);
+    QVERIFY(offers.count() >= 2);
+    QCOMPARE(offers[0]->entryPath(), QStringLiteral("preferredpart.desktop"));
+    QCOMPARE(offers[1]->entryPath(), QStringLiteral("fakepart.desktop"));
+    QVERIFY(!offerListHasService(offers, QStringLiteral("fakepart2.desktop")));
+    QCOMPARE(KServiceTypeTrader::self()->preferredService(serviceType)->entryPath(), QStringLiteral("preferredpart.desktop"));
+
+    // Those are outdated as soon as the profile changes
+    KServiceTypeProfile::writeServiceTypeProfile(serviceType, KService::List() << fakePart << preferredPart, KService::List());
+    offers = KServiceTypeTrader::self()->query(serviceType);
+    QVERIFY(offers.count() >= 3);
+    QCOMPARE(offers[0]->entryPath(), QStringLiteral("fakepart.desktop"));
+    QCOMPARE(offers[1]->entryPath(), QStringLiteral("preferredpart.desktop"));
+    QVERIFY(offerListHasService(offers, QStringLiteral("fakepart2.desktop")));
+    QCOMPARE(KServiceTypeTrader::self()->preferredService(serviceType)->entryPath(), QStringLiteral("fakepart.desktop"));
+
+    KServiceTypeProfile::deleteServiceTypeProfile(serviceType);
+    QVERIFY(!KServiceTypeProfile::hasProfile(serviceType));
+}
+
+void KServiceTest::testIncrementalBuildCopiesEntries()
+{
+    const KService::Ptr fakePart = KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop"));
+    QVERIFY(fakePart);
+    const QStringList mimeTypes = fakePart->mimeTypes();
+    const QString library = fakePart->library();
+    const QStringList propertyNames = fakePart->propertyNames();
+
+    // A new service changes the offers of the unchanged mimetypes and servicetypes,
+    // the unchanged services are copied as is from the previous database
+    const QString serviceName = QStringLiteral("fakeservice_incremental.desktop");
+    createFakeService(serviceName, QStringLiteral("FakePluginType"));
+    runKBuildSycoca();
+
+    const KService::Ptr copiedPart = KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop"));
+    QVERIFY(copiedPart);
+    QCOMPARE(copiedPart->mimeTypes(), mimeTypes);
+    QCOMPARE(copiedPart->library(), library);
+    QCOMPARE(copiedPart->propertyNames(), propertyNames);
+    QCOMPARE(copiedPart->showInCurrentDesktop(), fakePart->showInCurrentDesktop());
+    QVERIFY(offerListHasService(KMimeTypeTrader::self()->query(QStringLiteral("text/plain"), QStringLiteral("KParts/ReadOnlyPart")),
+                                QStringLiteral("fakepart.desktop")));
+    QVERIFY(offerListHasService(KServiceTypeTrader::self()->query(QStringLiteral("FakePluginType")), serviceName));
+
+    const QString servPath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/kservices5/") + serviceName;
+    QFile::remove(servPath);
+    runKBuildSycoca();
+    QVERIFY(!KService::serviceByDesktopPath(serviceName));
+    QVERIFY(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+}
+
+void KServiceTest::testUnchangedDatabaseIsKept()
+{
+    QVERIFY(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    const QString path = KSycoca::absoluteFilePath();
+    QFile database(path);
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    const QByteArray before = database.readAll();
+    database.close();
+    const QDateTime lastModified = QFileInfo(path).lastModified();
+    const quint32 generation = KSycocaPrivate::self()->m_databaseGeneration;
+
+    // Nothing changed: the file isn't touched, only the timestamps are written next to it,
+    // and the apps using it neither get notified nor reopen it
+    QSignalSpy spy(KSycoca::self(), SIGNAL(databaseChanged(QStringList)));
+    KBuildSycoca builder;
+    QVERIFY(builder.recreate());
+    QVERIFY(!spy.wait(1000));
+
+    QCOMPARE(QFileInfo(path).lastModified(), lastModified);
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    QCOMPARE(database.readAll(), before);
+    database.close();
+    QVERIFY(QFile::exists(KSycocaStamps::filePath(path)));
+    QVERIFY(!KSycoca::self()->needsRebuild());
+    QVERIFY(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    QCOMPARE(KSycocaPrivate::self()->m_databaseGeneration, generation);
+}
+
+void KServiceTest::testUnpublishedSegmentIsIgnored()
+{
+    QVERIFY(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    const KSycocaTrailer trailer = KSycocaPrivate::self()->m_trailer;
+    QVERIFY(!trailer.digest.isEmpty());
+
+    // A segment being appended, or left behind by a crash: the readers keep using
+    // the current header, not the one of the last full image
+    QFile database(KSycoca::absoluteFilePath());
+    QVERIFY(database.open(QIODevice::ReadWrite));
+    const qint64 size = database.size();
+    QVERIFY(database.seek(size));
+    QVERIFY(database.write(QByteArray(3 * KSycocaTrailer::Size + 3, 'x')) > 0);
+    database.flush();
+
+    KSycoca::clearCaches();
+    QVERIFY(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    QCOMPARE(KSycocaPrivate::self()->m_trailer.headerOffset, trailer.headerOffset);
+    QCOMPARE(KSycocaPrivate::self()->m_trailer.digest, trailer.digest);
+
+    QVERIFY(database.resize(size));
+    database.close();
+    KSycoca::clearCaches();
+}
+
 void KServiceTest::testActionsAndDataStream()
 {
     if (QStandardPaths::locate(QStandardPaths::ApplicationsLocation, QStringLiteral("org.kde.konsole.desktop")).isEmpty()) {
@@ -819,6 +1150,67 @@ void KServiceTest::testThreads()
     sync.waitForFinished();
 }
 
+void KServiceTest::parseConstraints()
+{
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(KTraderParse::parseConstraints(QStringLiteral("(exist Library) and ('txtlug' subseq Library or [X-KDE-Version] > 4.5)")));
+        QVERIFY(KTraderParse::parseConstraints(QStringLiteral("'item2' in [X-KDE-TestList] and not (Library == 'foo')")));
+        // Parse errors, the partial trees and strings must be freed
+        QVERIFY(!KTraderParse::parseConstraints(QStringLiteral("A == B OR C == D AND OR Foo == 'Parse Error'")));
+        QVERIFY(!KTraderParse::parseConstraints(QStringLiteral("('unterminated' == Library")));
+    }
+}
+
+void KServiceTest::testParserThreads()
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(10);
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < 5; ++i) {
+        sync.addFuture(QtConcurrent::run(this, &KServiceTest::parseConstraints));
+    }
+    sync.waitForFinished();
+    QThreadPool::globalInstance()->setMaxThreadCount(1); // delete those threads
+}
+
+void KServiceTest::readProfiles()
+{
+    // The profile is being rewritten by the main thread, reading it must not block nor crash
+    for (int i = 0; i < 1000; ++i) {
+        KServiceTypeProfile::hasProfile(QStringLiteral("FakeBasePart"));
+        QVERIFY(!KServiceTypeProfile::hasProfile(QStringLiteral("FakeUnknownPart")));
+    }
+}
+
+void KServiceTest::testProfileThreads()
+{
+    const QString serviceType = QStringLiteral("FakeBasePart");
+    KService::List services;
+    services.append(KService::serviceByDesktopPath(QStringLiteral("fakepart.desktop")));
+    QVERIFY(services.first());
+
+    QThreadPool::globalInstance()->setMaxThreadCount(10);
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < 4; ++i) {
+        sync.addFuture(QtConcurrent::run(this, &KServiceTest::readProfiles));
+    }
+    for (int i = 0; i < 10; ++i) {
+        KServiceTypeProfile::writeServiceTypeProfile(serviceType, services, KService::List());
+        QVERIFY(KServiceTypeProfile::hasProfile(serviceType));
+        KServiceTypeProfile::deleteServiceTypeProfile(serviceType);
+        QVERIFY(!KServiceTypeProfile::hasProfile(serviceType));
+    }
+    sync.waitForFinished();
+    QThreadPool::globalInstance()->setMaxThreadCount(1); // delete those threads
+
+    // The profile survives a ksycoca change, whether or not it's parsed again
+    KServiceTypeProfile::writeServiceTypeProfile(serviceType, services, KService::List());
+    KSycoca::clearCaches();
+    QVERIFY(KServiceTypeProfile::hasProfile(serviceType));
+    QCOMPARE(KServiceTypeTrader::self()->query(serviceType).first()->entryPath(), QStringLiteral("fakepart.desktop"));
+    KServiceTypeProfile::deleteServiceTypeProfile(serviceType);
+    QVERIFY(!KServiceTypeProfile::hasProfile(serviceType));
+}
+
 void KServiceTest::testOperatorKPluginName()
 {
     KService fservice(QFINDTESTDATA("fakeplugin.desktop"));
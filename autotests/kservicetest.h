@@ -40,11 +40,19 @@ private Q_SLOTS:
     void testServiceTypeTraderForReadOnlyPart();
     void testTraderConstraints();
     void testSubseqConstraints();
+    void testTraderConstraintsProgram();
+    void testPropertyIndexes();
     void testHasServiceType1();
     void testHasServiceType2();
     void testWriteServiceTypeProfile();
     void testDefaultOffers();
     void testDeleteServiceTypeProfile();
+    void testPreferredServiceFirstOffer();
+    void testTraderResultCache();
+    void testCompiledProfile();
+    void testIncrementalBuildCopiesEntries();
+    void testUnchangedDatabaseIsKept();
+    void testUnpublishedSegmentIsIgnored();
     void testDBUSStartupType();
     void testByStorageId();
     void testActionsAndDataStream();
@@ -52,6 +60,8 @@ private Q_SLOTS:
     void testDeletingService();
     void testReaderThreads();
     void testThreads();
+    void testParserThreads();
+    void testProfileThreads();
     void testOperatorKPluginName();
     void testKPluginInfoQuery();
     void testCompleteBaseName();
@@ -61,6 +71,8 @@ private Q_SLOTS:
 private:
     void createFakeService(const QString &filenameSuffix, const QString &serviceType);
     void runKBuildSycoca(bool noincremental = false);
+    void parseConstraints();
+    void readProfiles();
 
     QString m_firstOffer;
     bool m_hasKde5Konsole;
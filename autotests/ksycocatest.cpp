@@ -50,6 +50,14 @@ static const int s_waitDelay = 10;
 
 extern KSERVICE_EXPORT int ksycoca_ms_between_checks;
 
+// When only the timestamps change, kbuildsycoca writes them next to the database, see KSycocaStamps
+static QDateTime lastRebuild()
+{
+    const QDateTime database = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime stamps = QFileInfo(KSycocaStamps::filePath(KSycoca::absoluteFilePath())).lastModified();
+    return stamps.isValid() && stamps > database ? stamps : database;
+}
+
 class KSycocaTest : public QObject
 {
     Q_OBJECT
@@ -89,6 +97,7 @@ private Q_SLOTS:
     void dirInFutureShouldRebuildSycocaOnce();
     void dirTimestampShouldBeCheckedRecursively();
     void recursiveCheckShouldIgnoreLinksGoingUp();
+    void backgroundRebuildShouldKeepServingDatabase();
     void testAllResourceDirs();
     void testDeletingSycoca();
     void testGlobalSycoca();
@@ -143,7 +152,7 @@ void KSycocaTest::kBuildSycocaShouldEmitDatabaseChanged()
 
 void KSycocaTest::dirInFutureShouldRebuildSycocaOnce()
 {
-    const QDateTime oldTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime oldTimestamp = lastRebuild();
 
     // ### use QFile::setFileTime when it lands in Qt...
 #ifdef Q_OS_UNIX
@@ -164,13 +173,13 @@ void KSycocaTest::dirInFutureShouldRebuildSycocaOnce()
     QTest::qWait(s_waitDelay);
 
     KSycoca::self()->ensureCacheValid();
-    const QDateTime newTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime newTimestamp = lastRebuild();
     QVERIFY(newTimestamp > oldTimestamp);
 
     QTest::qWait(s_waitDelay);
 
     KSycoca::self()->ensureCacheValid();
-    const QDateTime againTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime againTimestamp = lastRebuild();
     QCOMPARE(againTimestamp, newTimestamp); // same mtime, it didn't get rebuilt
 
     // Ensure we don't pollute the other tests, with our dir in the future.
@@ -187,7 +196,7 @@ void KSycocaTest::dirTimestampShouldBeCheckedRecursively()
 #ifndef Q_OS_UNIX
     QSKIP("This test requires utime");
 #endif
-    const QDateTime oldTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime oldTimestamp = lastRebuild();
 
     const QString path = menusDir() + QLatin1String("/fakeSubserviceDirectory");
 
@@ -208,7 +217,7 @@ void KSycocaTest::dirTimestampShouldBeCheckedRecursively()
 
     qDebug() << "Waited 1s, calling ensureCacheValid (should rebuild)";
     KSycoca::self()->ensureCacheValid();
-    const QDateTime newTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime newTimestamp = lastRebuild();
     if (newTimestamp <= oldTimestamp) {
         qWarning() << "oldTimestamp=" << oldTimestamp << "newTimestamp=" << newTimestamp;
     }
@@ -218,7 +227,7 @@ void KSycocaTest::dirTimestampShouldBeCheckedRecursively()
 
     qDebug() << "Waited 1s, calling ensureCacheValid (should not rebuild)";
     KSycoca::self()->ensureCacheValid();
-    const QDateTime againTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime againTimestamp = lastRebuild();
     QCOMPARE(againTimestamp, newTimestamp); // same mtime, it didn't get rebuilt
 
     // Ensure we don't pollute the other tests
@@ -236,7 +245,7 @@ void KSycocaTest::recursiveCheckShouldIgnoreLinksGoingUp()
     QTest::qWait(s_waitDelay);
     KSycoca::self()->ensureCacheValid();
     QVERIFY2(QFile::exists(KSycoca::absoluteFilePath()), qPrintable(KSycoca::absoluteFilePath()));
-    const QDateTime oldTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime oldTimestamp = lastRebuild();
     QVERIFY(oldTimestamp.isValid());
 
     const QString path = QFileInfo(menusDir()).absolutePath(); // the parent of the menus dir
@@ -258,13 +267,41 @@ void KSycocaTest::recursiveCheckShouldIgnoreLinksGoingUp()
 
     qDebug() << "Waited 1s, calling ensureCacheValid (should not rebuild)";
     KSycoca::self()->ensureCacheValid();
-    const QDateTime againTimestamp = QFileInfo(KSycoca::absoluteFilePath()).lastModified();
+    const QDateTime againTimestamp = lastRebuild();
     QCOMPARE(againTimestamp, oldTimestamp); // same mtime, it didn't get rebuilt
 
     // Ensure we don't pollute the other tests
     QFile(link).remove();
 }
 
+void KSycocaTest::backgroundRebuildShouldKeepServingDatabase()
+{
+    ksycoca_ms_between_checks = 0;
+    KSycoca::self()->ensureCacheValid();
+    QVERIFY(KServiceType::serviceType(QStringLiteral("FakeGlobalServiceType")));
+    const QString fakeService = serviceTypesDir() + QLatin1String("/fakeBackgroundServiceType.desktop");
+    QTest::qWait(s_waitDelay);
+    KDesktopFile file(fakeService);
+    KConfigGroup group = file.desktopGroup();
+    group.writeEntry("Comment", "Fake Background ServiceType");
+    group.writeEntry("Type", "ServiceType");
+    group.writeEntry("X-KDE-ServiceType", "FakeBackgroundServiceType");
+    file.sync();
+
+    KSycoca::setRebuildPolicy(KSycoca::BackgroundRebuild);
+    QSignalSpy spy(KSycoca::self(), &KSycoca::rebuildFinished);
+    KSycoca::self()->ensureCacheValid();
+    // No check until the next ensureCacheValid(): the rebuild is only picked up through the signal
+    ksycoca_ms_between_checks = 1500;
+    QVERIFY(!KServiceType::serviceType(QStringLiteral("FakeBackgroundServiceType")));
+    QVERIFY(spy.wait(20000));
+    QCOMPARE(spy.at(0).at(0).toBool(), true);
+    QVERIFY(KServiceType::serviceType(QStringLiteral("FakeBackgroundServiceType")));
+    KSycoca::setRebuildPolicy(KSycoca::BlockingRebuild);
+
+    // Ensure we don't pollute the other tests
+    QVERIFY(QFile::remove(fakeService));
+}
 
 void KSycocaTest::runKBuildSycoca(const QProcessEnvironment &environment, bool global)
 {
@@ -18,6 +18,7 @@
  */
 
 #include <kbuildsycoca_p.h>
+#include "kbuildsycocadaemon.h"
 
 #include "../../kservice_version.h"
 
@@ -92,6 +93,20 @@ int main(int argc, char **argv)
                 i18nc("@info:shell command-line option",
                       "Track menu id for debug purposes"),
                 QStringLiteral("menu-id")));
+    parser.addOption(QCommandLineOption(QStringLiteral("daemon"),
+                i18nc("@info:shell command-line option",
+                      "Keep running, and update the database as soon as the watched directories change")));
+    parser.addOption(QCommandLineOption(QStringLiteral("profile"),
+                i18nc("@info:shell command-line option",
+                      "Print the time spent in each phase of the build, as JSON")));
+    parser.addOption(QCommandLineOption(QStringLiteral("profile-file"),
+                i18nc("@info:shell command-line option",
+                      "Write the time spent in each phase of the build to <file>, as JSON (also loadable as a Chrome trace)"),
+                QStringLiteral("file")));
+    parser.addOption(QCommandLineOption(QStringLiteral("sync"),
+                i18nc("@info:shell command-line option",
+                      "How long writing the database waits for the disk: none, data (default) or all"),
+                QStringLiteral("policy")));
     parser.addOption(QCommandLineOption(QStringLiteral("testmode"),
                 i18nc("@info:shell command-line option",
                       "Switch QStandardPaths to test mode, for unit tests only")));
@@ -117,6 +132,14 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "%s running...\n", KBUILDSYCOCA_EXENAME);
 
+    if (parser.isSet(QStringLiteral("daemon"))) {
+        KBuildSycocaDaemon daemon(bGlobalDatabase);
+        if (!daemon.start()) {
+            return -1;
+        }
+        return app.exec();
+    }
+
     const bool incremental = !bGlobalDatabase && !parser.isSet(QStringLiteral("noincremental"));
 
     KBuildSycoca sycoca(bGlobalDatabase); // Build data base
@@ -124,6 +147,17 @@ int main(int argc, char **argv)
         sycoca.setTrackId(parser.value(QStringLiteral("track")));
     }
     sycoca.setMenuTest(bMenuTest);
+    const QString syncPolicy = parser.value(QStringLiteral("sync"));
+    if (syncPolicy == QLatin1String("none")) {
+        sycoca.setSyncPolicy(KSycocaImageWriter::NoSync);
+    } else if (syncPolicy == QLatin1String("all")) {
+        sycoca.setSyncPolicy(KSycocaImageWriter::SyncAll);
+    }
+    if (parser.isSet(QStringLiteral("profile-file"))) {
+        sycoca.setProfileFile(parser.value(QStringLiteral("profile-file")));
+    } else if (parser.isSet(QStringLiteral("profile"))) {
+        sycoca.setProfileFile(QStringLiteral("-"));
+    }
     if (!sycoca.recreate(incremental)) {
         return -1;
     }
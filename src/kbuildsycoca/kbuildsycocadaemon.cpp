@@ -0,0 +1,108 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include "kbuildsycocadaemon.h"
+
+#include <kbuildsycoca_p.h>
+#include <ksycoca.h>
+
+#include <QDebug>
+
+const int KBuildSycocaDaemon::s_quietPeriod;
+const int KBuildSycocaDaemon::s_maxDelay;
+
+static QString databasePath(bool globalDatabase)
+{
+    return KSycoca::absoluteFilePath(globalDatabase ? KSycoca::GlobalDatabase : KSycoca::LocalDatabase);
+}
+
+KBuildSycocaDaemon::KBuildSycocaDaemon(bool globalDatabase, QObject *parent)
+    : QObject(parent),
+      m_globalDatabase(globalDatabase),
+      m_lockFile(KBuildSycoca::daemonLockPath(databasePath(globalDatabase))),
+      m_dirWatch(this)
+{
+    m_lockFile.setStaleLockTime(0); // see KBuildSycoca::isDaemonRunning
+    m_rebuildTimer.setSingleShot(true);
+    connect(&m_rebuildTimer, &QTimer::timeout, this, &KBuildSycocaDaemon::rebuild);
+    connect(&m_dirWatch, &KDirWatch::dirty, this, &KBuildSycocaDaemon::slotChanged);
+    connect(&m_dirWatch, &KDirWatch::created, this, &KBuildSycocaDaemon::slotChanged);
+    connect(&m_dirWatch, &KDirWatch::deleted, this, &KBuildSycocaDaemon::slotChanged);
+}
+
+KBuildSycocaDaemon::~KBuildSycocaDaemon()
+{
+}
+
+bool KBuildSycocaDaemon::start()
+{
+    if (!m_lockFile.tryLock(0)) {
+        qWarning() << KBUILDSYCOCA_EXENAME << "--daemon is already running for" << databasePath(m_globalDatabase);
+        return false;
+    }
+    rebuild();
+    return true;
+}
+
+void KBuildSycocaDaemon::slotChanged(const QString &path)
+{
+    Q_UNUSED(path)
+    if (!m_pendingSince.isValid()) {
+        m_pendingSince.start();
+    }
+    const qint64 remaining = s_maxDelay - m_pendingSince.elapsed();
+    m_rebuildTimer.start(int(qBound<qint64>(0, remaining, s_quietPeriod)));
+}
+
+void KBuildSycocaDaemon::rebuild()
+{
+    m_pendingSince.invalidate();
+
+    // Start from the database published last, whoever wrote it
+    KSycoca::clearCaches();
+
+    // A full database is renamed over the old one, a small update is appended
+    // to it (see KSycocaTrailer): the applications never use a partially written one.
+    // The unchanged entries are taken from the old one, see KSycocaFactory::setPreviousDatabase.
+    KBuildSycoca builder(m_globalDatabase);
+    if (!builder.recreate(!m_globalDatabase)) {
+        qWarning() << "Rebuilding" << databasePath(m_globalDatabase) << "failed";
+    }
+
+    // Watch the resource dirs listed in the new one
+    KSycoca::clearCaches();
+    updateWatches();
+    emit rebuilt();
+}
+
+void KBuildSycocaDaemon::updateWatches()
+{
+    // The resource dirs, existing or not, recursively and with their files,
+    // since editing a desktop file in place doesn't change the mtime of its dir
+    const QStringList resourceDirs = KBuildSycoca::factoryResourceDirs() + KSycoca::self()->allResourceDirs();
+    for (const QString &dir : resourceDirs) {
+        if (!m_dirWatch.contains(dir)) {
+            m_dirWatch.addDir(dir, KDirWatch::WatchSubDirs | KDirWatch::WatchFiles);
+        }
+    }
+    const QStringList files = KBuildSycoca::mimeAppsFiles();
+    for (const QString &file : files) {
+        if (!m_dirWatch.contains(file)) {
+            m_dirWatch.addFile(file);
+        }
+    }
+}
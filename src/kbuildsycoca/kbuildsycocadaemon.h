@@ -0,0 +1,78 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef KBUILDSYCOCADAEMON_H
+#define KBUILDSYCOCADAEMON_H
+
+#include <KDirWatch>
+#include <kbuildsycoca_p.h>
+
+#include <QElapsedTimer>
+#include <QLockFile>
+#include <QObject>
+#include <QTimer>
+
+/**
+ * kbuildsycoca5 --daemon: watches the resource dirs and the mimeapps.list
+ * files, and rebuilds the database incrementally once a burst of changes
+ * (e.g. a package manager installing many files) is over.
+ * While it runs, the applications don't rebuild the database themselves,
+ * see KBuildSycoca::isDaemonRunning().
+ */
+class KBuildSycocaDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit KBuildSycocaDaemon(bool globalDatabase, QObject *parent = nullptr);
+    ~KBuildSycocaDaemon() override;
+
+    /**
+     * Builds the database, then starts watching.
+     * @return false if another daemon already takes care of this database
+     */
+    bool start();
+
+    /**
+     * Once nothing changed for that long, in ms, the database is rebuilt...
+     */
+    static const int s_quietPeriod = 500;
+    /**
+     * ...but a never-ending burst of changes doesn't delay the rebuild more than that
+     */
+    static const int s_maxDelay = KBuildSycoca::DaemonMaxDelay;
+
+Q_SIGNALS:
+    /**
+     * Emitted after each rebuild, successful or not
+     */
+    void rebuilt();
+
+private:
+    friend class KBuildSycocaDaemonTest;
+
+    void slotChanged(const QString &path);
+    void rebuild();
+    void updateWatches();
+
+    bool m_globalDatabase;
+    QLockFile m_lockFile;
+    KDirWatch m_dirWatch;
+    QTimer m_rebuildTimer;
+    QElapsedTimer m_pendingSince; // first change not rebuilt yet
+};
+
+#endif
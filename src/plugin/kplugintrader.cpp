@@ -19,7 +19,7 @@
 */
 
 #include "kplugintrader.h"
-#include "ktraderparsetree_p.h"
+#include "ktraderparseprogram_p.h"
 
 #include <QCoreApplication>
 #include <QDirIterator>
@@ -61,20 +61,14 @@ void KPluginTrader::applyConstraints(KPluginInfo::List &lst, const QString &cons
     }
 
     const ParseTreeBase::Ptr constr = parseConstraints(constraint); // for ownership
-    const ParseTreeBase *pConstraintTree = constr.data(); // for speed
 
     if (!constr) { // parse error
         lst.clear();
     } else {
+        const ParseProgram program(constr.data()); // for speed
+
         // Find all plugin information matching the constraint and remove the rest
-        KPluginInfo::List::iterator it = lst.begin();
-        while (it != lst.end()) {
-            if (matchConstraintPlugin(pConstraintTree, *it, lst) != 1) {
-                it = lst.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        applyProgramPlugin(program, lst);
     }
 }
 
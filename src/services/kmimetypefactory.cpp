@@ -25,8 +25,20 @@
 extern int servicesDebugArea();
 
 KMimeTypeFactory::KMimeTypeFactory(KSycoca *db)
-    : KSycocaFactory(KST_KMimeTypeFactory, db)
+    : KSycocaFactory(KST_KMimeTypeFactory, db),
+      m_aliasTableOffset(0),
+      m_aliasTableLoaded(false)
 {
+    if (!sycoca()->isBuilding()) {
+        QDataStream *str = stream();
+        if (!str) {
+            return;
+        }
+        // Read Header
+        qint32 i;
+        (*str) >> i;
+        m_aliasTableOffset = i;
+    }
 }
 
 KMimeTypeFactory::~KMimeTypeFactory()
@@ -62,6 +74,38 @@ int KMimeTypeFactory::serviceOffersOffset(const QString &mimeTypeName)
     return newMimeType->serviceOffersOffset();
 }
 
+bool KMimeTypeFactory::findMimeTypeOffsets(const QString &mimeTypeName, int &entryOffset, int &serviceOffersOffset)
+{
+    if (!m_aliasTableOffset) {
+        return false;
+    }
+    if (!m_aliasTableLoaded) {
+        // Load the whole table at once, it's only a few thousand names
+        m_aliasTableLoaded = true;
+        QDataStream *str = stream();
+        const qint64 savedPos = str->device()->pos();
+        str->device()->seek(m_aliasTableOffset);
+        qint32 count;
+        (*str) >> count;
+        m_aliasTable.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            QString name;
+            qint32 offset, offersOffset;
+            (*str) >> name >> offset >> offersOffset;
+            m_aliasTable.insert(name, qMakePair(offset, offersOffset));
+        }
+        str->device()->seek(savedPos);
+    }
+
+    const AliasTable::const_iterator it = m_aliasTable.constFind(mimeTypeName.toLower());
+    if (it == m_aliasTable.constEnd()) {
+        return false;
+    }
+    entryOffset = it.value().first;
+    serviceOffersOffset = it.value().second;
+    return true;
+}
+
 KMimeTypeFactory::MimeTypeEntry *KMimeTypeFactory::createEntry(int offset) const
 {
     KSycocaType type;
@@ -132,6 +176,11 @@ public:
         return m_name;
     }
     void save(QDataStream &s) override;
+    bool saveRaw(QDataStream &s, const QByteArray &raw) override;
+    int rawTailSize() const override
+    {
+        return sizeof(qint32); // the offset of the offers
+    }
 
     QString m_name;
     int m_serviceOffersOffset;
@@ -143,6 +192,19 @@ void KMimeTypeFactory::MimeTypeEntryPrivate::save(QDataStream &s)
     s << m_name << m_serviceOffersOffset;
 }
 
+bool KMimeTypeFactory::MimeTypeEntryPrivate::saveRaw(QDataStream &s, const QByteArray &raw)
+{
+    // Everything but the offset of the offers, which comes last
+    if (raw.size() < int(sizeof(qint32))) {
+        return false;
+    }
+    offset = s.device()->pos();
+    rawSize = 0;
+    s.writeRawData(raw.constData(), raw.size() - sizeof(qint32));
+    s << m_serviceOffersOffset;
+    return true;
+}
+
 ////
 
 KMimeTypeFactory::MimeTypeEntry::MimeTypeEntry(const QString &file, const QString &name)
@@ -22,6 +22,8 @@
 
 #include <assert.h>
 
+#include <QHash>
+#include <QPair>
 #include <QStringList>
 
 #include "ksycocafactory_p.h"
@@ -66,6 +68,15 @@ public:
      */
     int serviceOffersOffset(const QString &mimeTypeName);
 
+    /**
+     * Looks up @p mimeTypeName, or any of its aliases, in the table of
+     * canonical names stored in the database.
+     * @param entryOffset set to the offset of the mimetype entry
+     * @param serviceOffersOffset set to the offset into the service offers, -1 if there are none
+     * @return false if the name isn't in the table
+     */
+    bool findMimeTypeOffsets(const QString &mimeTypeName, int &entryOffset, int &serviceOffersOffset);
+
     /**
      * Returns the directories to watch for this factory.
      */
@@ -104,7 +115,15 @@ public: // public for KBuildServiceFactory
 
 protected:
     MimeTypeEntry *createEntry(int offset) const override;
+
+    // Folded (lowercase) mimetype name or alias -> entry offset and service offers offset
+    typedef QHash<QString, QPair<qint32, qint32> > AliasTable;
+
+    int m_aliasTableOffset;
 private:
+    bool m_aliasTableLoaded;
+    AliasTable m_aliasTable;
+
     // d pointer: useless since this header is not installed
     //class KMimeTypeFactoryPrivate* d;
 };
@@ -26,9 +26,14 @@
 #include "kservicetypetrader.h"
 #include "kservicefactory_p.h"
 #include "kmimetypefactory_p.h"
+#include "ktraderresultcache_p.h"
 #include "servicesdebug.h"
 #include <qmimedatabase.h>
 
+#include <QSet>
+
+#include <algorithm>
+
 class KMimeTypeTraderPrivate
 {
 public:
@@ -58,39 +63,51 @@ KMimeTypeTrader::~KMimeTypeTrader()
     delete d;
 }
 
-static KServiceOfferList mimeTypeSycocaOffers(const QString &mimeType)
+// Looks up where the offers for @p mimeType are stored.
+// Returns false if there are none.
+static bool mimeTypeSycocaOffersOffsets(const QString &mimeType, int &offset, int &serviceOffersOffset)
 {
-    KServiceOfferList lst;
+    KSycoca::self()->ensureCacheValid();
+    if (KSycocaPrivate::self()->mimeTypeFactory()->findMimeTypeOffsets(mimeType, offset, serviceOffersOffset)) {
+        return serviceOffersOffset > -1;
+    }
 
+    // Not in the table of names and aliases, resolve it the slow way, mostly for the warnings
     QMimeDatabase db;
     QString mime = db.mimeTypeForName(mimeType).name();
     if (mime.isEmpty()) {
         if (!mimeType.startsWith(QLatin1String("x-scheme-handler/"))) { // don't warn for unknown scheme handler mimetypes
             qCWarning(SERVICES) << "KMimeTypeTrader: mimeType" << mimeType << "not found";
-            return lst; // empty
+            return false;
         }
         mime = mimeType;
     }
-    KSycoca::self()->ensureCacheValid();
     KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
-    const int offset = factory->entryOffset(mime);
+    offset = factory->entryOffset(mime);
     if (!offset) { // shouldn't happen, now that we know the mimetype exists
         if (!mimeType.startsWith(QLatin1String("x-scheme-handler/"))) { // don't warn for unknown scheme handler mimetypes
             qCDebug(SERVICES) << "KMimeTypeTrader: no entry offset for" << mimeType;
         }
-        return lst; // empty
+        return false;
     }
 
-    const int serviceOffersOffset = factory->serviceOffersOffset(mime);
-    if (serviceOffersOffset > -1) {
-        lst = KSycocaPrivate::self()->serviceFactory()->offers(offset, serviceOffersOffset);
-    }
-    return lst;
+    serviceOffersOffset = factory->serviceOffersOffset(mime);
+    return serviceOffersOffset > -1;
 }
 
 static KService::List mimeTypeSycocaServiceOffers(const QString &mimeType)
 {
     KService::List lst;
+    KSycoca::self()->ensureCacheValid();
+    int offset, serviceOffersOffset;
+    if (KSycocaPrivate::self()->mimeTypeFactory()->findMimeTypeOffsets(mimeType, offset, serviceOffersOffset)) {
+        if (serviceOffersOffset > -1) {
+            lst = KSycocaPrivate::self()->serviceFactory()->serviceOffers(offset, serviceOffersOffset);
+        }
+        return lst;
+    }
+
+    // Not in the table of names and aliases, resolve it the slow way, mostly for the warnings
     QMimeDatabase db;
     QString mime = db.mimeTypeForName(mimeType).name();
     if (mime.isEmpty()) {
@@ -100,85 +117,93 @@ static KService::List mimeTypeSycocaServiceOffers(const QString &mimeType)
         }
         mime = mimeType;
     }
-    KSycoca::self()->ensureCacheValid();
     KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
-    const int offset = factory->entryOffset(mime);
+    offset = factory->entryOffset(mime);
     if (!offset) {
         qCWarning(SERVICES) << "KMimeTypeTrader: mimeType" << mimeType << "not found";
         return lst; // empty
     }
-    const int serviceOffersOffset = factory->serviceOffersOffset(mime);
+    serviceOffersOffset = factory->serviceOffersOffset(mime);
     if (serviceOffersOffset > -1) {
         lst = KSycocaPrivate::self()->serviceFactory()->serviceOffers(offset, serviceOffersOffset);
     }
     return lst;
 }
 
-#define CHECK_SERVICETYPE(genericServiceTypePtr) \
-    if (!genericServiceTypePtr) { \
-        qCWarning(SERVICES) << "KMimeTypeTrader: couldn't find service type" << genericServiceType << \
-                   "\nPlease ensure that the .desktop file for it is installed; then run kbuildsycoca5."; \
-        return; \
-    }
-
-/**
- * Filter the offers for the requested mime type for the genericServiceType.
- *
- * @param list list of offers (key=service, value=initialPreference)
- * @param genericServiceType the generic service type (e.g. "Application" or "KParts/ReadOnlyPart")
- */
-void KMimeTypeTrader::filterMimeTypeOffers(KServiceOfferList &list, const QString &genericServiceType) // static, internal
+static bool showInCurrentDesktop(const KService::Ptr &service)
 {
-    KServiceType::Ptr genericServiceTypePtr = KServiceType::serviceType(genericServiceType);
-    CHECK_SERVICETYPE(genericServiceTypePtr);
+    return service->showInCurrentDesktop();
+}
 
+// Looks up the offers of @p mimeType already filtered for @p genericServiceType
+// by kbuildsycoca. Returns false if there's no such list, the offers then
+// have to be filtered at runtime.
+static bool prefilteredMimeTypeOffers(const QString &mimeType, const QString &genericServiceType,
+                                      int maxCount, KServiceOfferList &offers)
+{
     KSycoca::self()->ensureCacheValid();
-
-    QMutableListIterator<KServiceOffer> it(list);
-    while (it.hasNext()) {
-        const KService::Ptr servPtr = it.next().service();
-        // Expand servPtr->hasServiceType( genericServiceTypePtr ) to avoid lookup each time:
-        if (!KSycocaPrivate::self()->serviceFactory()->hasOffer(genericServiceTypePtr->offset(),
-                                               genericServiceTypePtr->serviceOffersOffset(),
-                                               servPtr->offset())
-                || !servPtr->showInCurrentDesktop()) {
-            it.remove();
-        }
+    int offset, serviceOffersOffset;
+    if (!KSycocaPrivate::self()->mimeTypeFactory()->findMimeTypeOffsets(mimeType, offset, serviceOffersOffset)) {
+        return false;
     }
+    return KSycocaPrivate::self()->serviceFactory()->prefilteredOffers(genericServiceType, offset, maxCount, offers);
 }
 
-void KMimeTypeTrader::filterMimeTypeOffers(KService::List &list, const QString &genericServiceType) // static, internal
+static KService::Ptr preferredOffer(const KServiceOfferList &offers)
 {
-    KServiceType::Ptr genericServiceTypePtr = KServiceType::serviceType(genericServiceType);
-    CHECK_SERVICETYPE(genericServiceTypePtr);
+    // Look for the first one that is allowed as default.
+    // Since the allowed-as-default are first anyway, we only have
+    // to look at the first one to know.
+    if (!offers.isEmpty() && offers.first().allowAsDefault()) {
+        return offers.first().service();
+    }
 
-    KSycoca::self()->ensureCacheValid();
+    //qCDebug(SERVICES) << "No offers, or none allowed as default";
+    return KService::Ptr();
+}
 
-    QMutableListIterator<KService::Ptr> it(list);
-    while (it.hasNext()) {
-        const KService::Ptr servPtr = it.next();
-        // Expand servPtr->hasServiceType( genericServiceTypePtr ) to avoid lookup each time:
-        if (!KSycocaPrivate::self()->serviceFactory()->hasOffer(genericServiceTypePtr->offset(),
-                                               genericServiceTypePtr->serviceOffersOffset(),
-                                               servPtr->offset())
-                || !servPtr->showInCurrentDesktop()) {
-            it.remove();
-        }
+// Returns the first offer for @p mimeType accepted by the filters,
+// if it's allowed as default
+static KService::Ptr firstMimeTypeOffer(const QString &mimeType,
+                                        const KServiceFactory::OffsetFilter &offsetFilter,
+                                        const KServiceFactory::ServiceFilter &serviceFilter)
+{
+    int offset, serviceOffersOffset;
+    if (!mimeTypeSycocaOffersOffsets(mimeType, offset, serviceOffersOffset)) {
+        return KService::Ptr();
     }
+    return preferredOffer(KSycocaPrivate::self()->serviceFactory()->offers(offset, serviceOffersOffset, 1, offsetFilter, serviceFilter));
 }
 
-#undef CHECK_SERVICETYPE
-
 KService::List KMimeTypeTrader::query(const QString &mimeType,
                                       const QString &genericServiceType,
                                       const QString &constraint) const
 {
-    // Get all services of this mime type.
-    KService::List lst = mimeTypeSycocaServiceOffers(mimeType);
-    filterMimeTypeOffers(lst, genericServiceType);
+    KTraderResultCache *cache = KTraderResultCache::current();
+    KService::List lst;
+    if (cache && cache->find(KTraderResultCache::MimeTypeQuery, mimeType, genericServiceType, constraint, lst)) {
+        return lst;
+    }
+
+    KServiceOfferList offers;
+    if (prefilteredMimeTypeOffers(mimeType, genericServiceType, -1, offers)) {
+        // kbuildsycoca already did filterMimeTypeOffers
+        lst.reserve(offers.count());
+        for (const KServiceOffer &offer : qAsConst(offers)) {
+            lst.append(offer.service());
+        }
+    } else {
+        // Get all services of this mime type.
+        lst = mimeTypeSycocaServiceOffers(mimeType);
+        filterMimeTypeOffers(lst, genericServiceType);
+    }
 
     KServiceTypeTrader::applyConstraints(lst, constraint);
 
+    if (cache) {
+        cache->insert(KTraderResultCache::MimeTypeQuery, mimeType, genericServiceType, constraint, lst);
+    }
+
     //qCDebug(SERVICES) << "query for mimeType " << mimeType << ", " << genericServiceType
     //         << " : returning " << lst.count() << " offers";
     return lst;
@@ -186,21 +211,116 @@ KService::List KMimeTypeTrader::query(const QString &mimeType,
 
 KService::Ptr KMimeTypeTrader::preferredService(const QString &mimeType, const QString &genericServiceType)
 {
-    // First, get all offers known to ksycoca.
-    KServiceOfferList offers = mimeTypeSycocaOffers(mimeType);
+    KTraderResultCache *cache = KTraderResultCache::current();
+    KService::List lst;
+    if (cache && cache->find(KTraderResultCache::MimeTypePreferred, mimeType, genericServiceType, QString(), lst)) {
+        return lst.value(0);
+    }
+    const KService::Ptr service = uncachedPreferredService(mimeType, genericServiceType);
+    if (cache) {
+        if (service) {
+            lst.append(service);
+        }
+        cache->insert(KTraderResultCache::MimeTypePreferred, mimeType, genericServiceType, QString(), lst);
+    }
+    return service;
+}
 
-    // Assign preferences from the profile to those offers - and filter for genericServiceType
+KService::Ptr KMimeTypeTrader::uncachedPreferredService(const QString &mimeType, const QString &genericServiceType)
+{
     Q_ASSERT(!genericServiceType.isEmpty());
-    filterMimeTypeOffers(offers, genericServiceType);
+    KServiceOfferList offers;
+    if (prefilteredMimeTypeOffers(mimeType, genericServiceType, 1, offers)) {
+        return preferredOffer(offers);
+    }
 
-    KServiceOfferList::const_iterator itOff = offers.constBegin();
-    // Look for the first one that is allowed as default.
-    // Since the allowed-as-default are first anyway, we only have
-    // to look at the first one to know.
-    if (itOff != offers.constEnd() && (*itOff).allowAsDefault()) {
-        return (*itOff).service();
+    // Same filtering as filterMimeTypeOffers, but only until the first
+    // offer is found: the offers are stored in the order of preference.
+    KServiceFactory *serviceFactory = KSycocaPrivate::self()->serviceFactory();
+    KServiceFactory::OffsetFilter offsetFilter;
+    KServiceFactory::ServiceFilter serviceFilter;
+    const KServiceType::Ptr genericServiceTypePtr = KServiceType::serviceType(genericServiceType);
+    if (genericServiceTypePtr) {
+        const int genericOffset = genericServiceTypePtr->offset();
+        const int genericOffersOffset = genericServiceTypePtr->serviceOffersOffset();
+        offsetFilter = [serviceFactory, genericOffset, genericOffersOffset](int serviceOffset) {
+            return serviceFactory->hasOffer(genericOffset, genericOffersOffset, serviceOffset);
+        };
+        serviceFilter = showInCurrentDesktop;
+    } else {
+        qCWarning(SERVICES) << "KMimeTypeTrader: couldn't find service type" << genericServiceType <<
+                   "\nPlease ensure that the .desktop file for it is installed; then run kbuildsycoca5.";
     }
+    return firstMimeTypeOffer(mimeType, offsetFilter, serviceFilter);
+}
 
-    //qCDebug(SERVICES) << "No offers, or none allowed as default";
-    return KService::Ptr();
+QHash<QString, KService::Ptr> KMimeTypeTrader::preferredServices(const QStringList &mimeTypes, const QString &genericServiceType)
+{
+    Q_ASSERT(!genericServiceType.isEmpty());
+    QHash<QString, KService::Ptr> result;
+    KTraderResultCache *cache = KTraderResultCache::current();
+    KSycoca::self()->ensureCacheValid();
+
+    // Resolve the generic service type only once, and read all its offers
+    // (without decoding them) so that testing a service is a binary search
+    KServiceFactory::OffsetFilter offsetFilter;
+    KServiceFactory::ServiceFilter serviceFilter;
+    const KServiceType::Ptr genericServiceTypePtr = KServiceType::serviceType(genericServiceType);
+    if (genericServiceTypePtr) {
+        const QVector<qint32> genericOffers = KSycocaPrivate::self()->serviceFactory()->serviceOffsets(
+                genericServiceTypePtr->offset(), genericServiceTypePtr->serviceOffersOffset());
+        offsetFilter = [genericOffers](int serviceOffset) {
+            return std::binary_search(genericOffers.constBegin(), genericOffers.constEnd(), serviceOffset);
+        };
+        serviceFilter = showInCurrentDesktop;
+    } else {
+        qCWarning(SERVICES) << "KMimeTypeTrader: couldn't find service type" << genericServiceType <<
+                   "\nPlease ensure that the .desktop file for it is installed; then run kbuildsycoca5.";
+    }
+
+    QSet<QString> done;
+    for (const QString &mimeType : mimeTypes) {
+        if (done.contains(mimeType)) {
+            continue;
+        }
+        done.insert(mimeType);
+
+        KService::Ptr service;
+        KService::List lst;
+        if (cache && cache->find(KTraderResultCache::MimeTypePreferred, mimeType, genericServiceType, QString(), lst)) {
+            service = lst.value(0);
+        } else {
+            KServiceOfferList offers;
+            if (prefilteredMimeTypeOffers(mimeType, genericServiceType, 1, offers)) {
+                service = preferredOffer(offers);
+            } else {
+                service = firstMimeTypeOffer(mimeType, offsetFilter, serviceFilter);
+            }
+            if (cache) {
+                if (service) {
+                    lst.append(service);
+                }
+                cache->insert(KTraderResultCache::MimeTypePreferred, mimeType, genericServiceType, QString(), lst);
+            }
+        }
+        if (service) {
+            result.insert(mimeType, service);
+        }
+    }
+    return result;
+}
+
+void KMimeTypeTrader::setResultCacheEnabled(bool enable)
+{
+    KTraderResultCache::setEnabled(enable);
+}
+
+bool KMimeTypeTrader::isResultCacheEnabled()
+{
+    return KTraderResultCache::isEnabled();
+}
+
+double KMimeTypeTrader::resultCacheHitRate()
+{
+    return KTraderResultCache::hitRate();
 }
@@ -21,6 +21,9 @@
 #define KMIMETYPETRADER_H
 
 #include <kservice.h>
+
+#include <QHash>
+
 class KMimeTypeTraderPrivate;
 class KServiceOffer;
 typedef QList<KServiceOffer> KServiceOfferList;
@@ -102,6 +105,47 @@ public:
      */
     KService::Ptr preferredService(const QString &mimeType, const QString &genericServiceType = QStringLiteral("Application"));
 
+    /**
+     * Returns the preferred service for each of @p mimeTypes and @p genericServiceType
+     *
+     * This gives the same results as calling preferredService() for each mimetype,
+     * but duplicates in @p mimeTypes are only looked up once, and the generic
+     * service type is only resolved once for all of them. Useful for views
+     * showing many files, e.g. directory listings.
+     *
+     * @param mimeTypes the mime types (see query()), can contain duplicates
+     * @param genericServiceType the service type (see query())
+     * @return the preferred service for each mimetype; the mimetypes without
+     * preferred service are not in the hash
+     * @since 5.53
+     */
+    QHash<QString, KService::Ptr> preferredServices(const QStringList &mimeTypes, const QString &genericServiceType = QStringLiteral("Application"));
+
+    /**
+     * Enables caching of the results of query() and preferredService().
+     *
+     * The cache is shared with KServiceTypeTrader: this is the same as
+     * KServiceTypeTrader::setResultCacheEnabled(), see there for the details.
+     *
+     * @since 5.53
+     */
+    static void setResultCacheEnabled(bool enable);
+
+    /**
+     * @return true if the result cache is enabled
+     * @see setResultCacheEnabled
+     * @since 5.53
+     */
+    static bool isResultCacheEnabled();
+
+    /**
+     * @return the ratio of the queries answered by the result cache, for both
+     * KMimeTypeTrader and KServiceTypeTrader, between 0 and 1, since it was enabled
+     * @see setResultCacheEnabled
+     * @since 5.53
+     */
+    static double resultCacheHitRate();
+
     /**
      * This method creates and returns a part object from the trader query for a given \p mimeType.
      *
@@ -200,8 +244,10 @@ private:
     KMimeTypeTraderPrivate *const d;
 
     // class-static so that it can access KSycocaEntry::offset()
-    static void filterMimeTypeOffers(KServiceOfferList &list, const QString &genericServiceType);
     static void filterMimeTypeOffers(KService::List &list, const QString &genericServiceType);
+
+    KService::Ptr uncachedPreferredService(const QString &mimeType, const QString &genericServiceType);
+
     friend class KMimeTypeTraderSingleton;
 };
 
@@ -325,7 +325,8 @@ void KServicePrivate::load(QDataStream &s)
       >> initpref
       >> m_lstKeywords >> m_strGenName
       >> categories >> menuId >> m_actions >> m_serviceTypes
-      >> m_lstFormFactors;
+      >> m_lstFormFactors
+      >> m_visibilityFlags >> m_desktopMask >> m_onlyPlatformMask >> m_notPlatformMask;
 
     m_bAllowAsDefault = bool(def);
     m_bTerminal = bool(term);
@@ -355,7 +356,77 @@ void KServicePrivate::save(QDataStream &s)
       << initpref
       << m_lstKeywords << m_strGenName
       << categories << menuId << m_actions << m_serviceTypes
-      << m_lstFormFactors;
+      << m_lstFormFactors
+      << m_visibilityFlags << m_desktopMask << m_onlyPlatformMask << m_notPlatformMask;
+}
+
+bool KServicePrivate::saveRaw(QDataStream &s, const QByteArray &raw)
+{
+    // Nothing in a service depends on the position of other entries
+    offset = s.device()->pos();
+    rawSize = 0;
+    s.writeRawData(raw.constData(), raw.size());
+    return true;
+}
+
+// Sets the bits of the names of the ';' separated list @p value into @p mask.
+// Returns false if there are too many names.
+static bool internNames(const QVariant &value, QStringList &names, quint32 &mask)
+{
+    mask = 0;
+    const QStringList list = value.toString().split(QLatin1Char(';'));
+    for (const QString &name : list) {
+        int bit = names.indexOf(name);
+        if (bit == -1) {
+            if (names.count() == KServiceVisibilityNames::MaxNames) {
+                return false;
+            }
+            bit = names.count();
+            names.append(name);
+        }
+        mask |= 1u << bit;
+    }
+    return true;
+}
+
+void KServicePrivate::computeVisibility(QStringList &names)
+{
+    const quint8 oldFlags = m_visibilityFlags;
+    const quint32 oldDesktopMask = m_desktopMask;
+    const quint32 oldOnlyPlatformMask = m_onlyPlatformMask;
+    const quint32 oldNotPlatformMask = m_notPlatformMask;
+
+    // Same logic as showInCurrentDesktop() and showOnCurrentPlatform()
+    m_visibilityFlags = VisibilityKnown;
+    m_desktopMask = m_onlyPlatformMask = m_notPlatformMask = 0;
+
+    if (qvariant_cast<bool>(property(QStringLiteral("NoDisplay"), QVariant::Bool))) {
+        m_visibilityFlags |= NoDisplayProperty;
+    }
+
+    QMap<QString, QVariant>::ConstIterator it = m_mapProps.constFind(QStringLiteral("OnlyShowIn"));
+    if (it != m_mapProps.constEnd() && it->isValid()) {
+        m_visibilityFlags |= internNames(*it, names, m_desktopMask) ? OnlyShowIn : DesktopCheckedAtRuntime;
+    } else {
+        it = m_mapProps.constFind(QStringLiteral("NotShowIn"));
+        if (it != m_mapProps.constEnd() && it->isValid()) {
+            m_visibilityFlags |= internNames(*it, names, m_desktopMask) ? NotShowIn : DesktopCheckedAtRuntime;
+        }
+    }
+
+    it = m_mapProps.constFind(QStringLiteral("X-KDE-OnlyShowOnQtPlatforms"));
+    if (it != m_mapProps.constEnd() && it->isValid()) {
+        m_visibilityFlags |= internNames(*it, names, m_onlyPlatformMask) ? OnlyShowOnPlatforms : PlatformCheckedAtRuntime;
+    }
+    it = m_mapProps.constFind(QStringLiteral("X-KDE-NotShowOnQtPlatforms"));
+    if (it != m_mapProps.constEnd() && it->isValid()) {
+        m_visibilityFlags |= internNames(*it, names, m_notPlatformMask) ? NotShowOnPlatforms : PlatformCheckedAtRuntime;
+    }
+
+    if (m_visibilityFlags != oldFlags || m_desktopMask != oldDesktopMask
+            || m_onlyPlatformMask != oldOnlyPlatformMask || m_notPlatformMask != oldNotPlatformMask) {
+        rawSize = 0; // the copy in the previous database is outdated
+    }
 }
 
 ////
@@ -441,23 +512,33 @@ bool KService::hasServiceType(const QString &serviceType) const
 bool KService::hasMimeType(const QString &mimeType) const
 {
     Q_D(const KService);
-    QMimeDatabase db;
-    const QString mime = db.mimeTypeForName(mimeType).name();
-    if (mime.isEmpty()) {
-        return false;
-    }
     int serviceOffset = offset();
     if (serviceOffset) {
         KSycoca::self()->ensureCacheValid();
         KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
-        const int mimeOffset = factory->entryOffset(mime);
-        const int serviceOffersOffset = factory->serviceOffersOffset(mime);
+        int mimeOffset, serviceOffersOffset;
+        if (!factory->findMimeTypeOffsets(mimeType, mimeOffset, serviceOffersOffset)) {
+            // Not in the table of names and aliases
+            QMimeDatabase db;
+            const QString mime = db.mimeTypeForName(mimeType).name();
+            if (mime.isEmpty()) {
+                return false;
+            }
+            mimeOffset = factory->entryOffset(mime);
+            serviceOffersOffset = factory->serviceOffersOffset(mime);
+        }
         if (serviceOffersOffset == -1) {
             return false;
         }
         return KSycocaPrivate::self()->serviceFactory()->hasOffer(mimeOffset, serviceOffersOffset, serviceOffset);
     }
 
+    QMimeDatabase db;
+    const QString mime = db.mimeTypeForName(mimeType).name();
+    if (mime.isEmpty()) {
+        return false;
+    }
+
     // fall-back code for services that are NOT from ksycoca
     QVector<ServiceTypeAndPreference>::ConstIterator it = d->m_serviceTypes.begin();
     for (; it != d->m_serviceTypes.end(); ++it) {
@@ -565,6 +646,37 @@ QVariant KServicePrivate::property(const QString &_name, QVariant::Type t) const
     }
 }
 
+// Must match the properties handled at the beginning of KServicePrivate::property
+static QStringList builtinPropertyNames()
+{
+    return QStringList {
+        QStringLiteral("Type"),
+        QStringLiteral("Name"),
+        QStringLiteral("Comment"),
+        QStringLiteral("GenericName"),
+        QStringLiteral("Icon"),
+        QStringLiteral("Exec"),
+        QStringLiteral("Terminal"),
+        QStringLiteral("TerminalOptions"),
+        QStringLiteral("Path"),
+        QStringLiteral("ServiceTypes"),
+        QStringLiteral("AllowAsDefault"),
+        QStringLiteral("InitialPreference"),
+        QStringLiteral("Library"),
+        QStringLiteral("DesktopEntryPath"),
+        QStringLiteral("DesktopEntryName"),
+        QStringLiteral("Keywords"),
+        QStringLiteral("FormFactors"),
+        QStringLiteral("Categories")
+    };
+}
+
+bool KServicePrivate::isBuiltinProperty(const QString &_name)
+{
+    static const QStringList s_builtinProperties = builtinPropertyNames();
+    return s_builtinProperties.contains(_name);
+}
+
 QStringList KServicePrivate::propertyNames() const
 {
     QStringList res;
@@ -574,24 +686,7 @@ QStringList KServicePrivate::propertyNames() const
         res.append(it.key());
     }
 
-    res.append(QStringLiteral("Type"));
-    res.append(QStringLiteral("Name"));
-    res.append(QStringLiteral("Comment"));
-    res.append(QStringLiteral("GenericName"));
-    res.append(QStringLiteral("Icon"));
-    res.append(QStringLiteral("Exec"));
-    res.append(QStringLiteral("Terminal"));
-    res.append(QStringLiteral("TerminalOptions"));
-    res.append(QStringLiteral("Path"));
-    res.append(QStringLiteral("ServiceTypes"));
-    res.append(QStringLiteral("AllowAsDefault"));
-    res.append(QStringLiteral("InitialPreference"));
-    res.append(QStringLiteral("Library"));
-    res.append(QStringLiteral("DesktopEntryPath"));
-    res.append(QStringLiteral("DesktopEntryName"));
-    res.append(QStringLiteral("Keywords"));
-    res.append(QStringLiteral("FormFactors"));
-    res.append(QStringLiteral("Categories"));
+    res += builtinPropertyNames();
 
     return res;
 }
@@ -651,6 +746,19 @@ bool KService::showInCurrentDesktop() const
 {
     Q_D(const KService);
 
+    // Precomputed by kbuildsycoca, only a bit test is left
+    if ((d->m_visibilityFlags & KServicePrivate::VisibilityKnown) && d->m_visibilityNames
+            && !(d->m_visibilityFlags & KServicePrivate::DesktopCheckedAtRuntime)) {
+        if (!(d->m_visibilityFlags & (KServicePrivate::OnlyShowIn | KServicePrivate::NotShowIn))) {
+            return true;
+        }
+        const quint32 desktopMask = d->m_visibilityNames->currentDesktopMask();
+        if (d->m_visibilityFlags & KServicePrivate::OnlyShowIn) {
+            return d->m_desktopMask & desktopMask;
+        }
+        return !(d->m_desktopMask & desktopMask);
+    }
+
     QStringList currentDesktops(QString::fromLatin1(qgetenv("XDG_CURRENT_DESKTOP")));
     if (currentDesktops.isEmpty()) {
         // This could be an old display manager, or e.g. a failsafe session with no desktop name
@@ -686,11 +794,29 @@ bool KService::showInCurrentDesktop() const
 bool KService::showOnCurrentPlatform() const
 {
     Q_D(const KService);
+
+    // Precomputed by kbuildsycoca
+    if ((d->m_visibilityFlags & KServicePrivate::VisibilityKnown) && d->m_visibilityNames
+            && !(d->m_visibilityFlags & KServicePrivate::PlatformCheckedAtRuntime)) {
+        if (!(d->m_visibilityFlags & (KServicePrivate::OnlyShowOnPlatforms | KServicePrivate::NotShowOnPlatforms))) {
+            return true;
+        }
+    }
+
     const QString platform = QCoreApplication::instance()->property("platformName").toString();
     if (platform.isEmpty()) {
         return true;
     }
 
+    if ((d->m_visibilityFlags & KServicePrivate::VisibilityKnown) && d->m_visibilityNames
+            && !(d->m_visibilityFlags & KServicePrivate::PlatformCheckedAtRuntime)) {
+        const quint32 platformMask = d->m_visibilityNames->mask(platform);
+        if ((d->m_visibilityFlags & KServicePrivate::OnlyShowOnPlatforms) && !(d->m_onlyPlatformMask & platformMask)) {
+            return false;
+        }
+        return !(d->m_notPlatformMask & platformMask);
+    }
+
     auto it = d->m_mapProps.find(QStringLiteral("X-KDE-OnlyShowOnQtPlatforms"));
     if ((it != d->m_mapProps.end()) && (it->isValid())) {
         const QStringList aList = it->toString().split(QLatin1Char(';'));
@@ -711,7 +837,12 @@ bool KService::showOnCurrentPlatform() const
 
 bool KService::noDisplay() const
 {
-    if (qvariant_cast<bool>(property(QStringLiteral("NoDisplay"), QVariant::Bool))) {
+    Q_D(const KService);
+    if (d->m_visibilityFlags & KServicePrivate::VisibilityKnown) {
+        if (d->m_visibilityFlags & KServicePrivate::NoDisplayProperty) {
+            return true;
+        }
+    } else if (qvariant_cast<bool>(property(QStringLiteral("NoDisplay"), QVariant::Bool))) {
         return true;
     }
 
@@ -795,7 +926,10 @@ QString KService::menuId() const
 void KService::setMenuId(const QString &_menuId)
 {
     Q_D(KService);
-    d->menuId = _menuId;
+    if (d->menuId != _menuId) {
+        d->menuId = _menuId;
+        d->rawSize = 0;
+    }
 }
 
 QString KService::storageId() const
@@ -983,12 +1117,14 @@ void KService::setTerminal(bool b)
 {
     Q_D(KService);
     d->m_bTerminal = b;
+    d->rawSize = 0;
 }
 
 void KService::setTerminalOptions(const QString &options)
 {
     Q_D(KService);
     d->m_strTerminalOptions = options;
+    d->rawSize = 0;
 }
 
 void KService::setExec(const QString &exec)
@@ -998,6 +1134,7 @@ void KService::setExec(const QString &exec)
     if (!exec.isEmpty()) {
         d->m_strExec = exec;
         d->path.clear();
+        d->rawSize = 0;
     }
 }
 
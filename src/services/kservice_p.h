@@ -21,11 +21,72 @@
 #ifndef KSERVICEPRIVATE_H
 #define KSERVICEPRIVATE_H
 
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
 #include <QVector>
 #include "kservice.h"
 
 #include <ksycocaentry_p.h>
 
+/**
+ * The desktop and platform names used in OnlyShowIn, NotShowIn,
+ * X-KDE-OnlyShowOnQtPlatforms and X-KDE-NotShowOnQtPlatforms,
+ * interned by kbuildsycoca: bit i of the visibility masks of
+ * the services is the name number i.
+ */
+class KServiceVisibilityNames
+{
+public:
+    enum { MaxNames = 32 };
+
+    explicit KServiceVisibilityNames(const QStringList &names)
+        : m_names(names.mid(0, MaxNames)),
+          m_currentDesktopMask(0),
+          m_currentDesktopKnown(false)
+    {
+        for (int i = 0; i < m_names.count(); ++i) {
+            m_bits.insert(m_names.at(i), 1u << i);
+        }
+    }
+
+    QStringList names() const
+    {
+        return m_names;
+    }
+
+    quint32 mask(const QString &name) const
+    {
+        return m_bits.value(name);
+    }
+
+    /**
+     * The bit of the whole XDG_CURRENT_DESKTOP value, 0 if it isn't in the table.
+     * Looked up again only when the variable changes.
+     */
+    quint32 currentDesktopMask() const
+    {
+        const QByteArray desktop = qgetenv("XDG_CURRENT_DESKTOP");
+        QMutexLocker locker(&m_mutex);
+        if (!m_currentDesktopKnown || desktop != m_currentDesktop) {
+            m_currentDesktop = desktop;
+            m_currentDesktopMask = mask(QString::fromLatin1(desktop));
+            m_currentDesktopKnown = true;
+        }
+        return m_currentDesktopMask;
+    }
+
+    typedef QSharedPointer<const KServiceVisibilityNames> Ptr;
+
+private:
+    QStringList m_names;
+    QHash<QString, quint32> m_bits;
+    mutable QMutex m_mutex;
+    mutable QByteArray m_currentDesktop;
+    mutable quint32 m_currentDesktopMask;
+    mutable bool m_currentDesktopKnown;
+};
+
 class KServicePrivate : public KSycocaEntryPrivate
 {
 public:
@@ -41,11 +102,32 @@ public:
         load(_str);
     }
 
+    /**
+     * What kbuildsycoca precomputed about OnlyShowIn & co, see computeVisibility()
+     */
+    enum VisibilityFlag {
+        VisibilityKnown = 1,
+        OnlyShowIn = 2,          // m_desktopMask lists the desktops of OnlyShowIn
+        NotShowIn = 4,           // m_desktopMask lists the desktops of NotShowIn
+        OnlyShowOnPlatforms = 8, // m_onlyPlatformMask is set
+        NotShowOnPlatforms = 16, // m_notPlatformMask is set
+        DesktopCheckedAtRuntime = 32, // too many names for the masks
+        PlatformCheckedAtRuntime = 64,
+        NoDisplayProperty = 128  // NoDisplay=true
+    };
+
+    /**
+     * Computes the visibility masks from the properties, interning the
+     * names into @p names. For kbuildsycoca.
+     */
+    void computeVisibility(QStringList &names);
+
     void init(const KDesktopFile *config, KService *q);
 
     void parseActions(const KDesktopFile *config, KService *q);
     void load(QDataStream &);
     void save(QDataStream &) override;
+    bool saveRaw(QDataStream &s, const QByteArray &raw) override;
 
     QString name() const override
     {
@@ -71,6 +153,12 @@ public:
 
     QVariant property(const QString &_name, QVariant::Type t) const;
 
+    /**
+     * @return true if @p _name is one of the properties stored in a dedicated
+     * member, whose value property() returns without looking up its type.
+     */
+    static bool isBuiltinProperty(const QString &_name);
+
     QStringList serviceTypes() const;
 
     QStringList categories;
@@ -95,6 +183,12 @@ public:
     QStringList m_lstKeywords;
     QString m_strGenName;
     QList<KServiceAction> m_actions;
+    // The names for the masks below, set by KServiceFactory::createEntry
+    KServiceVisibilityNames::Ptr m_visibilityNames;
+    quint8 m_visibilityFlags = 0;
+    quint32 m_desktopMask = 0;
+    quint32 m_onlyPlatformMask = 0;
+    quint32 m_notPlatformMask = 0;
     bool m_bAllowAsDefault : 1;
     bool m_bTerminal : 1;
     bool m_bValid : 1;
@@ -21,22 +21,68 @@
 #include "ksycocatype.h"
 #include "ksycocadict_p.h"
 #include "kservice.h"
+#include "kservice_p.h"
 #include "servicesdebug.h"
 #include <QDir>
 #include <QFile>
 
+#include <algorithm>
+
 extern int servicesDebugArea();
 
+class KServiceFactoryPrivate
+{
+public:
+    // One property index, see KBuildServiceFactory::savePropertyIndexes
+    struct PropertyIndex {
+        QVector<qint32> existing;
+        QHash<QString, QVector<qint32>> values;
+        QHash<QString, QVector<qint32>> items;
+    };
+
+    bool m_propertyIndexesLoaded = false;
+    QHash<QString, PropertyIndex> m_propertyIndexes;
+
+    // The prefiltered offer lists, see KBuildServiceFactory::savePrefilteredOffers
+    bool m_prefilteredOffersLoaded = false;
+    QHash<QString, QHash<qint32, qint32>> m_prefilteredLists; // generic service type -> mimetype offset -> list position
+
+    // The offer lists sorted according to the profiles, see KBuildServiceFactory::saveProfiledOffers
+    bool m_profiledOffersLoaded = false;
+    QStringList m_profileStamps;
+    QHash<QString, qint32> m_profiledLists; // service type -> list position
+
+    // The desktop and platform names of the visibility masks of the services
+    KServiceVisibilityNames::Ptr m_visibilityNames;
+};
+
+static QVector<qint32> readOffsets(QDataStream &str)
+{
+    qint32 count;
+    str >> count;
+    QVector<qint32> offsets;
+    offsets.resize(count);
+    for (int i = 0; i < count; ++i) {
+        str >> offsets[i];
+    }
+    return offsets;
+}
+
 KServiceFactory::KServiceFactory(KSycoca *db)
     : KSycocaFactory(KST_KServiceFactory, db),
       m_nameDict(nullptr),
       m_relNameDict(nullptr),
-      m_menuIdDict(nullptr)
+      m_menuIdDict(nullptr),
+      d(new KServiceFactoryPrivate)
 {
     m_offerListOffset = 0;
     m_nameDictOffset = 0;
     m_relNameDictOffset = 0;
     m_menuIdDictOffset = 0;
+    m_propertyIndexOffset = 0;
+    m_prefilteredOffersOffset = 0;
+    m_visibilityNamesOffset = 0;
+    m_profiledOffersOffset = 0;
     if (!sycoca()->isBuilding()) {
         QDataStream *str = stream();
         Q_ASSERT(str);
@@ -53,6 +99,14 @@ KServiceFactory::KServiceFactory(KSycoca *db)
         m_offerListOffset = i;
         (*str) >> i;
         m_menuIdDictOffset = i;
+        (*str) >> i;
+        m_propertyIndexOffset = i;
+        (*str) >> i;
+        m_prefilteredOffersOffset = i;
+        (*str) >> i;
+        m_visibilityNamesOffset = i;
+        (*str) >> i;
+        m_profiledOffersOffset = i;
 
         const qint64 saveOffset = str->device()->pos();
         // Init index tables
@@ -61,6 +115,13 @@ KServiceFactory::KServiceFactory(KSycoca *db)
         m_relNameDict = new KSycocaDict(str, m_relNameDictOffset);
         // Init index tables
         m_menuIdDict = new KSycocaDict(str, m_menuIdDictOffset);
+        // Shared by all the services created by this factory
+        QStringList visibilityNames;
+        if (m_visibilityNamesOffset) {
+            str->device()->seek(m_visibilityNamesOffset);
+            (*str) >> visibilityNames;
+        }
+        d->m_visibilityNames = KServiceVisibilityNames::Ptr(new KServiceVisibilityNames(visibilityNames));
         str->device()->seek(saveOffset);
     }
 }
@@ -70,6 +131,7 @@ KServiceFactory::~KServiceFactory()
     delete m_nameDict;
     delete m_relNameDict;
     delete m_menuIdDict;
+    delete d;
 }
 
 KService::Ptr KServiceFactory::findServiceByName(const QString &_name)
@@ -219,6 +281,8 @@ KService *KServiceFactory::createEntry(int offset) const
         qCWarning(SERVICES) << "KServiceFactory: corrupt object in KSycoca database!";
         delete newEntry;
         newEntry = nullptr;
+    } else {
+        static_cast<KServicePrivate *>(newEntry->d_ptr)->m_visibilityNames = d->m_visibilityNames;
     }
     return newEntry;
 }
@@ -281,6 +345,49 @@ QList<KServiceOffer> KServiceFactory::offers(int serviceTypeOffset, int serviceO
     return list;
 }
 
+KServiceOfferList KServiceFactory::offers(int serviceTypeOffset, int serviceOffersOffset, int maxCount,
+        const OffsetFilter &offsetFilter, const ServiceFilter &serviceFilter)
+{
+    KServiceOfferList list;
+    if (maxCount <= 0) {
+        return list;
+    }
+
+    // Jump to the offer list
+    QDataStream *str = stream();
+    str->device()->seek(m_offerListOffset + serviceOffersOffset);
+
+    qint32 aServiceTypeOffset, aServiceOffset, initialPreference, mimeTypeInheritanceLevel;
+    while (list.count() < maxCount) {
+        (*str) >> aServiceTypeOffset;
+        if (aServiceTypeOffset) {
+            (*str) >> aServiceOffset;
+            (*str) >> initialPreference;
+            (*str) >> mimeTypeInheritanceLevel;
+            if (aServiceTypeOffset == serviceTypeOffset) {
+                // Save stream position ! (the filters can use the stream too)
+                const qint64 savedPos = str->device()->pos();
+                if (!offsetFilter || offsetFilter(aServiceOffset)) {
+                    KService *serv = createEntry(aServiceOffset);
+                    if (serv) {
+                        KService::Ptr servPtr(serv);
+                        if (!serviceFilter || serviceFilter(servPtr)) {
+                            list.append(KServiceOffer(servPtr, initialPreference, mimeTypeInheritanceLevel, servPtr->allowAsDefault()));
+                        }
+                    }
+                }
+                // Restore position
+                str->device()->seek(savedPos);
+            } else {
+                break;    // too far
+            }
+        } else {
+            break;    // 0 => end of list
+        }
+    }
+    return list;
+}
+
 KService::List KServiceFactory::serviceOffers(int serviceTypeOffset, int serviceOffersOffset)
 {
     KService::List list;
@@ -316,6 +423,297 @@ KService::List KServiceFactory::serviceOffers(int serviceTypeOffset, int service
     return list;
 }
 
+KService::List KServiceFactory::serviceOffers(int serviceTypeOffset, int serviceOffersOffset,
+        const QVector<qint32> &candidates)
+{
+    KService::List list;
+    if (candidates.isEmpty()) {
+        return list;
+    }
+
+    // Jump to the offer list
+    QDataStream *str = stream();
+    str->device()->seek(m_offerListOffset + serviceOffersOffset);
+
+    qint32 aServiceTypeOffset, aServiceOffset, initialPreference, mimeTypeInheritanceLevel;
+    while (true) {
+        (*str) >> aServiceTypeOffset;
+        if (aServiceTypeOffset) {
+            (*str) >> aServiceOffset;
+            (*str) >> initialPreference;
+            (*str) >> mimeTypeInheritanceLevel;
+            if (aServiceTypeOffset == serviceTypeOffset) {
+                if (!std::binary_search(candidates.constBegin(), candidates.constEnd(), aServiceOffset)) {
+                    continue; // can't match, don't even create it
+                }
+                // Save stream position !
+                const qint64 savedPos = str->device()->pos();
+                // Create service
+                KService *serv = createEntry(aServiceOffset);
+                if (serv) {
+                    list.append(KService::Ptr(serv));
+                }
+                // Restore position
+                str->device()->seek(savedPos);
+            } else {
+                break;    // too far
+            }
+        } else {
+            break;    // 0 => end of list
+        }
+    }
+    return list;
+}
+
+bool KServiceFactory::prefilteredOffers(const QString &genericServiceType, int mimeTypeOffset, int maxCount,
+        KServiceOfferList &offers)
+{
+    if (!m_prefilteredOffersOffset) {
+        return false;
+    }
+
+    QDataStream *str = stream();
+    const qint64 savedPos = str->device()->pos();
+    if (!d->m_prefilteredOffersLoaded) {
+        d->m_prefilteredOffersLoaded = true;
+        str->device()->seek(m_prefilteredOffersOffset);
+        qint32 genericCount;
+        (*str) >> genericCount;
+        for (int i = 0; i < genericCount; ++i) {
+            QString name;
+            qint32 mimeTypeCount;
+            (*str) >> name >> mimeTypeCount;
+            QHash<qint32, qint32> &lists = d->m_prefilteredLists[name];
+            lists.reserve(mimeTypeCount);
+            for (int j = 0; j < mimeTypeCount; ++j) {
+                qint32 offset, position;
+                (*str) >> offset >> position;
+                lists.insert(offset, position);
+            }
+        }
+    }
+
+    const auto git = d->m_prefilteredLists.constFind(genericServiceType);
+    if (git == d->m_prefilteredLists.constEnd()) {
+        str->device()->seek(savedPos);
+        return false;
+    }
+    const auto lit = git->constFind(mimeTypeOffset);
+    if (lit == git->constEnd()) {
+        str->device()->seek(savedPos);
+        return false;
+    }
+
+    // Same as KService::showInCurrentDesktop(), which compares the whole variable
+    const quint32 desktopMask = d->m_visibilityNames->currentDesktopMask();
+
+    str->device()->seek(lit.value());
+    qint32 count;
+    (*str) >> count;
+    for (int i = 0; i < count && (maxCount < 0 || offers.count() < maxCount); ++i) {
+        qint32 serviceOffset, initialPreference, mimeTypeInheritanceLevel, visibility;
+        quint32 mask;
+        (*str) >> serviceOffset >> initialPreference >> mimeTypeInheritanceLevel >> visibility >> mask;
+        if ((visibility == OnlyShownIn && !(mask & desktopMask))
+                || (visibility == NotShownIn && (mask & desktopMask))) {
+            continue; // not shown, don't even create it
+        }
+        const qint64 listPos = str->device()->pos();
+        KService *serv = createEntry(serviceOffset);
+        if (serv) {
+            KService::Ptr servPtr(serv);
+            if (visibility != CheckedAtRuntime || servPtr->showInCurrentDesktop()) {
+                offers.append(KServiceOffer(servPtr, initialPreference, mimeTypeInheritanceLevel, servPtr->allowAsDefault()));
+            }
+        }
+        str->device()->seek(listPos);
+    }
+    str->device()->seek(savedPos);
+    return true;
+}
+
+bool KServiceFactory::profiledOffers(const QString &serviceType, const QStringList &profileStamps, int maxCount,
+                                     KServiceOfferList &offers)
+{
+    if (!m_profiledOffersOffset) {
+        return false;
+    }
+
+    QDataStream *str = stream();
+    const qint64 savedPos = str->device()->pos();
+    loadProfiledOffers(str);
+
+    // The profiles changed since kbuildsycoca ran
+    if (d->m_profileStamps != profileStamps) {
+        str->device()->seek(savedPos);
+        return false;
+    }
+    const auto it = d->m_profiledLists.constFind(serviceType);
+    if (it == d->m_profiledLists.constEnd()) {
+        str->device()->seek(savedPos);
+        return false;
+    }
+
+    str->device()->seek(it.value());
+    qint32 count;
+    (*str) >> count;
+    for (int i = 0; i < count && (maxCount < 0 || offers.count() < maxCount); ++i) {
+        qint32 serviceOffset, preference;
+        (*str) >> serviceOffset >> preference;
+        const qint64 listPos = str->device()->pos();
+        KService *serv = createEntry(serviceOffset);
+        if (serv) {
+            KService::Ptr servPtr(serv);
+            offers.append(KServiceOffer(servPtr, preference, 0, servPtr->allowAsDefault()));
+        }
+        str->device()->seek(listPos);
+    }
+    str->device()->seek(savedPos);
+    return true;
+}
+
+QStringList KServiceFactory::profileStamps()
+{
+    if (!m_profiledOffersOffset) {
+        return QStringList();
+    }
+    QDataStream *str = stream();
+    const qint64 savedPos = str->device()->pos();
+    loadProfiledOffers(str);
+    str->device()->seek(savedPos);
+    return d->m_profileStamps;
+}
+
+void KServiceFactory::loadProfiledOffers(QDataStream *str)
+{
+    if (d->m_profiledOffersLoaded) {
+        return;
+    }
+    d->m_profiledOffersLoaded = true;
+    str->device()->seek(m_profiledOffersOffset);
+    qint32 count;
+    (*str) >> d->m_profileStamps >> count;
+    d->m_profiledLists.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString name;
+        qint32 position;
+        (*str) >> name >> position;
+        d->m_profiledLists.insert(name, position);
+    }
+}
+
+QStringList KServiceFactory::visibilityNames() const
+{
+    return d->m_visibilityNames ? d->m_visibilityNames->names() : QStringList();
+}
+
+KServiceFactory::DesktopVisibility KServiceFactory::desktopVisibility(const KService::Ptr &service, quint32 &mask)
+{
+    const KServicePrivate *d = static_cast<const KServicePrivate *>(service->d_ptr);
+    mask = d->m_desktopMask;
+    if (!(d->m_visibilityFlags & KServicePrivate::VisibilityKnown)
+            || (d->m_visibilityFlags & KServicePrivate::DesktopCheckedAtRuntime)) {
+        return CheckedAtRuntime;
+    }
+    if (d->m_visibilityFlags & KServicePrivate::OnlyShowIn) {
+        return OnlyShownIn;
+    }
+    if (d->m_visibilityFlags & KServicePrivate::NotShowIn) {
+        return NotShownIn;
+    }
+    return ShownEverywhere;
+}
+
+bool KServiceFactory::lookupPropertyIndex(const QString &property, PropertyIndexLookup lookup,
+        const QString &value, QVector<qint32> &offsets)
+{
+    if (!m_propertyIndexOffset) {
+        return false;
+    }
+
+    if (!d->m_propertyIndexesLoaded) {
+        // Load all the indexes at once, there are only a few of them
+        d->m_propertyIndexesLoaded = true;
+        QDataStream *str = stream();
+        const qint64 savedPos = str->device()->pos();
+        str->device()->seek(m_propertyIndexOffset);
+        qint32 propertyCount;
+        (*str) >> propertyCount;
+        for (int i = 0; i < propertyCount; ++i) {
+            QString name;
+            (*str) >> name;
+            KServiceFactoryPrivate::PropertyIndex &index = d->m_propertyIndexes[name];
+            index.existing = readOffsets(*str);
+            qint32 count;
+            (*str) >> count;
+            for (int j = 0; j < count; ++j) {
+                QString key;
+                (*str) >> key;
+                index.values.insert(key, readOffsets(*str));
+            }
+            (*str) >> count;
+            for (int j = 0; j < count; ++j) {
+                QString key;
+                (*str) >> key;
+                index.items.insert(key, readOffsets(*str));
+            }
+        }
+        str->device()->seek(savedPos);
+    }
+
+    const auto it = d->m_propertyIndexes.constFind(property);
+    if (it == d->m_propertyIndexes.constEnd()) {
+        return false;
+    }
+    switch (lookup) {
+    case PropertyExists:
+        offsets = it->existing;
+        break;
+    case PropertyEquals:
+        offsets = it->values.value(value);
+        break;
+    case PropertyContains:
+        offsets = it->items.value(value);
+        break;
+    }
+    return true;
+}
+
+QVector<qint32> KServiceFactory::serviceOffsets(int serviceTypeOffset, int serviceOffersOffset)
+{
+    QVector<qint32> offsets;
+    if (serviceOffersOffset == -1) {
+        return offsets;
+    }
+
+    // Save stream position
+    QDataStream *str = stream();
+    const qint64 savedPos = str->device()->pos();
+
+    // Jump to the offer list
+    str->device()->seek(m_offerListOffset + serviceOffersOffset);
+    qint32 aServiceTypeOffset, aServiceOffset, initialPreference, mimeTypeInheritanceLevel;
+    while (true) {
+        (*str) >> aServiceTypeOffset;
+        if (aServiceTypeOffset) {
+            (*str) >> aServiceOffset;
+            (*str) >> initialPreference;
+            (*str) >> mimeTypeInheritanceLevel;
+            if (aServiceTypeOffset == serviceTypeOffset) {
+                offsets.append(aServiceOffset);
+            } else {
+                break;    // too far
+            }
+        } else {
+            break;    // 0 => end of list
+        }
+    }
+    // Restore position
+    str->device()->seek(savedPos);
+    std::sort(offsets.begin(), offsets.end());
+    return offsets;
+}
+
 bool KServiceFactory::hasOffer(int serviceTypeOffset, int serviceOffersOffset, int testedServiceOffset)
 {
     // Save stream position
@@ -22,10 +22,12 @@
 #define KSERVICEFACTORY_P_H
 
 #include <QStringList>
+#include <QVector>
 
 #include "kserviceoffer.h"
 #include "ksycocafactory_p.h"
 #include <assert.h>
+#include <functional>
 
 class KSycoca;
 class KSycocaDict;
@@ -100,6 +102,99 @@ public:
      */
     bool hasOffer(int serviceTypeOffset, int serviceOffersOffset, int testedServiceOffset);
 
+    /**
+     * @return the sorted offsets of the services supporting the given service type,
+     * without decoding any of them
+     */
+    QVector<qint32> serviceOffsets(int serviceTypeOffset, int serviceOffersOffset);
+
+    typedef std::function<bool(int serviceOffset)> OffsetFilter;
+    typedef std::function<bool(const KService::Ptr &service)> ServiceFilter;
+
+    /**
+     * Same as offers(), but walks the offers in their stored order and stops
+     * after @p maxCount accepted offers. The services rejected by @p offsetFilter
+     * aren't even decoded; @p serviceFilter is then called for the decoded ones.
+     * Empty filters accept everything.
+     */
+    KServiceOfferList offers(int serviceTypeOffset, int serviceOffersOffset, int maxCount,
+                             const OffsetFilter &offsetFilter, const ServiceFilter &serviceFilter);
+
+    /**
+     * Same as serviceOffers(), but only the services whose offset is in the
+     * sorted list @p candidates are decoded, the other ones are skipped.
+     */
+    KService::List serviceOffers(int serviceTypeOffset, int serviceOffersOffset,
+                                 const QVector<qint32> &candidates);
+
+    /**
+     * How a service of a prefiltered offer list is shown, see prefilteredOffers()
+     */
+    enum DesktopVisibility {
+        ShownEverywhere = 0,  ///< neither OnlyShowIn nor NotShowIn
+        OnlyShownIn = 1,      ///< only in the desktops of the mask
+        NotShownIn = 2,       ///< in all the desktops but those of the mask
+        CheckedAtRuntime = 3  ///< too many desktop names for the mask, call showInCurrentDesktop()
+    };
+
+    /**
+     * @return the visibility of @p service, whose masks were computed by kbuildsycoca
+     * using the names of the visibility table
+     */
+    static DesktopVisibility desktopVisibility(const KService::Ptr &service, quint32 &mask);
+
+    /**
+     * @return the names of the visibility table, bit i of the masks being name number i
+     */
+    QStringList visibilityNames() const;
+
+    /**
+     * Returns the offers for the mimetype at @p mimeTypeOffset which are also
+     * offers for @p genericServiceType and are shown in the current desktop,
+     * from the lists precomputed by kbuildsycoca. Only the services actually
+     * returned are decoded.
+     * @param maxCount stop after that many offers, -1 for all of them
+     * @return false if there is no precomputed list for this mimetype and
+     * @p genericServiceType, the offers then have to be filtered at runtime
+     */
+    bool prefilteredOffers(const QString &genericServiceType, int mimeTypeOffset, int maxCount,
+                           KServiceOfferList &offers);
+
+    /**
+     * Returns the offers for @p serviceType sorted according to its profile,
+     * from the lists precomputed by kbuildsycoca, i.e. what
+     * KServiceTypeProfile::sortServiceTypeOffers would return.
+     * @param profileStamps the KServiceTypeProfile::fileStamps() of the current profiles,
+     * the precomputed lists are only used if they were computed from the same files
+     * @param maxCount stop after that many offers, -1 for all of them
+     * @return false if there is no up to date precomputed list for @p serviceType
+     */
+    bool profiledOffers(const QString &serviceType, const QStringList &profileStamps, int maxCount,
+                        KServiceOfferList &offers);
+
+    /**
+     * The KServiceTypeProfile::fileStamps() the lists of profiledOffers() were computed from
+     */
+    QStringList profileStamps();
+
+    /**
+     * The predicates which can be answered from the property indexes
+     */
+    enum PropertyIndexLookup {
+        PropertyExists = 0,   ///< exist Property
+        PropertyEquals = 1,   ///< Property == 'value'
+        PropertyContains = 2  ///< 'value' in Property
+    };
+
+    /**
+     * Looks up @p property in the property indexes written by kbuildsycoca.
+     * @param offsets set to the sorted offsets of the services which may satisfy
+     * the predicate. The other services certainly don't satisfy it.
+     * @return false if @p property isn't indexed
+     */
+    bool lookupPropertyIndex(const QString &property, PropertyIndexLookup lookup,
+                             const QString &value, QVector<qint32> &offsets);
+
     /**
      * @return all services. Very memory consuming, avoid using.
      */
@@ -126,10 +221,16 @@ protected:
     int m_relNameDictOffset;
     KSycocaDict *m_menuIdDict;
     int m_menuIdDictOffset;
+    int m_propertyIndexOffset;
+    int m_prefilteredOffersOffset;
+    int m_visibilityNamesOffset;
+    int m_profiledOffersOffset;
 
 protected:
     void virtual_hook(int id, void *data) override;
 private:
+    void loadProfiledOffers(QDataStream *str);
+
     class KServiceFactoryPrivate *d;
 };
 
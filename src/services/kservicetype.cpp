@@ -113,6 +113,20 @@ KServiceTypePrivate::save(QDataStream &_str)
          << qint8(1) << m_serviceOffersOffset;
 }
 
+bool
+KServiceTypePrivate::saveRaw(QDataStream &_str, const QByteArray &raw)
+{
+    // Everything but the offset of the offers, which comes last
+    if (raw.size() < int(sizeof(qint32))) {
+        return false;
+    }
+    offset = _str.device()->pos();
+    rawSize = 0;
+    _str.writeRawData(raw.constData(), raw.size() - sizeof(qint32));
+    _str << m_serviceOffersOffset;
+    return true;
+}
+
 KServiceType::~KServiceType()
 {
 }
@@ -44,6 +44,11 @@ public:
     virtual ~KServiceTypePrivate() {}
 
     void save(QDataStream &) override;
+    bool saveRaw(QDataStream &s, const QByteArray &raw) override;
+    int rawTailSize() const override
+    {
+        return sizeof(qint32); // the offset of the offers
+    }
 
     QString name() const override
     {
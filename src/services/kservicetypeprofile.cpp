@@ -23,53 +23,103 @@
 #include "kserviceoffer.h"
 #include "kservicetype.h"
 #include "ksycoca_p.h"
+#include "ksycocautils_p.h"
 
 #include <kconfig.h>
 #include <kconfiggroup.h>
 
-#include <QMutex>
+#include <QAtomicInt>
+#include <QFile>
 #include <QHash>
+#include <QStandardPaths>
 #include <QtAlgorithms>
 
-// servicetype -> profile
-class KServiceTypeProfiles : public QHash<QString, KServiceTypeProfileEntry *>
+#include <memory>
+
+// An immutable copy of servicetype_profilerc: servicetype -> profile.
+// Readers take a reference to the current snapshot and never block,
+// a modified file is parsed into a new snapshot which then replaces it.
+class KServiceTypeProfiles
 {
 public:
-    KServiceTypeProfiles()
-    {
-        m_parsed = false; ensureParsed();
-    }
-    ~KServiceTypeProfiles()
-    {
-        clear();
-    }
-    void clear()
-    {
-        QMutexLocker lock(&m_mutex);
-        qDeleteAll(*this);
-        QHash<QString, KServiceTypeProfileEntry *>::clear();
-        m_parsed = false;
-    }
-    bool hasProfile(const QString &serviceType)
-    {
-        QMutexLocker lock(&m_mutex);
-        ensureParsed();
-        return contains(serviceType);
-    }
-    void ensureParsed(); // mutex must be locked when calling this
-    QMutex m_mutex;
+    KServiceTypeProfiles();
+
+    typedef std::shared_ptr<const KServiceTypeProfiles> Ptr;
+
+    /**
+     * @return the current snapshot, parsing the file if there is none yet
+     */
+    static Ptr current();
+
+    /**
+     * Drops the current snapshot, the next call to current() parses the file again
+     */
+    static void reset();
+
+    /**
+     * Same as reset(), unless the file didn't change since the current snapshot was parsed
+     */
+    static void resetIfModified();
+
+    /**
+     * @return the files which make up servicetype_profilerc, with a checksum
+     * of their contents, to find out whether they changed
+     */
+    static QStringList fileStamps();
+
+    QHash<QString, KServiceTypeProfileEntry> m_profiles;
+    QStringList m_fileStamps;
+
 private:
-    bool m_parsed;
+    static Ptr s_current;
 };
 
-Q_GLOBAL_STATIC(KServiceTypeProfiles, s_serviceTypeProfiles)
+KServiceTypeProfiles::Ptr KServiceTypeProfiles::s_current;
+
+static QAtomicInt s_profileGeneration;
+
+int KServiceTypeProfile::generation()
+{
+    return s_profileGeneration.load();
+}
+
+KServiceTypeProfiles::Ptr KServiceTypeProfiles::current()
+{
+    Ptr snapshot = std::atomic_load(&s_current);
+    if (!snapshot) {
+        Ptr parsed = std::make_shared<const KServiceTypeProfiles>();
+        // If another thread was faster, use its snapshot, they are the same
+        if (std::atomic_compare_exchange_strong(&s_current, &snapshot, parsed)) {
+            snapshot = parsed;
+        }
+    }
+    return snapshot;
+}
+
+void KServiceTypeProfiles::reset()
+{
+    std::atomic_store(&s_current, Ptr());
+    s_profileGeneration.ref();
+}
 
-void KServiceTypeProfiles::ensureParsed()
+void KServiceTypeProfiles::resetIfModified()
 {
-    if (m_parsed) {
+    const Ptr snapshot = std::atomic_load(&s_current);
+    if (snapshot && snapshot->m_fileStamps == fileStamps()) {
         return;
     }
-    m_parsed = true;
+    reset();
+}
+
+QStringList KServiceTypeProfiles::fileStamps()
+{
+    return KSycocaUtilsPrivate::fileStamps(QStandardPaths::locateAll(QStandardPaths::GenericConfigLocation, QStringLiteral("servicetype_profilerc")));
+}
+
+KServiceTypeProfiles::KServiceTypeProfiles()
+{
+    // Before parsing, so that a modification while parsing is noticed by clearCache
+    m_fileStamps = fileStamps();
 
     // Read the service type profiles from servicetype_profilerc
     // See writeServiceTypeProfile for a description of the file format.
@@ -82,11 +132,7 @@ void KServiceTypeProfiles::ensureParsed()
         const QString type = *aIt;
         KConfigGroup config(&configFile, type);
         const int count = config.readEntry("NumberOfEntries", 0);
-        KServiceTypeProfileEntry *p = this->value(type, nullptr);
-        if (!p) {
-            p = new KServiceTypeProfileEntry();
-            this->insert(type, p);
-        }
+        KServiceTypeProfileEntry &p = m_profiles[type];
 
         for (int i = 0; i < count; ++i) {
             const QString num = QLatin1String("Entry") + QString::number(i);
@@ -94,7 +140,7 @@ void KServiceTypeProfiles::ensureParsed()
             if (!serviceId.isEmpty()) {
                 const int pref = config.readEntry(num + QLatin1String("_Preference"), 0);
                 //qDebug() << "adding service " << serviceId << " to profile for " << type << " with preference " << pref;
-                p->addService(serviceId, pref);
+                p.addService(serviceId, pref);
             }
         }
     }
@@ -103,28 +149,20 @@ void KServiceTypeProfiles::ensureParsed()
 //static
 void KServiceTypeProfile::clearCache()
 {
-    if (s_serviceTypeProfiles.exists())
-        s_serviceTypeProfiles()->clear();
+    // Called whenever ksycoca changes, keep the snapshot if the file didn't change
+    KServiceTypeProfiles::resetIfModified();
 }
 
-/**
- * Returns the offers in the profile for the requested service type.
- * @param list list of offers (including initialPreference)
- * @param servicetype the service type
- * @return the weighted and sorted offer list
- * @internal used by KServiceTypeTrader
- */
-namespace KServiceTypeProfile
+KServiceOfferList KServiceTypeProfile::sortServiceTypeOffers(const KServiceOfferList &list, const QString &serviceType)
 {
-KServiceOfferList sortServiceTypeOffers(const KServiceOfferList &list, const QString &servicetype);
+    // Keeps the snapshot alive while we use it
+    const KServiceTypeProfiles::Ptr snapshot = KServiceTypeProfiles::current();
+    const auto profileIt = snapshot->m_profiles.constFind(serviceType);
+    return sortServiceTypeOffers(list, profileIt != snapshot->m_profiles.constEnd() ? &profileIt.value() : nullptr);
 }
 
-KServiceOfferList KServiceTypeProfile::sortServiceTypeOffers(const KServiceOfferList &list, const QString &serviceType)
+KServiceOfferList KServiceTypeProfile::sortServiceTypeOffers(const KServiceOfferList &list, const KServiceTypeProfileEntry *profile)
 {
-    QMutexLocker lock(&s_serviceTypeProfiles()->m_mutex);
-    s_serviceTypeProfiles()->ensureParsed();
-    KServiceTypeProfileEntry *profile = s_serviceTypeProfiles()->value(serviceType, nullptr);
-
     KServiceOfferList offers;
 
     KServiceOfferList::const_iterator it = list.begin();
@@ -168,7 +206,19 @@ KServiceOfferList KServiceTypeProfile::sortServiceTypeOffers(const KServiceOffer
 
 bool KServiceTypeProfile::hasProfile(const QString &serviceType)
 {
-    return s_serviceTypeProfiles()->hasProfile(serviceType);
+    return KServiceTypeProfiles::current()->m_profiles.contains(serviceType);
+}
+
+QHash<QString, KServiceTypeProfileEntry> KServiceTypeProfile::profiles(QStringList &fileStamps)
+{
+    const KServiceTypeProfiles::Ptr snapshot = KServiceTypeProfiles::current();
+    fileStamps = snapshot->m_fileStamps;
+    return snapshot->m_profiles;
+}
+
+QStringList KServiceTypeProfile::fileStamps()
+{
+    return KServiceTypeProfiles::current()->m_fileStamps;
 }
 
 void KServiceTypeProfile::writeServiceTypeProfile(const QString &serviceType,
@@ -212,7 +262,7 @@ void KServiceTypeProfile::writeServiceTypeProfile(const QString &serviceType,
     configFile.sync();
 
     // Drop the whole cache...
-    clearCache();
+    KServiceTypeProfiles::reset();
 }
 
 void KServiceTypeProfile::deleteServiceTypeProfile(const QString &serviceType)
@@ -221,9 +271,6 @@ void KServiceTypeProfile::deleteServiceTypeProfile(const QString &serviceType)
     config.deleteGroup(serviceType);
     config.sync();
 
-    // Not threadsafe, but well the whole idea of using this method isn't
-    // threadsafe in the first place.
-    if (s_serviceTypeProfiles.exists()) {
-        delete s_serviceTypeProfiles()->take(serviceType);
-    }
+    // The file was modified, the next reader parses it again
+    KServiceTypeProfiles::reset();
 }
@@ -20,7 +20,12 @@
 #ifndef KSERVICETYPEPROFILE_P_H
 #define KSERVICETYPEPROFILE_P_H
 
+#include <QHash>
 #include <QMap>
+#include <QString>
+#include <QStringList>
+
+#include "kserviceoffer.h"
 
 /**
  * @internal
@@ -51,5 +56,45 @@ public:
     QMap<QString, int> m_mapServices;
 };
 
+namespace KServiceTypeProfile
+{
+/**
+ * @internal
+ * Changes every time the profiles are modified or their cache is cleared.
+ * Used to invalidate the cached trader results.
+ */
+int generation();
+
+/**
+ * @internal
+ * @return the files which make up servicetype_profilerc with a checksum of their
+ * contents, as they were when the current profiles were parsed from them.
+ * Used to find out whether the profiles compiled into ksycoca are up to date.
+ */
+QStringList fileStamps();
+
+/**
+ * @internal
+ * @return all the current profiles, by service type, for kbuildsycoca
+ * @param fileStamps set to the fileStamps() of those profiles
+ */
+QHash<QString, KServiceTypeProfileEntry> profiles(QStringList &fileStamps);
+
+/**
+ * Returns the offers in the profile for the requested service type.
+ * @param list list of offers (including initialPreference)
+ * @param servicetype the service type
+ * @return the weighted and sorted offer list
+ * @internal used by KServiceTypeTrader
+ */
+KServiceOfferList sortServiceTypeOffers(const KServiceOfferList &list, const QString &servicetype);
+
+/**
+ * Same as above, with the profile of the service type, which can be null
+ * @internal used by kbuildsycoca
+ */
+KServiceOfferList sortServiceTypeOffers(const KServiceOfferList &list, const KServiceTypeProfileEntry *profile);
+}
+
 #endif /* KSERVICETYPEPROFILE_P_H */
 
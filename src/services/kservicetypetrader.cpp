@@ -21,23 +21,24 @@
 
 #include "ksycoca.h"
 #include "ksycoca_p.h"
-#include "ktraderparsetree_p.h"
+#include "ktraderparseprogram_p.h"
+#include "ktraderresultcache_p.h"
 #include <kservicetypeprofile.h>
+#include "kservicetypeprofile_p.h"
 #include "kservicetype.h"
+#include "kservice_p.h"
 #include "kservicetypefactory_p.h"
 #include "kservicefactory_p.h"
 
 #include "servicesdebug.h"
 
+#include <algorithm>
+#include <iterator>
+
 using namespace KTraderParse;
 
 // --------------------------------------------------
 
-namespace KServiceTypeProfile
-{
-KServiceOfferList sortServiceTypeOffers(const KServiceOfferList &list, const QString &servicetype);
-}
-
 class KServiceTypeTraderSingleton
 {
 public:
@@ -60,6 +61,27 @@ KServiceTypeTrader::~KServiceTypeTrader()
 {
 }
 
+// Looks up the types of the properties used by @p program in this thread,
+// so that it can then be evaluated from worker threads, see applyProgram
+static void resolvePropertyTypes(ParseProgram &program)
+{
+    if (program.usesExtrema()) {
+        return; // evaluated serially anyway
+    }
+    KServiceTypeFactory *factory = KSycocaPrivate::self()->serviceTypeFactory();
+    QHash<QString, int> types;
+    const QStringList names = program.propertyNames();
+    for (const QString &name : names) {
+        if (KServicePrivate::isBuiltinProperty(name)) {
+            types.insert(name, QVariant::Invalid);
+        } else {
+            const QVariant::Type type = factory->findPropertyTypeByName(name);
+            types.insert(name, type == QVariant::Invalid ? int(ParseProgram::UnknownProperty) : int(type));
+        }
+    }
+    program.setPropertyTypes(types);
+}
+
 // shared with KMimeTypeTrader
 void KServiceTypeTrader::applyConstraints(KService::List &lst,
         const QString &constraint)
@@ -69,22 +91,61 @@ void KServiceTypeTrader::applyConstraints(KService::List &lst,
     }
 
     const ParseTreeBase::Ptr constr = parseConstraints(constraint);   // for ownership
-    const ParseTreeBase *pConstraintTree = constr.data(); // for speed
 
     if (!constr) { // parse error
         lst.clear();
     } else {
+        ParseProgram program(constr.data()); // for speed
+        resolvePropertyTypes(program);
+
         // Find all services matching the constraint
         // and remove the other ones
-        KService::List::iterator it = lst.begin();
-        while (it != lst.end()) {
-            if (matchConstraint(pConstraintTree, (*it), lst) != 1) {
-                it = lst.erase(it);
-            } else {
-                ++it;
-            }
+        applyProgram(program, lst);
+    }
+}
+
+// Narrows down the offers a query has to decode, using the property
+// indexes for the predicates which must be true for @p tree to match.
+// Returns false if none of them is indexed.
+static bool indexedCandidates(const ParseTreeBase *tree, QVector<qint32> &candidates)
+{
+    QVector<IndexPredicate> predicates;
+    tree->indexPredicates(predicates);
+
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    bool indexed = false;
+    for (const IndexPredicate &predicate : qAsConst(predicates)) {
+        KServiceFactory::PropertyIndexLookup lookup = KServiceFactory::PropertyExists;
+        switch (predicate.kind) {
+        case IndexPredicate::Exists:
+            lookup = KServiceFactory::PropertyExists;
+            break;
+        case IndexPredicate::Equals:
+            lookup = KServiceFactory::PropertyEquals;
+            break;
+        case IndexPredicate::Contains:
+            lookup = KServiceFactory::PropertyContains;
+            break;
+        }
+        QVector<qint32> offsets;
+        if (!factory->lookupPropertyIndex(predicate.property, lookup, predicate.value, offsets)) {
+            continue;
+        }
+        if (!indexed) {
+            candidates = offsets;
+            indexed = true;
+        } else {
+            QVector<qint32> intersection;
+            std::set_intersection(candidates.constBegin(), candidates.constEnd(),
+                                  offsets.constBegin(), offsets.constEnd(),
+                                  std::back_inserter(intersection));
+            candidates.swap(intersection);
+        }
+        if (candidates.isEmpty()) {
+            break;
         }
     }
+    return indexed;
 }
 
 #if 0
@@ -111,10 +172,17 @@ KServiceOfferList KServiceTypeTrader::weightedOffers(const QString &serviceType)
         return KServiceOfferList();
     }
 
+    // Already sorted by kbuildsycoca, if the profile didn't change since
+    KServiceOfferList offers;
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    if (factory->profiledOffers(serviceType, KServiceTypeProfile::fileStamps(), -1, offers)) {
+        return offers;
+    }
+
     // First, get all offers known to ksycoca.
-    const KServiceOfferList services = KSycocaPrivate::self()->serviceFactory()->offers(servTypePtr->offset(), servTypePtr->serviceOffersOffset());
+    const KServiceOfferList services = factory->offers(servTypePtr->offset(), servTypePtr->serviceOffersOffset());
 
-    const KServiceOfferList offers = KServiceTypeProfile::sortServiceTypeOffers(services, serviceType);
+    offers = KServiceTypeProfile::sortServiceTypeOffers(services, serviceType);
     //qDebug() << "Found profile: " << offers.count() << " offers";
 
 #if 0
@@ -124,6 +192,21 @@ KServiceOfferList KServiceTypeTrader::weightedOffers(const QString &serviceType)
     return offers;
 }
 
+KServiceOfferList KServiceTypeTrader::firstOffer(const QString &serviceType)   // static, internal
+{
+    KSycoca::self()->ensureCacheValid();
+    KServiceType::Ptr servTypePtr = KSycocaPrivate::self()->serviceTypeFactory()->findServiceTypeByName(serviceType);
+    if (!servTypePtr) {
+        qCWarning(SERVICES) << "KServiceTypeTrader: serviceType" << serviceType << "not found";
+        return KServiceOfferList();
+    }
+    if (servTypePtr->serviceOffersOffset() == -1) {  // no offers in ksycoca
+        return KServiceOfferList();
+    }
+    return KSycocaPrivate::self()->serviceFactory()->offers(servTypePtr->offset(), servTypePtr->serviceOffersOffset(), 1,
+            KServiceFactory::OffsetFilter(), KServiceFactory::ServiceFilter());
+}
+
 KService::List KServiceTypeTrader::defaultOffers(const QString &serviceType,
         const QString &constraint) const
 {
@@ -137,10 +220,29 @@ KService::List KServiceTypeTrader::defaultOffers(const QString &serviceType,
         return KService::List();
     }
 
-    KService::List lst =
-        KSycocaPrivate::self()->serviceFactory()->serviceOffers(servTypePtr->offset(), servTypePtr->serviceOffersOffset());
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    if (constraint.isEmpty()) {
+        return factory->serviceOffers(servTypePtr->offset(), servTypePtr->serviceOffersOffset());
+    }
 
-    applyConstraints(lst, constraint);
+    const ParseTreeBase::Ptr constr = parseConstraints(constraint);
+    if (!constr) { // parse error
+        return KService::List();
+    }
+    ParseProgram program(constr.data());
+
+    // Skip decoding the offers which the property indexes show can't match.
+    // Not with min/max, their result depends on all the offers.
+    KService::List lst;
+    QVector<qint32> candidates;
+    if (!program.usesExtrema() && indexedCandidates(constr.data(), candidates)) {
+        lst = factory->serviceOffers(servTypePtr->offset(), servTypePtr->serviceOffersOffset(), candidates);
+    } else {
+        lst = factory->serviceOffers(servTypePtr->offset(), servTypePtr->serviceOffersOffset());
+    }
+
+    resolvePropertyTypes(program);
+    applyProgram(program, lst);
 
     //qDebug() << "query for serviceType " << serviceType << constraint
     //             << " : returning " << lst.count() << " offers" << endl;
@@ -149,6 +251,21 @@ KService::List KServiceTypeTrader::defaultOffers(const QString &serviceType,
 
 KService::List KServiceTypeTrader::query(const QString &serviceType,
         const QString &constraint) const
+{
+    KTraderResultCache *cache = KTraderResultCache::current();
+    KService::List lst;
+    if (cache && cache->find(KTraderResultCache::ServiceTypeQuery, serviceType, QString(), constraint, lst)) {
+        return lst;
+    }
+    lst = uncachedQuery(serviceType, constraint);
+    if (cache) {
+        cache->insert(KTraderResultCache::ServiceTypeQuery, serviceType, QString(), constraint, lst);
+    }
+    return lst;
+}
+
+KService::List KServiceTypeTrader::uncachedQuery(const QString &serviceType,
+        const QString &constraint) const
 {
     if (!KServiceTypeProfile::hasProfile(serviceType)) {
         // Fast path: skip the profile stuff if there's none (to avoid kservice->serviceoffer->kservice)
@@ -175,7 +292,34 @@ KService::List KServiceTypeTrader::query(const QString &serviceType,
 
 KService::Ptr KServiceTypeTrader::preferredService(const QString &serviceType) const
 {
-    const KServiceOfferList offers = weightedOffers(serviceType);
+    KTraderResultCache *cache = KTraderResultCache::current();
+    KService::List lst;
+    if (cache && cache->find(KTraderResultCache::ServiceTypePreferred, serviceType, QString(), QString(), lst)) {
+        return lst.value(0);
+    }
+    const KService::Ptr service = uncachedPreferredService(serviceType);
+    if (cache) {
+        if (service) {
+            lst.append(service);
+        }
+        cache->insert(KTraderResultCache::ServiceTypePreferred, serviceType, QString(), QString(), lst);
+    }
+    return service;
+}
+
+KService::Ptr KServiceTypeTrader::uncachedPreferredService(const QString &serviceType) const
+{
+    // Without a profile, or with a profile compiled by kbuildsycoca, the offers
+    // are already stored in the right order, only the first one needs to be decoded
+    KServiceOfferList offers;
+    if (!KServiceTypeProfile::hasProfile(serviceType)) {
+        offers = firstOffer(serviceType);
+    } else {
+        KSycoca::self()->ensureCacheValid();
+        if (!KSycocaPrivate::self()->serviceFactory()->profiledOffers(serviceType, KServiceTypeProfile::fileStamps(), 1, offers)) {
+            offers = weightedOffers(serviceType);
+        }
+    }
 
     KServiceOfferList::const_iterator itOff = offers.begin();
     // Look for the first one that is allowed as default.
@@ -188,3 +332,18 @@ KService::Ptr KServiceTypeTrader::preferredService(const QString &serviceType) c
     //qDebug() << "No offers, or none allowed as default";
     return KService::Ptr();
 }
+
+void KServiceTypeTrader::setResultCacheEnabled(bool enable)
+{
+    KTraderResultCache::setEnabled(enable);
+}
+
+bool KServiceTypeTrader::isResultCacheEnabled()
+{
+    return KTraderResultCache::isEnabled();
+}
+
+double KServiceTypeTrader::resultCacheHitRate()
+{
+    return KTraderResultCache::hitRate();
+}
@@ -205,6 +205,38 @@ public:
     static void applyConstraints(KService::List &lst,
                                  const QString &constraint);
 
+    /**
+     * Enables caching of the results of query() and preferredService(),
+     * as well as of KMimeTypeTrader::query() and KMimeTypeTrader::preferredService():
+     * there is one cache for both traders, KMimeTypeTrader::setResultCacheEnabled()
+     * is the same as this method.
+     *
+     * Repeating a query then returns the same (implicitly shared) list without
+     * evaluating anything again. The cached results are dropped automatically
+     * when the sycoca database changes, when a service type profile is modified,
+     * or when XDG_CURRENT_DESKTOP changes.
+     *
+     * The cache is disabled by default. Enabling or disabling it resets the hit rate.
+     *
+     * @since 5.53
+     */
+    static void setResultCacheEnabled(bool enable);
+
+    /**
+     * @return true if the result cache is enabled
+     * @see setResultCacheEnabled
+     * @since 5.53
+     */
+    static bool isResultCacheEnabled();
+
+    /**
+     * @return the ratio of the queries answered by the result cache,
+     * between 0 and 1, since it was enabled
+     * @see setResultCacheEnabled
+     * @since 5.53
+     */
+    static double resultCacheHitRate();
+
 private:
     /**
      * @internal
@@ -216,6 +248,9 @@ private:
     KServiceTypeTrader &operator=(const KServiceTypeTrader &rhs);
 
     static KServiceOfferList weightedOffers(const QString &serviceType);
+    static KServiceOfferList firstOffer(const QString &serviceType);
+    KService::List uncachedQuery(const QString &serviceType, const QString &constraint) const;
+    KService::Ptr uncachedPreferredService(const QString &serviceType) const;
 
     KServiceTypeTraderPrivate *const d;
 
@@ -17,13 +17,11 @@
    Boston, MA 02110-1301, USA.
 */
 
-// TODO: Torben: On error free memory!   (r932881 might serve as inspiration)
-
 extern "C"
 {
 #include "ktraderparse_p.h"
 
-    void KTraderParse_mainParse(const char *_code);
+    void KTraderParse_mainParse(const char *_code, void *_data);
 }
 
 #include "ktraderparsetree_p.h"
@@ -31,12 +29,12 @@ extern "C"
 #include <assert.h>
 #include <stdlib.h>
 
-#include <QThreadStorage>
 #include "servicesdebug.h"
 
 namespace KTraderParse
 {
 
+// The state of one call to parseConstraints, passed through the parser
 struct ParsingData {
     ParseTreeBase::Ptr ptr;
     QByteArray buffer;
@@ -46,28 +44,24 @@ struct ParsingData {
 
 using namespace KTraderParse;
 
-Q_GLOBAL_STATIC(QThreadStorage<ParsingData *>, s_parsingData)
-
 ParseTreeBase::Ptr KTraderParse::parseConstraints(const QString &_constr)
 {
-    ParsingData *data = new ParsingData();
-    s_parsingData()->setLocalData(data);
-    data->buffer = _constr.toUtf8();
-    KTraderParse_mainParse(data->buffer.constData());
-    ParseTreeBase::Ptr ret = data->ptr;
-    s_parsingData()->setLocalData(nullptr);
-    return ret;
+    ParsingData data;
+    data.buffer = _constr.toUtf8();
+    KTraderParse_mainParse(data.buffer.constData(), &data);
+    return data.ptr;
 }
 
-void KTraderParse_setParseTree(void *_ptr1)
+void KTraderParse_setParseTree(void *_ptr1, void *_data)
 {
-    ParsingData *data = s_parsingData()->localData();
+    ParsingData *data = static_cast<ParsingData *>(_data);
     data->ptr = static_cast<ParseTreeBase *>(_ptr1);
 }
 
-void KTraderParse_error(const char *err)
+void KTraderParse_error(const char *err, void *_data)
 {
-    qCWarning(SERVICES) << "Parsing" << s_parsingData()->localData()->buffer << "gave:" << err;
+    const ParsingData *data = static_cast<const ParsingData *>(_data);
+    qCWarning(SERVICES) << "Parsing" << data->buffer << "gave:" << err;
 }
 
 void *KTraderParse_newOR(void *_ptr1, void *_ptr2)
@@ -171,10 +165,11 @@ void *KTraderParse_newMIN2(char *_id)
     return t;
 }
 
-void KTraderParse_destroy(void *node)
+void KTraderParse_destroy(void *node, void *_data)
 {
-    ParsingData *data = s_parsingData()->localData();
-    ParseTreeBase *p = reinterpret_cast<ParseTreeBase *>(node);
+    // Called by the parser for the partial trees it discards on error
+    const ParsingData *data = static_cast<const ParsingData *>(_data);
+    ParseTreeBase *p = static_cast<ParseTreeBase *>(node);
     if (p != data->ptr.data()) {
         delete p;
     }
@@ -23,9 +23,9 @@
 /*
  * Functions definition for yacc
  */
-void KTraderParse_mainParse(const char *_code);
-void KTraderParse_setParseTree(void *_ptr1);
-void KTraderParse_error(const char *err);
+void KTraderParse_mainParse(const char *_code, void *_data);
+void KTraderParse_setParseTree(void *_ptr1, void *_data);
+void KTraderParse_error(const char *err, void *_data);
 void *KTraderParse_newOR(void *_ptr1, void *_ptr2);
 void *KTraderParse_newAND(void *_ptr1, void *_ptr2);
 void *KTraderParse_newCMP(void *_ptr1, void *_ptr2, int _i);
@@ -52,6 +52,6 @@ void *KTraderParse_newCI(void *_ptr1);
 void *KTraderParse_newFIRST();
 void *KTraderParse_newRANDOM();
 
-void KTraderParse_destroy(void *);
+void KTraderParse_destroy(void *node, void *_data);
 
 #endif
@@ -0,0 +1,720 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "ktraderparseprogram_p.h"
+#include "ksycocautils_p.h"
+
+#include <QVarLengthArray>
+
+namespace KTraderParse
+{
+
+// Compilation of the parse tree nodes
+
+void ParseTreeOR::compile(ParseCompiler *_compiler) const
+{
+    // Short-circuit, like eval(): the right side isn't evaluated
+    // (and can't fail) when the left side is true.
+    m_pLeft->compile(_compiler);
+    _compiler->append(ParseInstruction::AssertBool);
+    const int jump = _compiler->append(ParseInstruction::JumpIfTrue);
+    _compiler->append(ParseInstruction::Pop);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::AssertBool);
+    _compiler->patchJump(jump);
+}
+
+void ParseTreeAND::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    _compiler->append(ParseInstruction::AssertBool);
+    const int jump = _compiler->append(ParseInstruction::JumpIfFalse);
+    _compiler->append(ParseInstruction::Pop);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::AssertBool);
+    _compiler->patchJump(jump);
+}
+
+void ParseTreeCMP::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::Cmp, m_cmd);
+}
+
+void ParseTreeIN::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::In, (m_cs == Qt::CaseSensitive ? 1 : 0) | (m_substring ? 2 : 0));
+}
+
+void ParseTreeMATCH::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::Match, m_cs == Qt::CaseSensitive ? 1 : 0);
+}
+
+void ParseTreeSubsequenceMATCH::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::SubseqMatch, m_cs == Qt::CaseSensitive ? 1 : 0);
+}
+
+void ParseTreeCALC::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    m_pRight->compile(_compiler);
+    _compiler->append(ParseInstruction::Calc, m_cmd);
+}
+
+void ParseTreeBRACKETS::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+}
+
+void ParseTreeNOT::compile(ParseCompiler *_compiler) const
+{
+    m_pLeft->compile(_compiler);
+    _compiler->append(ParseInstruction::Not);
+}
+
+void ParseTreeEXIST::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::Exist, _compiler->addString(m_id));
+}
+
+void ParseTreeID::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::PushProperty, _compiler->addString(m_str));
+}
+
+void ParseTreeSTRING::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::PushString, _compiler->addString(m_str));
+}
+
+void ParseTreeNUM::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::PushNum, m_int);
+}
+
+void ParseTreeDOUBLE::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::PushDouble, _compiler->addDouble(m_double));
+}
+
+void ParseTreeBOOL::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::PushBool, m_bool ? 1 : 0);
+}
+
+void ParseTreeMAX2::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::Max, _compiler->addString(m_strId));
+}
+
+void ParseTreeMIN2::compile(ParseCompiler *_compiler) const
+{
+    _compiler->append(ParseInstruction::Min, _compiler->addString(m_strId));
+}
+
+// The compiler
+
+ParseCompiler::ParseCompiler(ParseProgram *program)
+    : m_program(program), m_depth(0)
+{
+}
+
+int ParseCompiler::append(ParseInstruction::OpCode op, qint32 arg)
+{
+    switch (op) {
+    case ParseInstruction::PushString:
+    case ParseInstruction::PushNum:
+    case ParseInstruction::PushDouble:
+    case ParseInstruction::PushBool:
+    case ParseInstruction::PushProperty:
+    case ParseInstruction::Exist:
+    case ParseInstruction::Max:
+    case ParseInstruction::Min:
+        ++m_depth;
+        break;
+    case ParseInstruction::Cmp:
+    case ParseInstruction::Calc:
+    case ParseInstruction::In:
+    case ParseInstruction::Match:
+    case ParseInstruction::SubseqMatch:
+    case ParseInstruction::Pop:
+        --m_depth;
+        break;
+    case ParseInstruction::Not:
+    case ParseInstruction::AssertBool:
+    case ParseInstruction::JumpIfTrue:
+    case ParseInstruction::JumpIfFalse:
+        break;
+    }
+    Q_ASSERT(m_depth >= 0);
+    m_program->m_maxDepth = qMax(m_program->m_maxDepth, m_depth);
+
+    ParseInstruction instruction;
+    instruction.op = op;
+    instruction.arg = arg;
+    m_program->m_code.append(instruction);
+    return m_program->m_code.count() - 1;
+}
+
+void ParseCompiler::patchJump(int pos)
+{
+    m_program->m_code[pos].arg = m_program->m_code.count();
+}
+
+qint32 ParseCompiler::addString(const QString &str)
+{
+    int idx = m_program->m_strings.indexOf(str);
+    if (idx == -1) {
+        m_program->m_strings.append(str);
+        idx = m_program->m_strings.count() - 1;
+    }
+    return idx;
+}
+
+qint32 ParseCompiler::addDouble(double d)
+{
+    m_program->m_doubles.append(d);
+    return m_program->m_doubles.count() - 1;
+}
+
+// The virtual machine
+
+namespace
+{
+// One slot of the value stack. The implicitly shared members
+// don't allocate anything until a property value is stored in them.
+struct ParseValue {
+    ParseValue() : type(ParseContext::T_BOOL), i(0), f(0), b(false) {}
+
+    ParseContext::Type type;
+    int i;
+    double f;
+    bool b;
+    QString str;
+    QStringList strSeq;
+    QList<QVariant> seq;
+};
+}
+
+// Same as ParseTreeID::eval
+static bool loadProperty(const QVariant &prop, ParseValue &v)
+{
+    switch (prop.type()) {
+    case QVariant::String:
+        v.str = prop.toString();
+        v.type = ParseContext::T_STRING;
+        return true;
+    case QVariant::Int:
+        v.i = prop.toInt();
+        v.type = ParseContext::T_NUM;
+        return true;
+    case QVariant::Bool:
+        v.b = prop.toBool();
+        v.type = ParseContext::T_BOOL;
+        return true;
+    case QVariant::Double:
+        v.f = prop.toDouble();
+        v.type = ParseContext::T_DOUBLE;
+        return true;
+    case QVariant::List:
+        v.seq = prop.toList();
+        v.type = ParseContext::T_SEQ;
+        return true;
+    case QVariant::StringList:
+        v.strSeq = prop.toStringList();
+        v.type = ParseContext::T_STR_SEQ;
+        return true;
+    default:
+        // Invalid, or value has unknown type
+        return false;
+    }
+}
+
+// Same as ParseTreeMAX2::eval and ParseTreeMIN2::eval
+static bool loadExtremum(ParseContext *context, const QString &key, bool max, ParseValue &v)
+{
+    const QVariant prop = context->property(key);
+    if (!prop.isValid()) {
+        return false;
+    }
+    if (!context->initMaxima(key)) {
+        return false;
+    }
+    QMap<QString, PreferencesMaxima>::ConstIterator it = context->maxima.constFind(key);
+    if (it == context->maxima.constEnd()) {
+        return false;
+    }
+
+    double ratio;
+    if (prop.type() == QVariant::Int && it.value().type == PreferencesMaxima::PM_INT) {
+        ratio = double(prop.toInt() - it.value().iMin) / double(it.value().iMax - it.value().iMin);
+    } else if (prop.type() == QVariant::Double && it.value().type == PreferencesMaxima::PM_DOUBLE) {
+        ratio = (prop.toDouble() - it.value().fMin) / (it.value().fMax - it.value().fMin);
+    } else {
+        return false;
+    }
+    v.type = ParseContext::T_DOUBLE;
+    v.f = max ? ratio * 2.0 - 1.0 : ratio * (-2.0) + 1.0;
+    return true;
+}
+
+static inline void boolToNum(ParseValue &v)
+{
+    v.type = ParseContext::T_NUM;
+    v.i = v.b ? 1 : -1;
+}
+
+static inline void boolToDouble(ParseValue &v)
+{
+    v.type = ParseContext::T_DOUBLE;
+    v.f = v.b ? 1.0 : -1.0;
+}
+
+// Same as ParseTreeCALC::eval, the result is stored into c1
+static bool calc(int cmd, ParseValue &c1, ParseValue &c2)
+{
+    // Bool extension
+    if (c1.type != ParseContext::T_NUM && c1.type != ParseContext::T_DOUBLE && c1.type != ParseContext::T_BOOL) {
+        return false;
+    }
+    if (c2.type != ParseContext::T_NUM && c2.type != ParseContext::T_DOUBLE && c2.type != ParseContext::T_BOOL) {
+        return false;
+    }
+    if (c1.type == ParseContext::T_BOOL && c2.type == ParseContext::T_BOOL) {
+        return false;
+    }
+
+    // Make types compatible
+    if (c1.type == ParseContext::T_NUM && c2.type == ParseContext::T_DOUBLE) {
+        c1.type = ParseContext::T_DOUBLE;
+        c1.f = c1.i;
+    } else if (c1.type == ParseContext::T_DOUBLE && c2.type == ParseContext::T_NUM) {
+        c2.type = ParseContext::T_DOUBLE;
+        c2.f = c2.i;
+    } else if (c1.type == ParseContext::T_BOOL && c2.type == ParseContext::T_NUM) {
+        boolToNum(c1);
+    } else if (c1.type == ParseContext::T_BOOL && c2.type == ParseContext::T_DOUBLE) {
+        boolToDouble(c1);
+    } else if (c1.type == ParseContext::T_NUM && c2.type == ParseContext::T_BOOL) {
+        boolToNum(c2);
+    } else if (c1.type == ParseContext::T_DOUBLE && c2.type == ParseContext::T_BOOL) {
+        boolToDouble(c2);
+    }
+
+    const bool isDouble = c1.type == ParseContext::T_DOUBLE;
+    switch (cmd) {
+    case 1: /* Add */
+        if (isDouble) {
+            c1.f += c2.f;
+        } else {
+            c1.i += c2.i;
+        }
+        return true;
+    case 2: /* Sub */
+        if (isDouble) {
+            c1.f -= c2.f;
+        } else {
+            c1.i -= c2.i;
+        }
+        return true;
+    case 3: /* Mul */
+        if (isDouble) {
+            c1.f *= c2.f;
+        } else {
+            c1.i *= c2.i;
+        }
+        return true;
+    case 4: /* Div */
+        if (isDouble) {
+            c1.f /= c2.f;
+        } else {
+            if (c2.i == 0) {
+                return false;
+            }
+            c1.i /= c2.i;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Same as ParseTreeCMP::eval, the result is stored into c1
+static bool compare(int cmd, ParseValue &c1, ParseValue &c2)
+{
+    // Make types compatible
+    if (c1.type == ParseContext::T_NUM && c2.type == ParseContext::T_DOUBLE) {
+        c1.type = ParseContext::T_DOUBLE;
+        c1.f = c1.i;
+    } else if (c1.type == ParseContext::T_DOUBLE && c2.type == ParseContext::T_NUM) {
+        c2.type = ParseContext::T_DOUBLE;
+        c2.f = c2.i;
+    }
+
+    bool result = false;
+    switch (cmd) {
+    case 1: /* EQ */
+    case 7: /* EQI */
+    case 2: /* NEQ */
+    case 8: /* NEQI */ {
+        const bool negate = (cmd == 2 || cmd == 8);
+        if (c1.type != c2.type) {
+            result = false;
+        } else if (c1.type == ParseContext::T_STRING) {
+            if (cmd == 7 || cmd == 8) {
+                result = QString::compare(c1.str, c2.str, Qt::CaseInsensitive) == 0;
+            } else {
+                result = (c1.str == c2.str);
+            }
+        } else if (c1.type == ParseContext::T_BOOL) {
+            result = (c1.b == c2.b);
+        } else if (c1.type == ParseContext::T_DOUBLE) {
+            result = qFuzzyCompare(c1.f, c2.f);
+        } else if (c1.type == ParseContext::T_NUM) {
+            result = (c1.i == c2.i);
+        } else {
+            return false;
+        }
+        result = negate ? !result : result;
+        break;
+    }
+    case 3: /* GEQ */
+    case 4: /* LEQ */
+    case 5: /* < */
+    case 6: /* > */
+        if (c1.type != c2.type) {
+            result = false;
+        } else if (c1.type == ParseContext::T_DOUBLE) {
+            result = cmd == 3 ? c1.f >= c2.f : cmd == 4 ? c1.f <= c2.f : cmd == 5 ? c1.f < c2.f : c1.f > c2.f;
+        } else if (c1.type == ParseContext::T_NUM) {
+            result = cmd == 3 ? c1.i >= c2.i : cmd == 4 ? c1.i <= c2.i : cmd == 5 ? c1.i < c2.i : c1.i > c2.i;
+        } else {
+            result = false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    c1.type = ParseContext::T_BOOL;
+    c1.b = result;
+    return true;
+}
+
+// Same as ParseTreeIN::eval, the result is stored into c1
+static bool contains(int flags, ParseValue &c1, const ParseValue &c2)
+{
+    bool result = false;
+    if (c1.type == ParseContext::T_NUM && c2.type == ParseContext::T_SEQ
+            && !c2.seq.isEmpty() && c2.seq.first().type() == QVariant::Int) {
+        for (const QVariant &v : c2.seq) {
+            if (v.type() == QVariant::Int && v.toInt() == c1.i) {
+                result = true;
+                break;
+            }
+        }
+    } else if (c1.type == ParseContext::T_DOUBLE && c2.type == ParseContext::T_SEQ
+            && !c2.seq.isEmpty() && c2.seq.first().type() == QVariant::Double) {
+        for (const QVariant &v : c2.seq) {
+            if (v.type() == QVariant::Double && qFuzzyCompare(v.toDouble(), c1.f)) {
+                result = true;
+                break;
+            }
+        }
+    } else if (c1.type == ParseContext::T_STRING && c2.type == ParseContext::T_STR_SEQ) {
+        // Substring matching (flag 2) is disabled in ParseTreeIN::eval too.
+        result = c2.strSeq.contains(c1.str, (flags & 1) ? Qt::CaseSensitive : Qt::CaseInsensitive);
+    } else {
+        return false;
+    }
+
+    c1.type = ParseContext::T_BOOL;
+    c1.b = result;
+    return true;
+}
+
+ParseProgram::ParseProgram(const ParseTreeBase *tree)
+    : m_maxDepth(0)
+{
+    if (tree) {
+        ParseCompiler compiler(this);
+        tree->compile(&compiler);
+    }
+}
+
+bool ParseProgram::usesExtrema() const
+{
+    for (const ParseInstruction &ins : m_code) {
+        if (ins.op == ParseInstruction::Max || ins.op == ParseInstruction::Min) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QStringList ParseProgram::propertyNames() const
+{
+    QStringList names;
+    for (const ParseInstruction &ins : m_code) {
+        switch (ins.op) {
+        case ParseInstruction::PushProperty:
+        case ParseInstruction::Exist:
+        case ParseInstruction::Max:
+        case ParseInstruction::Min:
+            if (!names.contains(m_strings.at(ins.arg))) {
+                names.append(m_strings.at(ins.arg));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return names;
+}
+
+void ParseProgram::setPropertyTypes(const QHash<QString, int> &types)
+{
+    m_propertyTypes.fill(QVariant::Invalid, m_strings.count());
+    for (int i = 0; i < m_strings.count(); ++i) {
+        m_propertyTypes[i] = types.value(m_strings.at(i), QVariant::Invalid);
+    }
+}
+
+QVariant ParseProgram::property(ParseContext *context, int idx) const
+{
+    if (m_propertyTypes.isEmpty() || !context->service) {
+        return context->property(m_strings.at(idx));
+    }
+    const int type = m_propertyTypes.at(idx);
+    if (type == UnknownProperty) {
+        return QVariant();
+    }
+    return context->service->property(m_strings.at(idx), static_cast<QVariant::Type>(type));
+}
+
+int ParseProgram::match(ParseContext *context) const
+{
+    // Empty program matches always
+    if (m_code.isEmpty()) {
+        return 1;
+    }
+
+    QVarLengthArray<ParseValue, 16> stack(m_maxDepth);
+    int sp = 0; // number of values on the stack
+
+    const ParseInstruction *code = m_code.constData();
+    const int size = m_code.count();
+    int pc = 0;
+    while (pc < size) {
+        const ParseInstruction &ins = code[pc++];
+        switch (ins.op) {
+        case ParseInstruction::PushString: {
+            ParseValue &v = stack[sp++];
+            v.type = ParseContext::T_STRING;
+            v.str = m_strings.at(ins.arg);
+            break;
+        }
+        case ParseInstruction::PushNum: {
+            ParseValue &v = stack[sp++];
+            v.type = ParseContext::T_NUM;
+            v.i = ins.arg;
+            break;
+        }
+        case ParseInstruction::PushDouble: {
+            ParseValue &v = stack[sp++];
+            v.type = ParseContext::T_DOUBLE;
+            v.f = m_doubles.at(ins.arg);
+            break;
+        }
+        case ParseInstruction::PushBool: {
+            ParseValue &v = stack[sp++];
+            v.type = ParseContext::T_BOOL;
+            v.b = ins.arg != 0;
+            break;
+        }
+        case ParseInstruction::PushProperty:
+            if (!loadProperty(property(context, ins.arg), stack[sp++])) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::Exist: {
+            ParseValue &v = stack[sp++];
+            v.type = ParseContext::T_BOOL;
+            v.b = property(context, ins.arg).isValid();
+            break;
+        }
+        case ParseInstruction::Max:
+        case ParseInstruction::Min:
+            if (!loadExtremum(context, m_strings.at(ins.arg), ins.op == ParseInstruction::Max, stack[sp++])) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::Cmp:
+            --sp;
+            if (!compare(ins.arg, stack[sp - 1], stack[sp])) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::Calc:
+            --sp;
+            if (!calc(ins.arg, stack[sp - 1], stack[sp])) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::In:
+            --sp;
+            if (!contains(ins.arg, stack[sp - 1], stack[sp])) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::Match:
+        case ParseInstruction::SubseqMatch: {
+            --sp;
+            ParseValue &c1 = stack[sp - 1];
+            const ParseValue &c2 = stack[sp];
+            if (c1.type != ParseContext::T_STRING || c2.type != ParseContext::T_STRING) {
+                return -1;
+            }
+            const Qt::CaseSensitivity cs = ins.arg ? Qt::CaseSensitive : Qt::CaseInsensitive;
+            c1.b = ins.op == ParseInstruction::Match ? c2.str.contains(c1.str, cs)
+                   : ParseTreeSubsequenceMATCH::isSubseq(c1.str, c2.str, cs);
+            c1.type = ParseContext::T_BOOL;
+            break;
+        }
+        case ParseInstruction::Not: {
+            ParseValue &v = stack[sp - 1];
+            if (v.type != ParseContext::T_BOOL) {
+                return -1;
+            }
+            v.b = !v.b;
+            break;
+        }
+        case ParseInstruction::Pop:
+            --sp;
+            break;
+        case ParseInstruction::AssertBool:
+            if (stack[sp - 1].type != ParseContext::T_BOOL) {
+                return -1;
+            }
+            break;
+        case ParseInstruction::JumpIfTrue:
+            if (stack[sp - 1].b) {
+                pc = ins.arg;
+            }
+            break;
+        case ParseInstruction::JumpIfFalse:
+            if (!stack[sp - 1].b) {
+                pc = ins.arg;
+            }
+            break;
+        }
+    }
+
+    Q_ASSERT(sp == 1);
+    // Did we get a bool ?
+    if (stack[0].type != ParseContext::T_BOOL) {
+        return -1;
+    }
+    return stack[0].b ? 1 : 0;
+}
+
+int matchProgram(const ParseProgram &program, const KService::Ptr &service,
+                 const KService::List &offers)
+{
+    QMap<QString, PreferencesMaxima> maxima;
+    return matchProgram(program, service, offers, maxima);
+}
+
+int matchProgramPlugin(const ParseProgram &program, const KPluginInfo &info,
+                       const KPluginInfo::List &offers)
+{
+    QMap<QString, PreferencesMaxima> maxima;
+    return matchProgramPlugin(program, info, offers, maxima);
+}
+
+int matchProgram(const ParseProgram &program, const KService::Ptr &service,
+                 const KService::List &offers, QMap<QString, PreferencesMaxima> &maxima)
+{
+    ParseContext c(service, offers, maxima);
+    return program.match(&c);
+}
+
+int matchProgramPlugin(const ParseProgram &program, const KPluginInfo &info,
+                       const KPluginInfo::List &offers, QMap<QString, PreferencesMaxima> &maxima)
+{
+    ParseContext c(info, offers, maxima);
+    return program.match(&c);
+}
+
+template<typename T>
+using MatchFunction = int (*)(const ParseProgram &, const T &, const QList<T> &, QMap<QString, PreferencesMaxima> &);
+
+static const int s_parallelThreshold = 256; // see KSycocaUtilsPrivate::chunkCount
+
+template<typename T>
+static void filterList(const ParseProgram &program, QList<T> &lst, MatchFunction<T> match, bool parallel)
+{
+    const int count = lst.count();
+    QVector<char> matches(count);
+    char *results = matches.data();
+    const QList<T> &candidates = lst;
+
+    auto matchRange = [&program, &candidates, match, results](int begin, int end) {
+        QMap<QString, PreferencesMaxima> maxima; // shared by all candidates
+        for (int i = begin; i < end; ++i) {
+            results[i] = match(program, candidates.at(i), candidates, maxima) == 1;
+        }
+    };
+    if (parallel) {
+        KSycocaUtilsPrivate::parallelForChunks(count, s_parallelThreshold, matchRange);
+    } else {
+        matchRange(0, count);
+    }
+
+    // Compact, keeping the order
+    QList<T> result;
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        if (matches.at(i)) {
+            result.append(lst.at(i));
+        }
+    }
+    lst.swap(result);
+}
+
+void applyProgram(const ParseProgram &program, KService::List &lst)
+{
+    filterList<KService::Ptr>(program, lst, &matchProgram,
+                              !program.usesExtrema() && program.hasPropertyTypes());
+}
+
+void applyProgramPlugin(const ParseProgram &program, KPluginInfo::List &lst)
+{
+    // KPluginInfo::property() looks up the property types in ksycoca, which is per thread
+    filterList<KPluginInfo>(program, lst, &matchProgramPlugin, false);
+}
+
+}
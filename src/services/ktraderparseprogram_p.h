@@ -0,0 +1,198 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KTRADERPARSEPROGRAM_P_H
+#define KTRADERPARSEPROGRAM_P_H
+
+#include <QHash>
+#include <QVector>
+
+#include "ktraderparsetree_p.h"
+
+namespace KTraderParse
+{
+
+/**
+ * @internal
+ * A single instruction of a compiled constraint.
+ * Depending on the opcode, @p arg is an immediate value,
+ * an index into one of the constant pools, or a jump target.
+ */
+struct ParseInstruction {
+    enum OpCode : quint8 {
+        PushString,     // arg: index into the string pool
+        PushNum,        // arg: immediate integer
+        PushDouble,     // arg: index into the double pool
+        PushBool,       // arg: 0 or 1
+        PushProperty,   // arg: property name (string pool)
+        Exist,          // arg: property name (string pool)
+        Max,            // arg: property name (string pool)
+        Min,            // arg: property name (string pool)
+        Cmp,            // arg: command, same values as ParseTreeCMP
+        Calc,           // arg: command, same values as ParseTreeCALC
+        In,             // arg: bit 0 = case sensitive, bit 1 = substring
+        Match,          // arg: 1 = case sensitive
+        SubseqMatch,    // arg: 1 = case sensitive
+        Not,
+        Pop,
+        AssertBool,
+        JumpIfTrue,     // arg: target pc, the tested value stays on the stack
+        JumpIfFalse     // arg: target pc, the tested value stays on the stack
+    };
+
+    OpCode op;
+    qint32 arg;
+};
+
+class ParseProgram;
+
+/**
+ * @internal
+ * Used by ParseTreeBase::compile() to append the instructions of a tree node.
+ */
+class ParseCompiler
+{
+public:
+    explicit ParseCompiler(ParseProgram *program);
+
+    /**
+     * Appends an instruction, keeping track of the stack depth.
+     * @return the position of the new instruction
+     */
+    int append(ParseInstruction::OpCode op, qint32 arg = 0);
+
+    /**
+     * Makes the jump instruction at @p pos point to the next instruction.
+     */
+    void patchJump(int pos);
+
+    qint32 addString(const QString &str);
+    qint32 addDouble(double d);
+
+private:
+    ParseProgram *m_program;
+    int m_depth;
+};
+
+/**
+ * @internal
+ * A constraint compiled from a parse tree into a flat stack program.
+ *
+ * Evaluating it only uses a fixed size value stack, allocated once per
+ * candidate, instead of the two ParseContext copies per node that
+ * ParseTreeBase::eval() needs. The tree stays the reference implementation,
+ * both must always give the same result.
+ */
+class ParseProgram
+{
+public:
+    /**
+     * Compiles @p tree. A null tree gives an empty program, which matches everything.
+     */
+    explicit ParseProgram(const ParseTreeBase *tree);
+
+    /**
+     * @return 0  => Does not match
+     *         1  => Does match
+     *         <0 => Error
+     */
+    int match(ParseContext *context) const;
+
+    int instructionCount() const
+    {
+        return m_code.count();
+    }
+
+    /**
+     * @return true if the program uses "min" or "max", whose result
+     * depends on all the offers being evaluated.
+     */
+    bool usesExtrema() const;
+
+    /**
+     * Type given to setPropertyTypes() for the properties which don't exist.
+     */
+    enum { UnknownProperty = -1 };
+
+    /**
+     * @return the names of the properties used by the program
+     */
+    QStringList propertyNames() const;
+
+    /**
+     * Sets the types of all the properties used by the program: the result of
+     * KServiceTypeFactory::findPropertyTypeByName(), QVariant::Invalid for the
+     * builtin properties of KService, or UnknownProperty.
+     * Evaluating the program for services then doesn't need ksycoca anymore,
+     * and can be done from any thread.
+     */
+    void setPropertyTypes(const QHash<QString, int> &types);
+
+    bool hasPropertyTypes() const
+    {
+        return !m_propertyTypes.isEmpty();
+    }
+
+private:
+    friend class ParseCompiler;
+
+    QVariant property(ParseContext *context, int idx) const;
+
+    QVector<ParseInstruction> m_code;
+    QStringList m_strings;
+    QVector<double> m_doubles;
+    QVector<int> m_propertyTypes; // indexed like m_strings, empty if not set
+    int m_maxDepth;
+};
+
+/**
+ * @internal
+ * Same as matchConstraint(), using a compiled program.
+ */
+int matchProgram(const ParseProgram &program, const KService::Ptr &service,
+                 const KService::List &offers);
+int matchProgramPlugin(const ParseProgram &program, const KPluginInfo &info,
+                       const KPluginInfo::List &offers);
+
+/**
+ * @internal
+ * Same as above, but the min/max extrema computed over @p offers are
+ * stored into @p maxima, so that they can be reused for the next
+ * candidate of the same query.
+ */
+int matchProgram(const ParseProgram &program, const KService::Ptr &service,
+                 const KService::List &offers, QMap<QString, PreferencesMaxima> &maxima);
+int matchProgramPlugin(const ParseProgram &program, const KPluginInfo &info,
+                       const KPluginInfo::List &offers, QMap<QString, PreferencesMaxima> &maxima);
+
+/**
+ * @internal
+ * Removes from @p lst all the entries which don't match @p program.
+ * All entries are evaluated against the unmodified list, sharing the
+ * min/max extrema, then the list is compacted in one pass keeping the order.
+ *
+ * Large lists of services are evaluated by several threads of the global
+ * thread pool, if the property types have been set and the program doesn't
+ * use min/max.
+ */
+void applyProgram(const ParseProgram &program, KService::List &lst);
+void applyProgramPlugin(const ParseProgram &program, KPluginInfo::List &lst);
+
+}
+
+#endif
@@ -497,7 +497,7 @@ bool ParseTreeIN::eval(ParseContext *_context) const
         _context->b = false;
         for (; it != end; ++it)
             if ((*it).type() == QVariant::Double &&
-                    qFuzzyCompare((*it).toDouble(), c1.i)) {
+                    qFuzzyCompare((*it).toDouble(), c1.f)) {
                 _context->b = true;
                 break;
             }
@@ -752,10 +752,10 @@ bool ParseContext::initMaxima(const QString &_prop)
             }
             // Correct existing extrema
             else if (extrema.type == PreferencesMaxima::PM_DOUBLE) {
-                if (p.toDouble() < it.value().fMin) {
+                if (p.toDouble() < extrema.fMin) {
                     extrema.fMin = p.toDouble();
                 }
-                if (p.toDouble() > it.value().fMax) {
+                if (p.toDouble() > extrema.fMax) {
                     extrema.fMax = p.toDouble();
                 }
             }
@@ -772,6 +772,65 @@ bool ParseContext::initMaxima(const QString &_prop)
 
 ParseTreeBase::~ParseTreeBase() { }
 
+void ParseTreeBase::indexPredicates(QVector<IndexPredicate> &) const
+{
+}
+
+void ParseTreeAND::indexPredicates(QVector<IndexPredicate> &_preds) const
+{
+    m_pLeft->indexPredicates(_preds);
+    m_pRight->indexPredicates(_preds);
+}
+
+void ParseTreeBRACKETS::indexPredicates(QVector<IndexPredicate> &_preds) const
+{
+    m_pLeft->indexPredicates(_preds);
+}
+
+void ParseTreeEXIST::indexPredicates(QVector<IndexPredicate> &_preds) const
+{
+    IndexPredicate pred;
+    pred.kind = IndexPredicate::Exists;
+    pred.property = m_id;
+    _preds.append(pred);
+}
+
+void ParseTreeCMP::indexPredicates(QVector<IndexPredicate> &_preds) const
+{
+    if (m_cmd != 1) { // only "==", the index is case sensitive
+        return;
+    }
+    const ParseTreeID *id = dynamic_cast<const ParseTreeID *>(m_pLeft.data());
+    const ParseTreeSTRING *str = dynamic_cast<const ParseTreeSTRING *>(m_pRight.data());
+    if (!id || !str) {
+        id = dynamic_cast<const ParseTreeID *>(m_pRight.data());
+        str = dynamic_cast<const ParseTreeSTRING *>(m_pLeft.data());
+    }
+    if (id && str) {
+        IndexPredicate pred;
+        pred.kind = IndexPredicate::Equals;
+        pred.property = id->name();
+        pred.value = str->value();
+        _preds.append(pred);
+    }
+}
+
+void ParseTreeIN::indexPredicates(QVector<IndexPredicate> &_preds) const
+{
+    if (m_cs != Qt::CaseSensitive) {
+        return;
+    }
+    const ParseTreeSTRING *str = dynamic_cast<const ParseTreeSTRING *>(m_pLeft.data());
+    const ParseTreeID *id = dynamic_cast<const ParseTreeID *>(m_pRight.data());
+    if (id && str) {
+        IndexPredicate pred;
+        pred.kind = IndexPredicate::Contains;
+        pred.property = id->name();
+        pred.value = str->value();
+        _preds.append(pred);
+    }
+}
+
 bool ParseTreeSTRING::eval(ParseContext *_context) const
 {
     _context->type = ParseContext::T_STRING;
@@ -23,14 +23,23 @@
 #include <QString>
 #include <QStringList>
 #include <QMap>
+#include <QVector>
 
 #include <kservice.h>
 #include <kplugininfo.h>
 
+// Only for the symbols kservicetest needs, but can't build itself (the parser is generated)
+#ifdef KSERVICE_BUILD_TESTS
+# define KSERVICE_TESTS_EXPORT KSERVICE_EXPORT
+#else
+# define KSERVICE_TESTS_EXPORT
+#endif
+
 namespace KTraderParse
 {
 
 class ParseTreeBase;
+class ParseCompiler;
 
 /**
  * @internal
@@ -103,6 +112,19 @@ public:
     KPluginInfo::List pluginOffers;
 };
 
+/**
+ * @internal
+ * A predicate which must be true for a constraint to match,
+ * and which can be answered by the property indexes of ksycoca.
+ */
+struct IndexPredicate {
+    enum Kind { Exists, Equals, Contains };
+
+    Kind kind;
+    QString property;
+    QString value;
+};
+
 /**
  * @internal
  */
@@ -114,9 +136,22 @@ public:
     virtual ~ParseTreeBase();
 
     virtual bool eval(ParseContext *_context) const = 0;
+
+    /**
+     * Appends the instructions evaluating this node to @p _compiler.
+     * The result must be the same as the one of eval().
+     */
+    virtual void compile(ParseCompiler *_compiler) const = 0;
+
+    /**
+     * Appends to @p _preds the predicates which must all be true for this
+     * node to evaluate to true. Only "and" nodes and the predicates below
+     * them are considered, the default implementation appends nothing.
+     */
+    virtual void indexPredicates(QVector<IndexPredicate> &_preds) const;
 };
 
-ParseTreeBase::Ptr parseConstraints(const QString &_constr);
+KSERVICE_TESTS_EXPORT ParseTreeBase::Ptr parseConstraints(const QString &_constr);
 
 /**
  * @internal
@@ -131,6 +166,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -150,6 +186,8 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+    void indexPredicates(QVector<IndexPredicate> &_preds) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -170,6 +208,8 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+    void indexPredicates(QVector<IndexPredicate> &_preds) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -192,6 +232,8 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+    void indexPredicates(QVector<IndexPredicate> &_preds) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -214,6 +256,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -247,6 +290,7 @@ public:
   }
 
   bool eval(ParseContext *_context) const override;
+  void compile(ParseCompiler *_compiler) const override;
 
   static bool isSubseq(const QString& pattern, const QString& text, Qt::CaseSensitivity cs);
 
@@ -270,6 +314,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -289,6 +334,8 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+    void indexPredicates(QVector<IndexPredicate> &_preds) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -306,6 +353,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     ParseTreeBase::Ptr m_pLeft;
@@ -323,6 +371,8 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+    void indexPredicates(QVector<IndexPredicate> &_preds) const override;
 
 protected:
     QString m_id;
@@ -340,6 +390,12 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+
+    const QString &name() const
+    {
+        return m_str;
+    }
 
 protected:
     QString m_str;
@@ -357,6 +413,12 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
+
+    const QString &value() const
+    {
+        return m_str;
+    }
 
 protected:
     QString m_str;
@@ -374,6 +436,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     int m_int;
@@ -391,6 +454,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     double m_double;
@@ -408,6 +472,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     bool m_bool;
@@ -425,6 +490,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     QString m_strId;
@@ -442,6 +508,7 @@ public:
     }
 
     bool eval(ParseContext *_context) const override;
+    void compile(ParseCompiler *_compiler) const override;
 
 protected:
     QString m_strId;
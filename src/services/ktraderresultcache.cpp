@@ -0,0 +1,115 @@
+/* This file is part of the KDE libraries
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "ktraderresultcache_p.h"
+
+#include "ksycoca.h"
+#include "ksycoca_p.h"
+#include "kservicetypeprofile_p.h"
+
+#include <QAtomicInt>
+#include <QThreadStorage>
+
+// Upper bound for the number of results kept per thread,
+// the cache is simply emptied when it's reached.
+static const int s_maxEntries = 512;
+
+static QAtomicInt s_enabled;
+static QAtomicInt s_hits;
+static QAtomicInt s_misses;
+
+static QThreadStorage<KTraderResultCache *> s_traderResultCaches;
+
+KTraderResultCache::KTraderResultCache()
+    : m_databaseGeneration(0),
+      m_profileGeneration(0)
+{
+}
+
+KTraderResultCache *KTraderResultCache::current()
+{
+    if (!isEnabled()) {
+        return nullptr;
+    }
+    if (!s_traderResultCaches.hasLocalData()) {
+        s_traderResultCaches.setLocalData(new KTraderResultCache);
+    }
+    KTraderResultCache *cache = s_traderResultCaches.localData();
+    cache->validate();
+    return cache;
+}
+
+void KTraderResultCache::validate()
+{
+    // This closes the database if it changed on disk, bumping its generation
+    KSycoca::self()->ensureCacheValid();
+
+    const quint32 databaseGeneration = KSycocaPrivate::self()->m_databaseGeneration;
+    const int profileGeneration = KServiceTypeProfile::generation();
+    const QByteArray currentDesktop = qgetenv("XDG_CURRENT_DESKTOP");
+    if (databaseGeneration != m_databaseGeneration
+            || profileGeneration != m_profileGeneration
+            || currentDesktop != m_currentDesktop) {
+        m_entries.clear();
+        m_databaseGeneration = databaseGeneration;
+        m_profileGeneration = profileGeneration;
+        m_currentDesktop = currentDesktop;
+    }
+}
+
+bool KTraderResultCache::find(QueryKind kind, const QString &type, const QString &genericType,
+                              const QString &constraint, KService::List &result)
+{
+    const Key key = { kind, type, genericType, constraint };
+    QHash<Key, KService::List>::const_iterator it = m_entries.constFind(key);
+    if (it == m_entries.constEnd()) {
+        s_misses.ref();
+        return false;
+    }
+    s_hits.ref();
+    result = it.value();
+    return true;
+}
+
+void KTraderResultCache::insert(QueryKind kind, const QString &type, const QString &genericType,
+                                const QString &constraint, const KService::List &result)
+{
+    if (m_entries.count() >= s_maxEntries) {
+        m_entries.clear();
+    }
+    const Key key = { kind, type, genericType, constraint };
+    m_entries.insert(key, result);
+}
+
+void KTraderResultCache::setEnabled(bool enable)
+{
+    s_enabled.store(enable ? 1 : 0);
+    s_hits.store(0);
+    s_misses.store(0);
+}
+
+bool KTraderResultCache::isEnabled()
+{
+    return s_enabled.load() != 0;
+}
+
+double KTraderResultCache::hitRate()
+{
+    const int hits = s_hits.load();
+    const int lookups = hits + s_misses.load();
+    return lookups == 0 ? 0.0 : double(hits) / lookups;
+}
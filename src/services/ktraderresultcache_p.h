@@ -0,0 +1,92 @@
+/* This file is part of the KDE libraries
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KTRADERRESULTCACHE_P_H
+#define KTRADERRESULTCACHE_P_H
+
+#include <QHash>
+#include <QString>
+
+#include "kservice.h"
+
+/**
+ * @internal
+ * Results of the trader queries of the current thread, see
+ * KServiceTypeTrader::setResultCacheEnabled().
+ *
+ * The entries are only valid for one generation of the database (bumped
+ * every time KSycoca closes it, e.g. on databaseChanged), one generation
+ * of the service type profiles and one value of XDG_CURRENT_DESKTOP;
+ * the whole cache is dropped as soon as one of them changes.
+ * The result lists are implicitly shared, returning them doesn't copy anything.
+ */
+class KTraderResultCache
+{
+public:
+    enum QueryKind {
+        ServiceTypeQuery,
+        ServiceTypePreferred,
+        MimeTypeQuery,
+        MimeTypePreferred
+    };
+
+    /**
+     * @return the cache of the current thread, or nullptr if the cache is disabled.
+     * Validates the database first, so that stale results are never returned.
+     */
+    static KTraderResultCache *current();
+
+    bool find(QueryKind kind, const QString &type, const QString &genericType,
+              const QString &constraint, KService::List &result);
+    void insert(QueryKind kind, const QString &type, const QString &genericType,
+                const QString &constraint, const KService::List &result);
+
+    static void setEnabled(bool enable);
+    static bool isEnabled();
+    static double hitRate();
+
+    struct Key {
+        QueryKind kind;
+        QString type;
+        QString genericType;
+        QString constraint;
+
+        bool operator==(const Key &other) const
+        {
+            return kind == other.kind && type == other.type
+                   && genericType == other.genericType && constraint == other.constraint;
+        }
+    };
+
+private:
+    KTraderResultCache();
+
+    void validate();
+
+    QHash<Key, KService::List> m_entries;
+    quint32 m_databaseGeneration;
+    int m_profileGeneration;
+    QByteArray m_currentDesktop;
+};
+
+inline uint qHash(const KTraderResultCache::Key &key, uint seed = 0)
+{
+    return qHash(key.type, seed) ^ qHash(key.genericType, seed)
+           ^ qHash(key.constraint, seed) ^ uint(key.kind);
+}
+
+#endif
@@ -6,7 +6,7 @@
 
 #define YYLTYPE_IS_TRIVIAL 0
 #define YYENABLE_NLS 0
-void yyerror(yyscan_t scanner, const char *s);
+void yyerror(yyscan_t scanner, void *_data, const char *s);
 int kiotraderlex(YYSTYPE * yylval, yyscan_t scanner);
 int kiotraderlex_init (yyscan_t* scanner);
 int kiotraderlex_destroy(yyscan_t scanner);
@@ -70,27 +70,30 @@ typedef void *yyscan_t;
 %type <ptr> factor_non
 %type <ptr> factor
 
-%destructor { KTraderParse_destroy( $$ ); } bool_or
-%destructor { KTraderParse_destroy( $$ ); } bool_and
-%destructor { KTraderParse_destroy( $$ ); } bool_compare
-%destructor { KTraderParse_destroy( $$ ); } expr_in
-%destructor { KTraderParse_destroy( $$ ); } expr_twiddle
-%destructor { KTraderParse_destroy( $$ ); } expr
-%destructor { KTraderParse_destroy( $$ ); } term
-%destructor { KTraderParse_destroy( $$ ); } factor_non
-%destructor { KTraderParse_destroy( $$ ); } factor
+%destructor { KTraderParse_destroy( $$, _data ); } bool_or
+%destructor { KTraderParse_destroy( $$, _data ); } bool_and
+%destructor { KTraderParse_destroy( $$, _data ); } bool_compare
+%destructor { KTraderParse_destroy( $$, _data ); } expr_in
+%destructor { KTraderParse_destroy( $$, _data ); } expr_twiddle
+%destructor { KTraderParse_destroy( $$, _data ); } expr
+%destructor { KTraderParse_destroy( $$, _data ); } term
+%destructor { KTraderParse_destroy( $$, _data ); } factor_non
+%destructor { KTraderParse_destroy( $$, _data ); } factor
+%destructor { free( $$ ); } VAL_STRING
+%destructor { free( $$ ); } VAL_ID
 
 %pure-parser
 
 %lex-param   { yyscan_t scanner }
 %parse-param { yyscan_t scanner }
+%parse-param { void *_data }
 
 /* Grammar follows */
 
 %%
 
-constraint: /* empty */ { KTraderParse_setParseTree( 0L ); }
-          | bool { KTraderParse_setParseTree( $<ptr>1 ); }
+constraint: /* empty */ { KTraderParse_setParseTree( 0L, _data ); }
+          | bool { KTraderParse_setParseTree( $<ptr>1, _data ); }
 ;
 
 bool: bool_or { $$ = $<ptr>1; }
@@ -158,17 +161,21 @@ factor: '(' bool_or ')' { $$ = KTraderParse_newBRACKETS( $<ptr>2 ); }
 
 %%
 
-void yyerror ( yyscan_t scanner, const char *s )  /* Called by yyparse on error */
+void yyerror ( yyscan_t scanner, void *_data, const char *s )  /* Called by yyparse on error */
 {
     (void) scanner;
-    KTraderParse_error( s );
+    KTraderParse_error( s, _data );
 }
 
-void KTraderParse_mainParse( const char *_code )
+/* All the parsing state is in the scanner and in _data, so that
+   several threads can parse at the same time. */
+void KTraderParse_mainParse( const char *_code, void *_data )
 {
     yyscan_t scanner;
-    kiotraderlex_init(&scanner);
+    if (kiotraderlex_init(&scanner) != 0) {
+        return;
+    }
     KTraderParse_initFlex(_code, scanner);
-    kiotraderparse(scanner);
+    kiotraderparse(scanner, _data);
     kiotraderlex_destroy(scanner);
 }
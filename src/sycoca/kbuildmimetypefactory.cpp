@@ -18,6 +18,7 @@
  */
 
 #include "kbuildmimetypefactory_p.h"
+#include "kmimeancestry_p.h"
 #include "ksycoca.h"
 #include "ksycocadict_p.h"
 #include "ksycocaresourcelist_p.h"
@@ -25,10 +26,13 @@
 #include <assert.h>
 #include <QDebug>
 #include <QHash>
+#include <QMap>
+#include <QMimeDatabase>
 #include <qstandardpaths.h>
 
 KBuildMimeTypeFactory::KBuildMimeTypeFactory(KSycoca *db)
-    : KMimeTypeFactory(db)
+    : KMimeTypeFactory(db),
+      m_ancestry(nullptr)
 {
     m_resourceList = new KSycocaResourceList;
     // We want all xml files under xdgdata/mime - but not mime/packages/*.xml
@@ -38,6 +42,7 @@ KBuildMimeTypeFactory::KBuildMimeTypeFactory(KSycoca *db)
 KBuildMimeTypeFactory::~KBuildMimeTypeFactory()
 {
     delete m_resourceList;
+    delete m_ancestry;
 }
 
 KSycocaEntry::List KBuildMimeTypeFactory::allEntries() const
@@ -75,6 +80,8 @@ KSycocaEntry *KBuildMimeTypeFactory::createEntry(const QString &file) const
 void KBuildMimeTypeFactory::saveHeader(QDataStream &str)
 {
     KSycocaFactory::saveHeader(str);
+
+    str << qint32(m_aliasTableOffset);
 }
 
 void KBuildMimeTypeFactory::save(QDataStream &str)
@@ -83,6 +90,8 @@ void KBuildMimeTypeFactory::save(QDataStream &str)
 
     str << qint32(0);
 
+    saveAliasTable(str);
+
     const qint64 endOfFactoryData = str.device()->pos();
 
     // Update header (pass #3)
@@ -92,6 +101,39 @@ void KBuildMimeTypeFactory::save(QDataStream &str)
     str.device()->seek(endOfFactoryData);
 }
 
+void KBuildMimeTypeFactory::saveAliasTable(QDataStream &str)
+{
+    // Every entry under its own (already lowercase) name, plus all the aliases
+    // known to QMimeDatabase, so that the traders need neither QMimeDatabase
+    // nor a second lookup of the entry. A QMap, for a deterministic output.
+    QMap<QString, MimeTypeEntry *> table;
+    for (KSycocaEntryDict::const_iterator it = m_entryDict->constBegin(); it != m_entryDict->constEnd(); ++it) {
+        MimeTypeEntry *entry = static_cast<MimeTypeEntry *>((*it).data());
+        table.insert(entry->name(), entry);
+    }
+    QMimeDatabase db;
+    const QList<QMimeType> mimeTypes = db.allMimeTypes();
+    for (const QMimeType &mime : mimeTypes) {
+        MimeTypeEntry *entry = table.value(mime.name().toLower());
+        if (!entry) {
+            continue;
+        }
+        const QStringList aliases = mime.aliases();
+        for (const QString &alias : aliases) {
+            const QString key = alias.toLower();
+            if (!table.contains(key)) { // a real mimetype wins over an alias
+                table.insert(key, entry);
+            }
+        }
+    }
+
+    m_aliasTableOffset = str.device()->pos();
+    str << qint32(table.count());
+    for (QMap<QString, MimeTypeEntry *>::const_iterator it = table.constBegin(); it != table.constEnd(); ++it) {
+        str << it.key() << qint32(it.value()->offset()) << qint32(it.value()->serviceOffersOffset());
+    }
+}
+
 KMimeTypeFactory::MimeTypeEntry::Ptr KBuildMimeTypeFactory::createFakeMimeType(const QString &name)
 {
     const QString file = name; // hack
@@ -105,3 +147,11 @@ KMimeTypeFactory::MimeTypeEntry::Ptr KBuildMimeTypeFactory::createFakeMimeType(c
     addEntry(entry);
     return KMimeTypeFactory::MimeTypeEntry::Ptr(static_cast<MimeTypeEntry *>(entry.data()));
 }
+
+const KMimeAncestry &KBuildMimeTypeFactory::ancestry()
+{
+    if (!m_ancestry) {
+        m_ancestry = new KMimeAncestry;
+    }
+    return *m_ancestry;
+}
@@ -23,6 +23,8 @@
 #include <kmimetypefactory_p.h>
 #include <QStringList>
 
+class KMimeAncestry;
+
 /**
  * Mime-type factory for building ksycoca
  * @internal
@@ -52,6 +54,12 @@ public:
 
     KMimeTypeFactory::MimeTypeEntry::Ptr createFakeMimeType(const QString &name);
 
+    /**
+     * The inheritance graph of the mimetypes, computed on first use
+     * and then shared by everything in this build.
+     */
+    const KMimeAncestry &ancestry();
+
     /**
      * Write out mime type specific index files.
      */
@@ -64,6 +72,14 @@ public:
      * this function.
      */
     void saveHeader(QDataStream &str) override;
+
+private:
+    /**
+     * Write out the table of canonical names and aliases, see findMimeTypeOffsets()
+     */
+    void saveAliasTable(QDataStream &str);
+
+    KMimeAncestry *m_ancestry;
 };
 
 #endif
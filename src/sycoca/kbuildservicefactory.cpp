@@ -20,18 +20,26 @@
 #include "kbuildservicefactory_p.h"
 #include "kbuildservicegroupfactory_p.h"
 #include "kbuildmimetypefactory_p.h"
+#include "kmimeancestry_p.h"
 #include "kservicetypefactory_p.h"
 #include "ksycoca.h"
 #include "ksycocadict_p.h"
+#include "ksycocaprofiler_p.h"
 #include "ksycocaresourcelist_p.h"
+#include "ksycocautils_p.h"
 #include "kdesktopfile.h"
 #include "kservicetype.h"
+#include "kservice_p.h"
+#include "kservicetypeprofile_p.h"
 #include "sycocadebug.h"
 
 #include <QDebug>
 #include <QDir>
 #include <qmimedatabase.h>
+#include <kconfiggroup.h>
+#include <ksharedconfig.h>
 
+#include <algorithm>
 #include <assert.h>
 #include <kmimetypefactory_p.h>
 #include <qstandardpaths.h>
@@ -56,6 +64,27 @@ KBuildServiceFactory::KBuildServiceFactory(KServiceTypeFactory *serviceTypeFacto
     m_nameDict = new KSycocaDict();
     m_relNameDict = new KSycocaDict();
     m_menuIdDict = new KSycocaDict();
+
+    // The properties commonly used in trader constraints, which get an index
+    // so that "exist", "==" and "in" can be answered without decoding the services.
+    const QStringList defaultIndexedProperties = {
+        QStringLiteral("X-DBUS-ServiceName"),
+        QStringLiteral("Library"),
+        QStringLiteral("X-KDE-PluginInfo-Name"),
+        QStringLiteral("X-KDE-ParentApp")
+    };
+    KConfigGroup config(KSharedConfig::openConfig(), "KSycoca");
+    m_indexedProperties = config.readEntry("IndexedProperties", defaultIndexedProperties);
+    m_indexedProperties.removeDuplicates();
+
+    // The generic service types commonly used in mimetype trader queries, for which
+    // the offers of each mimetype are filtered in advance, see savePrefilteredOffers.
+    const QStringList defaultPrefilteredServiceTypes = {
+        QStringLiteral("Application"),
+        QStringLiteral("KParts/ReadOnlyPart")
+    };
+    m_prefilteredServiceTypes = config.readEntry("PrefilteredServiceTypes", defaultPrefilteredServiceTypes);
+    m_prefilteredServiceTypes.removeDuplicates();
 }
 
 KBuildServiceFactory::~KBuildServiceFactory()
@@ -118,6 +147,11 @@ KSycocaEntry *KBuildServiceFactory::createEntry(const QString &file) const
     return nullptr;
 }
 
+void KBuildServiceFactory::setPreviousVisibilityNames(const QStringList &names)
+{
+    m_previousVisibilityNames = names;
+}
+
 void KBuildServiceFactory::saveHeader(QDataStream &str)
 {
     KSycocaFactory::saveHeader(str);
@@ -126,10 +160,31 @@ void KBuildServiceFactory::saveHeader(QDataStream &str)
     str << qint32(m_relNameDictOffset);
     str << qint32(m_offerListOffset);
     str << qint32(m_menuIdDictOffset);
+    str << qint32(m_propertyIndexOffset);
+    str << qint32(m_prefilteredOffersOffset);
+    str << qint32(m_visibilityNamesOffset);
+    str << qint32(m_profiledOffersOffset);
 }
 
 void KBuildServiceFactory::save(QDataStream &str)
 {
+    // Precompute the OnlyShowIn/NotShowIn/platform masks, which are saved with the services.
+    // Starting from the previous names keeps the masks of the unchanged services as they were.
+    m_visibilityNames = m_previousVisibilityNames;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const KSycocaEntry::Ptr &entry : qAsConst(*m_entryDict)) {
+            if (entry->isType(KST_KService)) {
+                static_cast<KServicePrivate *>(entry->d_ptr)->computeVisibility(m_visibilityNames);
+            }
+        }
+        // Names nobody uses anymore may have taken the place of new ones: start over without them
+        if (m_visibilityNames.count() < KServiceVisibilityNames::MaxNames || m_previousVisibilityNames.isEmpty()) {
+            break;
+        }
+        m_visibilityNames.clear();
+        m_previousVisibilityNames.clear();
+    }
+
     KSycocaFactory::save(str);
 
     m_nameDictOffset = str.device()->pos();
@@ -143,6 +198,15 @@ void KBuildServiceFactory::save(QDataStream &str)
     m_menuIdDictOffset = str.device()->pos();
     m_menuIdDict->save(str);
 
+    savePropertyIndexes(str);
+
+    savePrefilteredOffers(str);
+
+    m_visibilityNamesOffset = str.device()->pos();
+    str << m_visibilityNames;
+
+    saveProfiledOffers(str);
+
     qint64 endOfFactoryData = str.device()->pos();
 
     // Update header (pass #3)
@@ -152,49 +216,74 @@ void KBuildServiceFactory::save(QDataStream &str)
     str.device()->seek(endOfFactoryData);
 }
 
-void KBuildServiceFactory::collectInheritedServices()
+namespace
 {
-    // For each mimetype, go up the parent-mimetype chains and collect offers.
-    // For "removed associations" to work, we can't just grab everything from all parents.
-    // We need to process parents before children, hence the recursive call in
-    // collectInheritedServices(mime) and the QSet to process a given parent only once.
-    QSet<QString> visitedMimes;
-    Q_FOREACH (const QString &mimeType, m_mimeTypeFactory->allMimeTypes()) {
-        collectInheritedServices(mimeType, visitedMimes);
-    }
-}
-
-void KBuildServiceFactory::collectInheritedServices(const QString &mimeTypeName, QSet<QString> &visitedMimes)
+// Collects the offers mimeTypeName inherits from its parents.
+// Only reads offerHash, so it can be called from several threads.
+void collectInheritedOffers(const KOfferHash &offerHash, const KMimeAncestry &ancestry,
+                            const QString &mimeTypeName, QList<KServiceOffer> &result)
 {
-    if (visitedMimes.contains(mimeTypeName)) {
-        return;
-    }
-    visitedMimes.insert(mimeTypeName);
-
     // With multiple inheritance, the "mimeTypeInheritanceLevel" isn't exactly
     // correct (it should only be increased when going up a level, not when iterating
     // through the multiple parents at a given level). I don't think we care, though.
     int mimeTypeInheritanceLevel = 0;
 
-    QMimeDatabase db;
-    QMimeType qmime = db.mimeTypeForName(mimeTypeName);
-    Q_FOREACH (QString parentMimeType, qmime.parentMimeTypes()) {
+    const QStringList parents = ancestry.parents(mimeTypeName);
+    for (const QString &parentMimeType : parents) {
+        ++mimeTypeInheritanceLevel;
+        const QList<KServiceOffer> offers = offerHash.offersFor(parentMimeType);
+        for (const KServiceOffer &parentOffer : offers) {
+            if (!offerHash.hasRemovedOffer(mimeTypeName, parentOffer.service())) {
+                KServiceOffer offer(parentOffer);
+                offer.setMimeTypeInheritanceLevel(mimeTypeInheritanceLevel);
+                result.append(offer);
+            }
+        }
+    }
+}
+}
+
+static const int s_parallelThreshold = 256; // see KSycocaUtilsPrivate::chunkCount
 
-        // Workaround issue in shared-mime-info and/or Qt, which sometimes return an alias as parent
-        parentMimeType = db.mimeTypeForName(parentMimeType).name();
+void KBuildServiceFactory::collectInheritedServices()
+{
+    // For each mimetype, go up the parent-mimetype chains and collect offers.
+    // For "removed associations" to work, we can't just grab everything from all parents:
+    // the parents must have all their offers before their children look at them.
+    // So the mimetypes are processed by depth in the inheritance graph; the ones
+    // at a given depth only read the offers of lower ones, so they are independent.
+    const KMimeAncestry &ancestry = m_mimeTypeFactory->ancestry();
+    QVector<QStringList> levels;
+    QSet<QString> seen;
+    const QStringList mimeTypes = ancestry.mimeTypes() + m_mimeTypeFactory->allMimeTypes();
+    for (const QString &mimeType : mimeTypes) {
+        const int depth = ancestry.depth(mimeType);
+        if (depth == 0 || seen.contains(mimeType)) { // no parents, nothing to inherit
+            continue;
+        }
+        seen.insert(mimeType);
+        if (levels.count() <= depth) {
+            levels.resize(depth + 1);
+        }
+        levels[depth].append(mimeType);
+    }
 
-        collectInheritedServices(parentMimeType, visitedMimes);
+    for (const QStringList &level : qAsConst(levels)) {
+        const int count = level.count();
+        QVector<QList<KServiceOffer>> inherited(count);
+        QList<KServiceOffer> *results = inherited.data();
+        // The offers get added by this thread once all the chunks are done
+        KSycocaUtilsPrivate::parallelForChunks(count, s_parallelThreshold, [this, &ancestry, &level, results](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                collectInheritedOffers(m_offerHash, ancestry, level.at(i), results[i]);
+            }
+        });
 
-        ++mimeTypeInheritanceLevel;
-        const QList<KServiceOffer> &offers = m_offerHash.offersFor(parentMimeType);
-        QList<KServiceOffer>::const_iterator itserv = offers.begin();
-        const QList<KServiceOffer>::const_iterator endserv = offers.end();
-        for (; itserv != endserv; ++itserv) {
-            if (!m_offerHash.hasRemovedOffer(mimeTypeName, (*itserv).service())) {
-                KServiceOffer offer(*itserv);
-                offer.setMimeTypeInheritanceLevel(mimeTypeInheritanceLevel);
-                //qCDebug(SYCOCA) << "INHERITANCE: Adding service" << (*itserv).service()->entryPath() << "to" << mimeTypeName << "mimeTypeInheritanceLevel=" << mimeTypeInheritanceLevel;
-                m_offerHash.addServiceOffer(mimeTypeName, offer);
+        // Sequentially and in a fixed order, so that the result does not depend on the threads
+        for (int i = 0; i < count; ++i) {
+            for (const KServiceOffer &offer : inherited.at(i)) {
+                //qCDebug(SYCOCA) << "INHERITANCE: Adding service" << offer.service()->entryPath() << "to" << level.at(i) << "mimeTypeInheritanceLevel=" << offer.mimeTypeInheritanceLevel();
+                m_offerHash.addServiceOffer(level.at(i), offer);
             }
         }
     }
@@ -259,6 +348,7 @@ void KBuildServiceFactory::postProcessServices()
 void KBuildServiceFactory::populateServiceTypes()
 {
     QMimeDatabase db;
+    const KMimeAncestry &ancestry = m_mimeTypeFactory->ancestry();
     // For every service...
     KSycocaEntryDict::const_iterator itserv = m_entryDict->constBegin();
     const KSycocaEntryDict::const_iterator endserv = m_entryDict->constEnd();
@@ -301,7 +391,7 @@ void KBuildServiceFactory::populateServiceTypes()
                     bool shouldAdd = true;
                     foreach (const QString &otherType, service->serviceTypes()) {
                         // Skip derived types if the base class is listed (#321706)
-                        if (stName != otherType && mime.inherits(otherType)) {
+                        if (stName != otherType && ancestry.inherits(mime.name(), otherType)) {
                             // But don't skip aliases (they got resolved into mime->name() already, but don't let two aliases cancel out)
                             if (db.mimeTypeForName(otherType).name() != mime.name()) {
                                 //qCDebug(SYCOCA) << "Skipping" << mime->name() << "because of" << otherType << "(canonical" << KMimeTypeRepository::self()->canonicalName(otherType) << ") while parsing" << service->entryPath();
@@ -331,12 +421,10 @@ void KBuildServiceFactory::populateServiceTypes()
     const int offerEntrySize = sizeof(qint32) * 4;   // four qint32s, see saveOfferList.
 
     const auto &offerHash = m_offerHash.serviceTypeData();
-    auto it = offerHash.constBegin();
-    const auto end = offerHash.constEnd();
-    for ( ; it != end ; ++it ) {
-        const QString stName = it.key();
-        const ServiceTypeOffersData offersData = it.value();
-        const int numOffers = offersData.offers.count();
+    QStringList stNames = offerHash.keys();
+    stNames.sort(); // for a deterministic output
+    for (const QString &stName : qAsConst(stNames)) {
+        const int numOffers = offerHash.value(stName).offerCount();
         KServiceType::Ptr serviceType = m_serviceTypeFactory->findServiceTypeByName(stName);
         if (serviceType) {
             serviceType->setServiceOffersOffset(offersOffset);
@@ -366,14 +454,14 @@ void KBuildServiceFactory::saveOfferList(QDataStream &str)
 {
     m_offerListOffset = str.device()->pos();
     //qCDebug(SYCOCA) << "Saving offer list at offset" << m_offerListOffset;
+    KSycocaProfilePhase phase("saveOfferList");
+    int offerCount = 0;
 
     const auto &offerHash = m_offerHash.serviceTypeData();
-    auto it = offerHash.constBegin();
-    const auto end = offerHash.constEnd();
-    for ( ; it != end ; ++it ) {
-        const QString stName = it.key();
-        const ServiceTypeOffersData offersData = it.value();
-        QList<KServiceOffer> offers = offersData.offers;
+    QStringList stNames = offerHash.keys();
+    stNames.sort(); // same order as in populateServiceTypes
+    for (const QString &stName : qAsConst(stNames)) {
+        QList<KServiceOffer> offers = offerHash.value(stName).offers();
         qStableSort(offers);   // by initial preference
 
         int offset = -1;
@@ -404,9 +492,72 @@ void KBuildServiceFactory::saveOfferList(QDataStream &str)
             str << qint32((*it2).mimeTypeInheritanceLevel());
             // update offerEntrySize in populateServiceTypes if you add/remove something here
         }
+        offerCount += offers.count();
     }
 
     str << qint32(0);               // End of list marker (0)
+    phase.setValue("offers", offerCount);
+    phase.setValue("bytes", str.device()->pos() - m_offerListOffset);
+}
+
+static void saveOffsets(QDataStream &str, QVector<qint32> offsets)
+{
+    std::sort(offsets.begin(), offsets.end());
+    str << qint32(offsets.count());
+    for (qint32 offset : qAsConst(offsets)) {
+        str << offset;
+    }
+}
+
+static void saveOffsetMap(QDataStream &str, const QMap<QString, QVector<qint32>> &map)
+{
+    str << qint32(map.count());
+    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+        str << it.key();
+        saveOffsets(str, it.value());
+    }
+}
+
+void KBuildServiceFactory::savePropertyIndexes(QDataStream &str)
+{
+    m_propertyIndexOffset = str.device()->pos();
+
+    // Must be called after KSycocaFactory::save, so that the services have an offset.
+    // The types are passed explicitly to property(), the property definitions of
+    // the database being built can't be looked up yet. The index only needs to list
+    // a superset of the services matching at runtime: the constraint is evaluated anyway.
+    str << qint32(m_indexedProperties.count());
+    for (const QString &property : qAsConst(m_indexedProperties)) {
+        QVector<qint32> existing;
+        QMap<QString, QVector<qint32>> values; // for "=="
+        QMap<QString, QVector<qint32>> items; // for "in"
+
+        for (const KSycocaEntry::Ptr &entry : qAsConst(*m_entryDict)) {
+            if (!entry->isType(KST_KService)) {
+                continue;
+            }
+            const KService::Ptr service(static_cast<KService*>(entry.data()));
+            const QVariant value = service->property(property, QVariant::String);
+            if (!value.isValid()) {
+                continue;
+            }
+            const qint32 offset = service->offset();
+            existing.append(offset);
+            values[value.toString()].append(offset);
+            const QStringList list = service->property(property, QVariant::StringList).toStringList();
+            for (const QString &item : list) {
+                QVector<qint32> &offsets = items[item];
+                if (offsets.isEmpty() || offsets.last() != offset) { // the same item can be listed twice
+                    offsets.append(offset);
+                }
+            }
+        }
+
+        str << property;
+        saveOffsets(str, existing);
+        saveOffsetMap(str, values);
+        saveOffsetMap(str, items);
+    }
 }
 
 void KBuildServiceFactory::addEntry(const KSycocaEntry::Ptr &newEntry)
@@ -420,3 +571,98 @@ void KBuildServiceFactory::addEntry(const KSycocaEntry::Ptr &newEntry)
     m_dupeDict.insert(newEntry);
     KSycocaFactory::addEntry(newEntry);
 }
+
+void KBuildServiceFactory::savePrefilteredOffers(QDataStream &str)
+{
+    // Must be called after KSycocaFactory::save, so that the services have an offset.
+    // For each generic service type and each mimetype, the offers of the mimetype
+    // which are also offers of the generic service type, in the same order as in
+    // the offer list, i.e. what KMimeTypeTrader::filterMimeTypeOffers would keep,
+    // apart from the desktop, which is checked at runtime using the masks.
+    const auto &offerHash = m_offerHash.serviceTypeData();
+    QStringList mimeTypes;
+    for (auto it = offerHash.constBegin(); it != offerHash.constEnd(); ++it) {
+        if (!m_serviceTypeFactory->findServiceTypeByName(it.key()) && m_mimeTypeFactory->findMimeTypeEntryByName(it.key())) {
+            mimeTypes.append(it.key());
+        }
+    }
+    mimeTypes.sort(); // for a deterministic output
+
+    QMap<QString, QVector<QPair<qint32, qint32>>> directory; // generic service type -> (mimetype offset, list position)
+    for (const QString &genericServiceType : qAsConst(m_prefilteredServiceTypes)) {
+        if (!m_serviceTypeFactory->findServiceTypeByName(genericServiceType)) {
+            continue;
+        }
+        QSet<KService *> genericServices;
+        const QList<KServiceOffer> genericOffers = m_offerHash.offersFor(genericServiceType);
+        for (const KServiceOffer &offer : genericOffers) {
+            genericServices.insert(offer.service().data());
+        }
+
+        QVector<QPair<qint32, qint32>> &lists = directory[genericServiceType];
+        for (const QString &mimeType : qAsConst(mimeTypes)) {
+            QList<KServiceOffer> offers = m_offerHash.offersFor(mimeType);
+            qStableSort(offers); // same order as saveOfferList
+            QList<KServiceOffer> filtered;
+            for (const KServiceOffer &offer : qAsConst(offers)) {
+                if (genericServices.contains(offer.service().data())) {
+                    filtered.append(offer);
+                }
+            }
+
+            lists.append(qMakePair(qint32(m_mimeTypeFactory->findMimeTypeEntryByName(mimeType)->offset()),
+                                   qint32(str.device()->pos())));
+            str << qint32(filtered.count());
+            for (const KServiceOffer &offer : qAsConst(filtered)) {
+                quint32 mask;
+                const qint32 visibility = KServiceFactory::desktopVisibility(offer.service(), mask);
+                str << qint32(offer.service()->offset()) << qint32(offer.preference())
+                    << qint32(offer.mimeTypeInheritanceLevel()) << visibility << mask;
+            }
+        }
+    }
+
+    m_prefilteredOffersOffset = str.device()->pos();
+    str << qint32(directory.count());
+    for (auto it = directory.constBegin(); it != directory.constEnd(); ++it) {
+        str << it.key() << qint32(it.value().count());
+        for (const QPair<qint32, qint32> &list : it.value()) {
+            str << list.first << list.second;
+        }
+    }
+}
+
+void KBuildServiceFactory::saveProfiledOffers(QDataStream &str)
+{
+    // Must be called after KSycocaFactory::save, so that the services have an offset.
+    // For each service type with a profile, its offers as sorted by
+    // KServiceTypeProfile::sortServiceTypeOffers, so that the trader doesn't have to.
+    // The runtime only uses them if servicetype_profilerc didn't change since.
+    QStringList fileStamps;
+    const QHash<QString, KServiceTypeProfileEntry> profiles = KServiceTypeProfile::profiles(fileStamps);
+    QStringList serviceTypes = profiles.keys();
+    serviceTypes.sort(); // for a deterministic output
+
+    QVector<QPair<QString, qint32>> directory; // service type -> list position
+    for (const QString &serviceType : qAsConst(serviceTypes)) {
+        if (!m_serviceTypeFactory->findServiceTypeByName(serviceType)) {
+            continue;
+        }
+        QList<KServiceOffer> offers = m_offerHash.offersFor(serviceType);
+        qStableSort(offers); // same order as saveOfferList, i.e. as KServiceFactory::offers
+        const KServiceOfferList sorted = KServiceTypeProfile::sortServiceTypeOffers(offers, &profiles.constFind(serviceType).value());
+
+        directory.append(qMakePair(serviceType, qint32(str.device()->pos())));
+        str << qint32(sorted.count());
+        for (const KServiceOffer &offer : sorted) {
+            str << qint32(offer.service()->offset()) << qint32(offer.preference());
+        }
+    }
+
+    m_profiledOffersOffset = str.device()->pos();
+    str << fileStamps;
+    str << qint32(directory.count());
+    for (const QPair<QString, qint32> &list : qAsConst(directory)) {
+        str << list.first << list.second;
+    }
+}
@@ -84,11 +84,19 @@ public:
 
     void postProcessServices();
 
+    /**
+     * The names of the visibility table of the previous database, reused when possible
+     * so that the masks of the unchanged services remain the same
+     */
+    void setPreviousVisibilityNames(const QStringList &names);
+
 private:
     void populateServiceTypes();
     void saveOfferList(QDataStream &str);
+    void savePropertyIndexes(QDataStream &str);
+    void savePrefilteredOffers(QDataStream &str);
+    void saveProfiledOffers(QDataStream &str);
     void collectInheritedServices();
-    void collectInheritedServices(const QString &mime, QSet<QString> &visitedMimes);
 
     QHash<QString, KService::Ptr> m_nameMemoryHash; // m_nameDict is not useable while building ksycoca
     QHash<QString, KService::Ptr> m_relNameMemoryHash; // m_relNameDict is not useable while building ksycoca
@@ -96,6 +104,10 @@ private:
     QSet<KSycocaEntry::Ptr> m_dupeDict;
 
     KOfferHash m_offerHash;
+    QStringList m_indexedProperties;
+    QStringList m_prefilteredServiceTypes;
+    QStringList m_visibilityNames; // interned by KServicePrivate::computeVisibility
+    QStringList m_previousVisibilityNames;
 
     KServiceTypeFactory *m_serviceTypeFactory;
     KBuildMimeTypeFactory *m_mimeTypeFactory;
@@ -25,7 +25,7 @@
 
 #include <QDebug>
 #include <assert.h>
-#include <QHash>
+#include <QMap>
 
 KBuildServiceGroupFactory::KBuildServiceGroupFactory(KSycoca *db)
     : KServiceGroupFactory(db)
@@ -26,7 +26,7 @@
 #include <assert.h>
 #include <kdesktopfile.h>
 #include <kconfiggroup.h>
-#include <QHash>
+#include <QMap>
 #include <qstandardpaths.h>
 
 KBuildServiceTypeFactory::KBuildServiceTypeFactory(KSycoca *db)
@@ -21,7 +21,6 @@
 #include "ksycoca_p.h"
 #include "ksycocaresourcelist_p.h"
 #include "vfolder_menu_p.h"
-#include "ksycocautils_p.h"
 #include "sycocadebug.h"
 
 #include <config-ksycoca.h>
@@ -32,16 +31,23 @@
 #include "kbuildservicefactory_p.h"
 #include "kbuildservicegroupfactory_p.h"
 #include "kctimefactory_p.h"
+#include "kmimeassociations_p.h"
+#include "kservicetypeprofile_p.h"
+#include "ksycocadirsnapshot_p.h"
+#include "ksycocadevices_p.h"
+#include "ksycocaprofiler_p.h"
+#include "ksycocaimagewriter_p.h"
+#include "ksycocautils_p.h"
+#include <QCryptographicHash>
 #include <QDataStream>
 #include <QDir>
 #include <QEventLoop>
 #include <QFile>
+#include <QFileInfo>
 #include <QLocale>
 #include <QTimer>
 #include <QDebug>
-#include <QDirIterator>
 #include <QDateTime>
-#include <qsavefile.h>
 
 #include <kmemfile_p.h>
 
@@ -76,13 +82,18 @@ KBuildSycoca::~KBuildSycoca()
     // Delete the factories while we exist, so that the virtual isBuilding() still works
     qDeleteAll(*factories());
     factories()->clear();
+    delete m_dirSnapshot;
 }
 
 KSycocaEntry::Ptr KBuildSycoca::createEntry(const QString &file, bool addToFactory)
 {
+    const PrefetchedEntry prefetched = m_prefetchedEntries.take(file);
     quint32 timeStamp = m_ctimeFactory->dict()->ctime(file, m_resource);
+    if (!timeStamp && m_associationsOnly) {
+        timeStamp = m_ctimeDict->ctime(file, m_resource);
+    }
     if (!timeStamp) {
-        timeStamp = calcResourceHash(m_resourceSubdir, file);
+        timeStamp = prefetched.timeStamp ? prefetched.timeStamp : m_dirSnapshot->resourceHash(m_resourceSubdir, file);
     }
     KSycocaEntry::Ptr entry;
     if (m_allEntries) {
@@ -117,8 +128,12 @@ KSycocaEntry::Ptr KBuildSycoca::createEntry(const QString &file, bool addToFacto
     }
     m_ctimeFactory->dict()->addCTime(file, m_resource, timeStamp);
     if (!entry) {
-        // Create a new entry
-        entry = m_currentFactory->createEntry(file);
+        // Create a new entry, unless a worker thread did it already
+        if (prefetched.parsed && prefetched.timeStamp == timeStamp) {
+            entry = prefetched.entry;
+        } else {
+            entry = m_currentFactory->createEntry(file);
+        }
     }
     if (entry && entry->isValid()) {
         if (addToFactory) {
@@ -131,6 +146,62 @@ KSycocaEntry::Ptr KBuildSycoca::createEntry(const QString &file, bool addToFacto
     return KSycocaEntry::Ptr();
 }
 
+// Parsing a file costs more than what the other parallel loops do per item
+static const int s_prefetchThreshold = 64; // see KSycocaUtilsPrivate::chunkCount
+
+bool KBuildSycoca::filesChanged(const QMap<QString, QByteArray> &resourceSubdirs) const
+{
+    QMap<QString, QByteArray> resources = resourceSubdirs;
+    resources.insert(QStringLiteral("applications"), "apps"); // VFolderMenu's
+    for (auto it = resources.constBegin(); it != resources.constEnd(); ++it) {
+        const QStringList paths = m_ctimeDict->paths(it.value());
+        for (const QString &path : paths) {
+            if (m_dirSnapshot->resourceHash(it.key(), path) != m_ctimeDict->ctime(path, it.value())) {
+                qCDebug(SYCOCA) << "modified:" << path;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void KBuildSycoca::prefetchEntries(const QStringList &files)
+{
+    if (m_associationsOnly) { // nothing changed, all the entries get reused
+        return;
+    }
+    const int count = files.count();
+    if (KSycocaUtilsPrivate::chunkCount(count, s_prefetchThreshold) == 1) { // createEntry will do it all
+        return;
+    }
+
+    QVector<PrefetchedEntry> results(count);
+    PrefetchedEntry *prefetched = results.data();
+    const KCTimeDict *oldTimestamps = m_allEntries ? m_ctimeDict : nullptr;
+    const KSycocaFactory *factory = m_currentFactory;
+    const KSycocaDirSnapshot *dirSnapshot = m_dirSnapshot;
+
+    // Only reads the old timestamps: createEntry adds the entries to the factory
+    KSycocaUtilsPrivate::parallelForChunks(count, s_prefetchThreshold,
+            [this, &files, prefetched, oldTimestamps, factory, dirSnapshot](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const QString &file = files.at(i);
+            PrefetchedEntry &result = prefetched[i];
+            result.timeStamp = dirSnapshot->resourceHash(m_resourceSubdir, file);
+            if (oldTimestamps && result.timeStamp && result.timeStamp == oldTimestamps->ctime(file, m_resource)) {
+                continue; // createEntry will reuse the old entry
+            }
+            result.entry = KSycocaEntry::Ptr(factory->createEntry(file));
+            result.parsed = true;
+        }
+    });
+
+    m_prefetchedEntries.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        m_prefetchedEntries.insert(files.at(i), results.at(i));
+    }
+}
+
 KService::Ptr KBuildSycoca::createService(const QString &path)
 {
     KSycocaEntry::Ptr entry = createEntry(path, false);
@@ -165,17 +236,6 @@ bool KBuildSycoca::build()
         entryDictList.append(entryDict);
     }
 
-    // Save the mtime of each dir, just before we list them
-    // ## should we convert to UTC to avoid surprises when summer time kicks in?
-    Q_FOREACH (const QString &dir, factoryResourceDirs()) {
-        qint64 stamp = 0;
-        KSycocaUtilsPrivate::visitResourceDirectory(dir, [&stamp] (const QFileInfo &info) {
-            stamp = qMax(stamp, info.lastModified().toMSecsSinceEpoch());
-            return true;
-        });
-        m_allResourceDirs.insert(dir, stamp);
-    }
-
     QMap<QString, QByteArray> allResourcesSubDirs; // dirs, kstandarddirs-resource-name
     // For each factory
     Q_FOREACH (KSycocaFactory* factory, *factories()) {
@@ -192,6 +252,22 @@ bool KBuildSycoca::build()
         }
     }
 
+    // List all the resource dirs, VFolderMenu's applications included, in one go.
+    // Save the mtime of each dir, just before we list them
+    // ## should we convert to UTC to avoid surprises when summer time kicks in?
+    {
+        KSycocaProfilePhase phase("scan");
+        m_dirSnapshot->scan(QStringList(allResourcesSubDirs.keys()) << QStringLiteral("applications"));
+        Q_FOREACH (const QString &dir, factoryResourceDirs()) {
+            m_allResourceDirs.insert(dir, m_dirSnapshot->dirStamp(dir));
+        }
+        phase.setValue("files", m_dirSnapshot->entryCount());
+    }
+    if (m_associationsOnly && filesChanged(allResourcesSubDirs)) {
+        qCDebug(SYCOCA) << "Some files were modified too, looking at everything";
+        m_associationsOnly = false;
+    }
+
     m_ctimeFactory = new KCTimeFactory(this); // This is a build factory too, don't delete!!
     for (QMap<QString, QByteArray>::ConstIterator it1 = allResourcesSubDirs.constBegin();
             it1 != allResourcesSubDirs.constEnd();
@@ -201,16 +277,13 @@ bool KBuildSycoca::build()
         m_resource = it1.value();
 
         QSet<QString> relFiles;
-        const QStringList dirs = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, m_resourceSubdir, QStandardPaths::LocateDirectory);
-        qCDebug(SYCOCA) << "Looking for subdir" << m_resourceSubdir << "=>" << dirs;
-        Q_FOREACH (const QString &dir, dirs) {
-            QDirIterator it(dir, QDirIterator::Subdirectories);
-            while (it.hasNext()) {
-                const QString filePath = it.next();
-                Q_ASSERT(filePath.startsWith(dir)); // due to the line below...
-                const QString relPath = filePath.mid(dir.length() + 1);
-                relFiles.insert(relPath);
-            }
+        if (m_associationsOnly) {
+            // The same files as last time
+            const QStringList paths = m_ctimeDict->paths(m_resource);
+            relFiles = paths.toSet();
+        } else {
+            qCDebug(SYCOCA) << "Looking for subdir" << m_resourceSubdir;
+            relFiles = m_dirSnapshot->relativeFiles(m_resourceSubdir);
         }
         // Now find all factories that use this resource....
         // For each factory
@@ -234,14 +307,22 @@ bool KBuildSycoca::build()
                 }
 
                 // For each file in the resource
+                QStringList files;
                 for (auto entryPath = relFiles.constBegin();
                          entryPath != relFiles.constEnd();
                         ++entryPath) {
                     // Check if file matches filter
                     if ((*entryPath).endsWith(res.extension)) {
-                        createEntry(*entryPath, true);
+                        files.append(*entryPath);
                     }
                 }
+                KSycocaProfilePhase phase("parse", m_resourceSubdir);
+                phase.setValue("files", files.count());
+                prefetchEntries(files);
+                for (const QString &file : qAsConst(files)) {
+                    createEntry(file, true);
+                }
+                m_prefetchedEntries.clear();
             }
         }
         if (m_changed || !m_allEntries) {
@@ -259,16 +340,36 @@ bool KBuildSycoca::build()
         m_currentEntryDict = serviceEntryDict;
         m_changed = false;
 
+        // Parse the applications of the default application dirs upfront,
+        // with the same paths as VFolderMenu::loadApplications will ask for.
+        QStringList applications;
+        const QStringList appFiles = m_dirSnapshot->filePaths(QStringLiteral("applications"));
+        for (const QString &file : appFiles) {
+            if (file.endsWith(QLatin1String(".desktop"))) {
+                applications.append(file);
+            }
+        }
+        {
+            KSycocaProfilePhase phase("parse", m_resourceSubdir);
+            phase.setValue("files", applications.count());
+            prefetchEntries(applications);
+        }
+
         m_vfolder = new VFolderMenu(d->m_serviceFactory, this);
         if (!m_trackId.isEmpty()) {
             m_vfolder->setTrackId(m_trackId);
         }
 
+        KSycocaProfilePhase parseMenuPhase("parseMenu");
         VFolderMenu::SubMenu *kdeMenu = m_vfolder->parseMenu(QStringLiteral(APPLICATIONS_MENU_NAME));
+        parseMenuPhase.finish();
 
+        KSycocaProfilePhase createMenuPhase("createMenu");
         KServiceGroup::Ptr entry = m_buildServiceGroupFactory->addNew(QStringLiteral("/"), kdeMenu->directoryFile, KServiceGroup::Ptr(), false);
         entry->setLayoutInfo(kdeMenu->layoutList);
         createMenu(QString(), QString(), kdeMenu);
+        m_prefetchedEntries.clear(); // the ones the menu didn't use
+        createMenuPhase.finish();
 
         // Storing the mtime *after* looking at these dirs is a tiny race condition,
         // but I'm not sure how to get the vfolder dirs upfront...
@@ -277,12 +378,7 @@ bool KBuildSycoca::build()
                 dir.chop(1); // remove trailing slash, to avoid having ~/.local/share/applications twice
             }
             if (!m_allResourceDirs.contains(dir)) {
-                qint64 stamp = 0;
-                KSycocaUtilsPrivate::visitResourceDirectory(dir, [&stamp] (const QFileInfo &info) {
-                    stamp = qMax(stamp, info.lastModified().toMSecsSinceEpoch());
-                    return true;
-                });
-                m_allResourceDirs.insert(dir, stamp);
+                m_allResourceDirs.insert(dir, m_dirSnapshot->dirStamp(dir));
             }
         }
 
@@ -321,8 +417,11 @@ void KBuildSycoca::createMenu(const QString &caption_, const QString &name_, VFo
             directoryFile = subName + QStringLiteral(".directory");
         }
         quint32 timeStamp = m_ctimeFactory->dict()->ctime(directoryFile, m_resource);
+        if (!timeStamp && m_associationsOnly) {
+            timeStamp = m_ctimeDict->ctime(directoryFile, m_resource);
+        }
         if (!timeStamp) {
-            timeStamp = calcResourceHash(m_resourceSubdir, directoryFile);
+            timeStamp = m_dirSnapshot->resourceHash(m_resourceSubdir, directoryFile);
         }
 
         KServiceGroup::Ptr entry;
@@ -355,7 +454,11 @@ void KBuildSycoca::createMenu(const QString &caption_, const QString &name_, VFo
     if (name.isEmpty()) {
         name += QLatin1Char('/');
     }
-    foreach (const KService::Ptr &p, menu->items) {
+    // Sorted, for a deterministic output
+    QStringList itemIds = menu->items.keys();
+    itemIds.sort();
+    for (const QString &itemId : qAsConst(itemIds)) {
+        const KService::Ptr p = menu->items.value(itemId);
         if (m_menuTest) {
             if (!menu->isDeleted && !p->noDisplay())
                 printf("%s\t%s\t%s\n", qPrintable(caption), qPrintable(p->menuId()),
@@ -368,13 +471,16 @@ void KBuildSycoca::createMenu(const QString &caption_, const QString &name_, VFo
 
 bool KBuildSycoca::recreate(bool incremental)
 {
+    KSycocaProfiler profiler(m_profileFile); // written when returning
     QFileInfo fi(KSycoca::absoluteFilePath(m_globalDatabase ? KSycoca::GlobalDatabase : KSycoca::LocalDatabase));
     if (!QDir().mkpath(fi.absolutePath())) {
         qCWarning(SYCOCA) << "Couldn't create" << fi.absolutePath();
         return false;
     }
     QString path(fi.absoluteFilePath());
+    KSycocaProfilePhase recreatePhase("recreate", path);
 
+    KSycocaProfilePhase lockPhase("lock");
     QLockFile lockFile(path + QLatin1String(".lock"));
     if (!lockFile.tryLock()) {
         qCDebug(SYCOCA) <<  "Waiting for already running" << KBUILDSYCOCA_EXENAME << "to finish.";
@@ -388,15 +494,31 @@ bool KBuildSycoca::recreate(bool incremental)
         }
     }
 
+    lockPhase.finish();
+
     QByteArray qSycocaPath = QFile::encodeName(path);
     s_cSycocaPath = qSycocaPath.data();
 
     m_allEntries = nullptr;
     m_ctimeDict = nullptr;
+    m_associationsOnly = false;
+    m_databaseKept = false;
+    delete m_dirSnapshot;
+    m_dirSnapshot = new KSycocaDirSnapshot;
+    m_mimeAppsStamps = KMimeAssociations::fileStamps();
     if (incremental && checkGlobalHeader()) {
         qCDebug(SYCOCA) << "Reusing existing ksycoca";
+        // A changed mimeapps.list while no resource dir changed: a new default application
+        // was chosen, the desktop files don't need to be looked at again
+        m_associationsOnly = KSycocaPrivate::self()->readSycocaHeader().mimeAppsStamps != m_mimeAppsStamps
+                             && !m_dirSnapshot->hasChangedSince(KSycocaPrivate::self()->allResourceDirs);
+        if (m_associationsOnly) {
+            qCDebug(SYCOCA) << "Only the associations changed";
+        }
+        KSycocaProfilePhase phase("loadPrevious");
         KSycoca *oldSycoca = KSycoca::self();
         m_allEntries = new KSycocaEntryListList;
+        m_allEntriesGeneration = KSycocaPrivate::self()->m_databaseGeneration;
         m_ctimeDict = new KCTimeDict;
 
         // Must be in same order as in KBuildSycoca::recreate()!
@@ -407,24 +529,14 @@ bool KBuildSycoca::recreate(bool incremental)
 
         KCTimeFactory *ctimeInfo = new KCTimeFactory(oldSycoca);
         *m_ctimeDict = ctimeInfo->loadDict();
+        int entryCount = 0;
+        for (const KSycocaEntry::List &entries : qAsConst(*m_allEntries)) {
+            entryCount += entries.count();
+        }
+        phase.setValue("entries", entryCount);
     }
     s_cSycocaPath = nullptr;
 
-    QSaveFile database(path);
-    bool openedOK = database.open(QIODevice::WriteOnly);
-
-    if (!openedOK && database.error() == QFile::WriteError && QFile::exists(path)) {
-        QFile::remove(path);
-        openedOK = database.open(QIODevice::WriteOnly);
-    }
-    if (!openedOK) {
-        qCWarning(SYCOCA) << "ERROR creating database" << path << ":" << database.errorString();
-        return false;
-    }
-
-    QDataStream *str = new QDataStream(&database);
-    str->setVersion(QDataStream::Qt_5_3);
-
     m_newTimestamp = QDateTime::currentMSecsSinceEpoch();
     qCDebug(SYCOCA).nospace() << "Recreating ksycoca file (" << path << ", version " << KSycoca::version() << ")";
 
@@ -435,30 +547,19 @@ bool KBuildSycoca::recreate(bool incremental)
     d->m_mimeTypeFactory = buildMimeTypeFactory;
     m_buildServiceGroupFactory = new KBuildServiceGroupFactory(this);
     d->m_serviceGroupFactory = m_buildServiceGroupFactory;
-    d->m_serviceFactory = new KBuildServiceFactory(buildServiceTypeFactory, buildMimeTypeFactory, m_buildServiceGroupFactory);
+    KBuildServiceFactory *buildServiceFactory = new KBuildServiceFactory(buildServiceTypeFactory, buildMimeTypeFactory, m_buildServiceGroupFactory);
+    if (m_allEntries) {
+        buildServiceFactory->setPreviousVisibilityNames(KSycocaPrivate::self()->serviceFactory()->visibilityNames());
+    }
+    d->m_serviceFactory = buildServiceFactory;
 
     if (build()) { // Parse dirs
-        save(str); // Save database
-        if (str->status() != QDataStream::Ok) { // Probably unnecessary now in Qt5, since QSaveFile detects write errors
-            database.cancelWriting();    // Error
-        }
-        delete str;
-        str = nullptr;
-
-        //if we are currently via sudo, preserve the original owner
-        //as $HOME may also be that of another user rather than /root
-#ifdef Q_OS_UNIX
-        if (qEnvironmentVariableIsSet("SUDO_UID")) {
-            const int uid = qEnvironmentVariableIntValue("SUDO_UID");
-            const int gid = qEnvironmentVariableIntValue("SUDO_GID");
-            if (uid && gid) {
-                fchown(database.handle(), uid, gid);
-            }
+        // Calculate per-servicetype/mimetype data
+        {
+            KSycocaProfilePhase phase("postProcessServices");
+            buildServiceFactory->postProcessServices();
         }
-#endif
-
-        if (!database.commit()) {
-            qCWarning(SYCOCA) << "ERROR writing database" << database.fileName() << ". Disk full?";
+        if (!commitDatabase(path)) {
             return false;
         }
 
@@ -477,9 +578,6 @@ bool KBuildSycoca::recreate(bool incremental)
             }
         }
     } else {
-        delete str;
-        str = nullptr;
-        database.cancelWriting();
         if (m_menuTest) {
             return true;
         }
@@ -493,7 +591,7 @@ bool KBuildSycoca::recreate(bool incremental)
         QDir().remove(appsDir);
         // was doing the same with servicetypes, but I don't think any of these gets created-by-mistake anymore.
     }
-    if (d->m_sycocaStrategy == KSycocaPrivate::StrategyMemFile) {
+    if (d->m_sycocaStrategy == KSycocaPrivate::StrategyMemFile && !m_databaseKept) {
         KMemFile::fileContentsChanged(path);
     }
 
@@ -504,26 +602,266 @@ bool KBuildSycoca::recreate(bool incremental)
     return true;
 }
 
-void KBuildSycoca::save(QDataStream *str)
+// For the profile
+static QString factoryName(KSycocaFactoryId id)
+{
+    switch (id) {
+    case KST_KServiceFactory:
+        return QStringLiteral("services");
+    case KST_KServiceTypeFactory:
+        return QStringLiteral("servicetypes");
+    case KST_KServiceGroupFactory:
+        return QStringLiteral("servicegroups");
+    case KST_KMimeTypeFactory:
+        return QStringLiteral("mimetypes");
+    case KST_CTimeInfo:
+        return QStringLiteral("timestamps");
+    }
+    return QString::number(id);
+}
+
+// Writes the new database in one of three ways: not at all but for the timestamps
+// if nothing else changed, as a segment appended to the existing file if it's
+// a small change, or as a full image replacing the existing file.
+bool KBuildSycoca::commitDatabase(const QString &path)
+{
+    KSycocaTrailer previous;
+    if (canAppendSegment(path, previous)) {
+        QVector<QVector<QPair<int, qint32>>> entryLocations;
+        Q_FOREACH (KSycocaFactory *factory, *factories()) {
+            entryLocations.append(factory->entryLocations());
+        }
+        // Only what changed gets encoded, so there's no full image to compare
+        if (contentUnchanged()) {
+            qCDebug(SYCOCA) << "Database content unchanged, only updating its timestamps";
+            return refreshTimestamps(path, previous);
+        }
+        if (appendSegment(path, previous)) {
+            return true;
+        }
+        // Back to where they are in the existing file, which the full image copies them from
+        int i = 0;
+        Q_FOREACH (KSycocaFactory *factory, *factories()) {
+            factory->setEntryLocations(entryLocations.at(i++));
+        }
+    }
+
+    // The same content gives the same bytes, whatever the file looks like now,
+    // so the digest of the full image tells whether anything changed
+    KSycocaImageWriter image(0, QFileInfo(path).size());
+    if (!saveImage(image, false)) {
+        qCWarning(SYCOCA) << "ERROR creating database" << path;
+        return false;
+    }
+    const QByteArray digest = contentDigest(image);
+
+    KSycocaTrailer current;
+    QFile currentFile(path);
+    if (currentFile.open(QIODevice::ReadOnly) && current.read(&currentFile) && current.digest == digest) {
+        currentFile.close();
+        qCDebug(SYCOCA) << "Database content unchanged, only updating its timestamps";
+        return refreshTimestamps(path, current);
+    }
+    currentFile.close();
+    return saveDatabase(path, image, digest);
+}
+
+// What the content of the database depends on, compared with what the existing one,
+// which the entries were read from, was made of
+bool KBuildSycoca::contentUnchanged()
+{
+    // Files added, modified or removed
+    if (!m_changedResources.isEmpty()) {
+        return false;
+    }
+    // The other inputs of the offer lists and of the header
+    KSycocaPrivate *previous = KSycocaPrivate::self();
+    if (previous->readSycocaHeader().mimeAppsStamps != m_mimeAppsStamps
+            || previous->allResourceDirs.keys() != m_allResourceDirs.keys()
+            || previous->serviceFactory()->profileStamps() != KServiceTypeProfile::fileStamps()) {
+        return false;
+    }
+    // The menus also come from the .menu files, which aren't in the timestamp dict
+    KSycocaAbstractDevice *device = previous->device();
+    return device && m_buildServiceGroupFactory->entriesUnchanged(device->device());
+}
+
+bool KBuildSycoca::saveImage(KSycocaImageWriter &image, bool appending)
+{
+    QDataStream str(&image);
+    str.setVersion(QDataStream::Qt_5_3);
+    m_appending = appending;
+    save(&str);
+    m_appending = false;
+    return str.status() == QDataStream::Ok;
+}
+
+QByteArray KBuildSycoca::contentDigest(const KSycocaImageWriter &image, const QByteArray &previousDigest) const
+{
+    const QByteArray &data = image.imageData();
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(previousDigest);
+    qint64 pos = 0;
+    for (const QPair<qint64, qint64> &range : m_timestampRanges) {
+        hash.addData(data.constData() + pos, int(range.first - pos));
+        pos = range.second;
+    }
+    hash.addData(data.constData() + pos, int(data.size() - pos));
+    return hash.result();
+}
+
+bool KBuildSycoca::refreshTimestamps(const QString &path, const KSycocaTrailer &current)
+{
+    // The database stays as it is: the applications using it don't need to reload anything
+    m_databaseKept = true;
+    KSycocaStamps stamps;
+    stamps.headerOffset = current.headerOffset;
+    stamps.digest = current.digest;
+    stamps.timeStamp = m_newTimestamp;
+    stamps.resourceDirs = m_allResourceDirs;
+
+    KSycocaImageWriter image;
+    QDataStream str(&image);
+    str.setVersion(QDataStream::Qt_5_3);
+    stamps.write(str);
+    if (str.status() != QDataStream::Ok) {
+        qCWarning(SYCOCA) << "ERROR updating the timestamps of" << path;
+        return false;
+    }
+
+    KSycocaProfilePhase phase("commit");
+    phase.setValue("bytes", image.size());
+    return replaceDatabase(KSycocaStamps::filePath(path), image);
+}
+
+// Writes a full image, which replaces the existing file
+bool KBuildSycoca::saveDatabase(const QString &path, KSycocaImageWriter &image, const QByteArray &digest)
+{
+    QDataStream str(&image);
+    str.setVersion(QDataStream::Qt_5_3);
+    KSycocaTrailer trailer;
+    const qint64 trailerPos = image.pos();
+    trailer.baseSize = trailerPos + KSycocaTrailer::Size;
+    trailer.digest = digest;
+    trailer.write(str);
+    image.seek(KSycocaTrailer::PointerPos);
+    str << qint32(trailerPos);
+    if (str.status() != QDataStream::Ok) {
+        qCWarning(SYCOCA) << "ERROR creating database" << path;
+        return false;
+    }
+
+    KSycocaProfilePhase phase("commit");
+    phase.setValue("bytes", image.size());
+    if (!replaceDatabase(path, image)) {
+        return false;
+    }
+    // Those of an older database, which the new one's digest may happen to match
+    QFile::remove(KSycocaStamps::filePath(path));
+    return true;
+}
+
+bool KBuildSycoca::replaceDatabase(const QString &path, KSycocaImageWriter &image)
+{
+    if (!image.replaceFile(path, m_syncPolicy)) {
+        return false;
+    }
+
+    //if we are currently via sudo, preserve the original owner
+    //as $HOME may also be that of another user rather than /root
+#ifdef Q_OS_UNIX
+    if (qEnvironmentVariableIsSet("SUDO_UID")) {
+        const int uid = qEnvironmentVariableIntValue("SUDO_UID");
+        const int gid = qEnvironmentVariableIntValue("SUDO_GID");
+        if (uid && gid) {
+            chown(QFile::encodeName(path).constData(), uid, gid);
+        }
+    }
+#endif
+    return true;
+}
+
+// Once the segments add up to half of the full image, or there are that many of them,
+// a full image is written again
+static const int s_maxSegments = 8;
+
+bool KBuildSycoca::canAppendSegment(const QString &path, KSycocaTrailer &trailer)
+{
+    if (!m_allEntries || d->m_sycocaStrategy == KSycocaPrivate::StrategyMemFile) {
+        return false;
+    }
+    // The unchanged entries stay where they are, so this must be the file they were
+    // read from, as it was then
+    KSycocaPrivate *previous = KSycocaPrivate::self();
+    const QFileInfo info(path);
+    if (previous->m_databaseGeneration != m_allEntriesGeneration || previous->m_databasePath != path
+            || previous->m_dbLastModified != info.lastModified()) {
+        return false;
+    }
+    KSycocaAbstractDevice *device = previous->device();
+    if (!device || device->device()->size() != info.size()) {
+        return false;
+    }
+    trailer = previous->m_trailer;
+    return trailer.baseSize > 0 // not written by an older version
+           && trailer.segmentCount < s_maxSegments
+           && info.size() - trailer.baseSize < trailer.baseSize / 2;
+}
+
+bool KBuildSycoca::appendSegment(const QString &path, const KSycocaTrailer &previous)
+{
+    QFile database(path);
+    if (!database.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        return false;
+    }
+    const qint64 oldSize = database.size();
+    KSycocaImageWriter image(oldSize);
+
+    qCDebug(SYCOCA) << "Appending segment" << previous.segmentCount + 1 << "at" << oldSize;
+    if (!saveImage(image, true)) {
+        qCWarning(SYCOCA) << "ERROR appending to database" << path;
+        return false;
+    }
+    QDataStream str(&image);
+    str.setVersion(QDataStream::Qt_5_3);
+    KSycocaTrailer trailer;
+    trailer.headerOffset = oldSize;
+    trailer.baseSize = previous.baseSize;
+    trailer.segmentCount = previous.segmentCount + 1;
+    // That of the previous content together with the segment, as encoded
+    trailer.digest = contentDigest(image, previous.digest);
+    const qint64 trailerPos = image.pos();
+    trailer.write(str);
+    KSycocaProfilePhase phase("commit");
+    phase.setValue("bytes", image.size() - oldSize);
+    if (!image.appendTo(database, m_syncPolicy)) {
+        return false;
+    }
+
+    // The readers keep using the previous header until the first one points to the new
+    // trailer, which is only done once the segment is written (and synced, by default)
+    QByteArray pointer;
+    QDataStream(&pointer, QIODevice::WriteOnly) << qint32(trailerPos);
+    if (!KSycocaImageWriter::overwrite(database, KSycocaTrailer::PointerPos, pointer, m_syncPolicy)) {
+        database.resize(oldSize);
+        return false;
+    }
+    QFile::remove(KSycocaStamps::filePath(path));
+    return true;
+}
+
+void KBuildSycoca::saveHeader(QDataStream *str)
 {
     // Write header (#pass 1)
-    str->device()->seek(0);
+    const qint64 headerOffset = str->device()->pos();
 
     (*str) << qint32(KSycoca::version());
-    //KSycocaFactory * servicetypeFactory = 0;
-    //KBuildMimeTypeFactory * mimeTypeFactory = 0;
-    KBuildServiceFactory *serviceFactory = nullptr;
+    // Set in the first header of the file, by saveDatabase() or appendSegment()
+    (*str) << qint32(KSycocaTrailer::PointerId) << qint32(0);
     Q_FOREACH (KSycocaFactory* factory, *factories()) {
         qint32 aId;
         qint32 aOffset;
         aId = factory->factoryId();
-        //if ( aId == KST_KServiceTypeFactory )
-        //   servicetypeFactory = factory;
-        //else if ( aId == KST_KMimeTypeFactory )
-        //   mimeTypeFactory = static_cast<KBuildMimeTypeFactory *>( factory );
-        if (aId == KST_KServiceFactory) {
-            serviceFactory = static_cast<KBuildServiceFactory *>(factory);
-        }
         aOffset = factory->offset(); // not set yet, so always 0
         (*str) << aId;
         (*str) << aOffset;
@@ -531,24 +869,48 @@ void KBuildSycoca::save(QDataStream *str)
     (*str) << qint32(0); // No more factories.
     // Write XDG_DATA_DIRS
     (*str) << QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation).join(QString(QLatin1Char(':')));
+    // The timestamps are left out of contentDigest(), refreshTimestamps() writes newer ones next to the database
+    m_timestampRanges.clear();
+    const qint64 timestampPos = str->device()->pos() - headerOffset;
     (*str) << m_newTimestamp;
+    m_timestampRanges.append(qMakePair(timestampPos, str->device()->pos() - headerOffset));
     (*str) << QLocale().bcp47Name();
     // This makes it possible to trigger a ksycoca update for all users (KIOSK feature)
     (*str) << calcResourceHash(QStringLiteral("kservices5"), QStringLiteral("update_ksycoca"));
     (*str) << m_allResourceDirs.keys();
+    const qint64 dirStampsPos = str->device()->pos() - headerOffset;
     for (auto it = m_allResourceDirs.constBegin(); it != m_allResourceDirs.constEnd(); ++it) {
         (*str) << it.value();
     }
+    m_timestampRanges.append(qMakePair(dirStampsPos, str->device()->pos() - headerOffset));
+    (*str) << m_mimeAppsStamps;
+}
 
-    // Calculate per-servicetype/mimetype data
-    if (serviceFactory) serviceFactory->postProcessServices();
+void KBuildSycoca::save(QDataStream *str)
+{
+    const qint64 headerOffset = str->device()->pos();
+    saveHeader(str);
+
+    // The entries which weren't modified are copied from the existing ksycoca,
+    // unless it was reopened since they were read from it
+    QIODevice *previousDatabase = nullptr;
+    if (m_allEntries && KSycocaPrivate::self()->m_databaseGeneration == m_allEntriesGeneration) {
+        KSycocaAbstractDevice *device = KSycocaPrivate::self()->device();
+        previousDatabase = device ? device->device() : nullptr;
+    }
 
     // Here so that it's the last debug message
     qCDebug(SYCOCA) << "Saving";
 
     // Write factory data....
     Q_FOREACH (KSycocaFactory* factory, *factories()) {
+        KSycocaProfilePhase phase("saveFactory", factoryName(factory->factoryId()));
+        const qint64 factoryStart = str->device()->pos();
+        factory->setPreviousDatabase(previousDatabase, m_appending);
         factory->save(*str);
+        factory->setPreviousDatabase(nullptr);
+        phase.setValue("entries", factory->entryDict() ? factory->entryDict()->count() : 0);
+        phase.setValue("bytes", str->device()->pos() - factoryStart);
         if (str->status() != QDataStream::Ok) { // ######## TODO: does this detect write errors, e.g. disk full?
             return;    // error
         }
@@ -557,9 +919,10 @@ void KBuildSycoca::save(QDataStream *str)
     qint64 endOfData = str->device()->pos();
 
     // Write header (#pass 2)
-    str->device()->seek(0);
+    str->device()->seek(headerOffset);
 
     (*str) << qint32(KSycoca::version());
+    (*str) << qint32(KSycocaTrailer::PointerId) << qint32(0);
     Q_FOREACH (KSycocaFactory* factory, *factories()) {
         qint32 aId;
         qint32 aOffset;
@@ -589,6 +952,11 @@ QStringList KBuildSycoca::factoryResourceDirs()
     return *dirs;
 }
 
+QStringList KBuildSycoca::mimeAppsFiles()
+{
+    return KMimeAssociations::mimeAppsFiles(true);
+}
+
 QStringList KBuildSycoca::existingResourceDirs()
 {
     static QStringList *dirs = nullptr;
@@ -659,3 +1027,22 @@ const char *KBuildSycoca::sycocaPath()
 {
     return s_cSycocaPath;
 }
+
+QString KBuildSycoca::daemonLockPath(const QString &databasePath)
+{
+    return databasePath + QLatin1String(".daemon");
+}
+
+bool KBuildSycoca::isDaemonRunning(const QString &databasePath)
+{
+    if (databasePath.isEmpty()) {
+        return false;
+    }
+    QLockFile lockFile(daemonLockPath(databasePath));
+    lockFile.setStaleLockTime(0); // held for as long as the daemon runs, only stale if it died
+    if (lockFile.tryLock(0)) {
+        lockFile.unlock();
+        return false;
+    }
+    return lockFile.error() == QLockFile::LockFailedError;
+}
@@ -23,12 +23,18 @@
 #include <kservice.h>
 #include <ksycoca.h>
 
+#include <QPair>
+#include <QVector>
+
 #include "vfolder_menu_p.h"
+#include "ksycocaimagewriter_p.h"
 
 class KBuildServiceGroupFactory;
 class QDataStream;
 class KCTimeFactory;
 class KCTimeDict;
+class KSycocaDirSnapshot;
+struct KSycocaTrailer;
 
 /**
  * @internal
@@ -57,6 +63,24 @@ public:
         m_menuTest = b;
     }
 
+    /**
+     * Record the time spent in each phase of recreate() into @p file,
+     * see KSycocaProfiler. "-" for stdout, empty to disable.
+     */
+    void setProfileFile(const QString &file)
+    {
+        m_profileFile = file;
+    }
+
+    /**
+     * How long writing the database waits for the disk,
+     * KSycocaImageWriter::SyncData by default.
+     */
+    void setSyncPolicy(KSycocaImageWriter::SyncPolicy policy)
+    {
+        m_syncPolicy = policy;
+    }
+
     QStringList changedResources() const
     {
         return m_changedResources;
@@ -65,6 +89,11 @@ public:
     static QStringList factoryResourceDirs();
     static QStringList existingResourceDirs();
 
+    /**
+     * The mimeapps.list files the associations are read from, existing or not
+     */
+    static QStringList mimeAppsFiles();
+
     /**
      * Returns a number that identifies the current version of the file @p filename,
      * which is located under GenericDataLocation (including local overrides).
@@ -84,6 +113,35 @@ public:
      */
     static const char *sycocaPath();
 
+    /**
+     * The lock file held by kbuildsycoca5 --daemon while it keeps
+     * the database at @p databasePath up to date
+     */
+    static QString daemonLockPath(const QString &databasePath);
+
+    /**
+     * @return true if a kbuildsycoca5 --daemon rebuilds the database at @p databasePath
+     * whenever the resource dirs change, so that the applications only have to read it
+     */
+    static bool isDaemonRunning(const QString &databasePath);
+
+    /**
+     * The longest kbuildsycoca5 --daemon waits after a change before rebuilding,
+     * in ms. A database stale for much longer is rebuilt by the applications anyway,
+     * see KSycocaPrivate::checkDirectories().
+     */
+    enum { DaemonMaxDelay = 5000 };
+
+    /**
+     * @internal
+     * A file parsed ahead of time by prefetchEntries().
+     */
+    struct PrefetchedEntry {
+        quint32 timeStamp = 0;
+        bool parsed = false; // false if unchanged since the existing ksycoca
+        KSycocaEntry::Ptr entry; // null if the file isn't valid
+    };
+
 private:
     /**
      * Add single entry to the sycoca database.
@@ -91,6 +149,21 @@ private:
      */
     KSycocaEntry::Ptr createEntry(const QString &file, bool addToFactory);
 
+    /**
+     * Compute the timestamps of @p files and parse the new or modified ones
+     * with the current factory, on the global thread pool.
+     * createEntry() then picks up the results in its usual order, so that
+     * the database is the same as when parsing one file after the other.
+     */
+    void prefetchEntries(const QStringList &files);
+
+    /**
+     * Returns true if a file known to the existing database, in one of the
+     * @p resourceSubdirs, has a different timestamp now.
+     * Editing a file in place doesn't change the mtime of its dir.
+     */
+    bool filesChanged(const QMap<QString, QByteArray> &resourceSubdirs) const;
+
     /**
      * Implementation of KBuildSycocaInterface
      * Create service and return it. The caller must add it to the servicefactory.
@@ -108,7 +181,62 @@ private:
     bool build();
 
     /**
-     * Save the ksycoca file
+     * Write the ksycoca file, unless nothing but its timestamps changed
+     */
+    bool commitDatabase(const QString &path);
+
+    /**
+     * Write @p image, the full image returned by saveImage(), as the new ksycoca file
+     */
+    bool saveDatabase(const QString &path, KSycocaImageWriter &image, const QByteArray &digest);
+
+    /**
+     * Save the database into @p image
+     */
+    bool saveImage(KSycocaImageWriter &image, bool appending);
+
+    /**
+     * @return true if the database would have the same content as the existing
+     * one, whose entries are reused, without encoding it
+     */
+    bool contentUnchanged();
+
+    /**
+     * The digest of a full image, or of a segment together with @p previousDigest,
+     * that of the content it is appended to, leaving out the timestamps
+     */
+    QByteArray contentDigest(const KSycocaImageWriter &image, const QByteArray &previousDigest = QByteArray()) const;
+
+    /**
+     * Write the new timestamps for the existing ksycoca file, whose content is the same,
+     * next to it (see KSycocaStamps), leaving the file itself untouched
+     */
+    bool refreshTimestamps(const QString &path, const KSycocaTrailer &current);
+
+    /**
+     * Write @p image as the file @p path (the ksycoca file or the one of its timestamps),
+     * according to the sync policy
+     */
+    bool replaceDatabase(const QString &path, KSycocaImageWriter &image);
+
+    /**
+     * @return true if the changes can be appended to the existing ksycoca file,
+     * with @p trailer set to its trailer
+     */
+    bool canAppendSegment(const QString &path, KSycocaTrailer &trailer);
+
+    /**
+     * Append the changes to the existing ksycoca file
+     */
+    bool appendSegment(const QString &path, const KSycocaTrailer &previous);
+
+    /**
+     * Save the global header, with the factory offsets not set yet
+     */
+    void saveHeader(QDataStream *str);
+
+    /**
+     * Save the ksycoca data, from the current position of @p str
      */
     void save(QDataStream *str);
 
@@ -129,13 +257,17 @@ private:
     QStringList m_changedResources;
     QMap<QString, qint64> m_allResourceDirs; // dir, mtime in ms since epoch
     QString m_trackId;
+    QString m_profileFile;
+    KSycocaImageWriter::SyncPolicy m_syncPolicy = KSycocaImageWriter::SyncData;
 
     QByteArray m_resource; // e.g. "services" (old resource name, now only used for the signal, see kctimefactory.cpp)
     QString m_resourceSubdir; // e.g. "kservices5" (xdgdata subdir)
 
     KSycocaEntry::List m_tempStorage;
+    QHash<QString, PrefetchedEntry> m_prefetchedEntries; // for the current factory and resource
     typedef QList<KSycocaEntry::List> KSycocaEntryListList;
     KSycocaEntryListList *m_allEntries; // entries from existing ksycoca
+    quint32 m_allEntriesGeneration = 0; // the database generation they were read from
     KBuildServiceGroupFactory *m_buildServiceGroupFactory = nullptr;
     KSycocaFactory *m_currentFactory = nullptr;
     KCTimeFactory *m_ctimeFactory = nullptr;
@@ -144,7 +276,16 @@ private:
     KBSEntryDict *m_currentEntryDict = nullptr;
     KBSEntryDict *m_serviceGroupEntryDict = nullptr;
     VFolderMenu *m_vfolder = nullptr;
+    KSycocaDirSnapshot *m_dirSnapshot = nullptr; // the resource dirs, listed once per build
     qint64 m_newTimestamp;
+    QStringList m_mimeAppsStamps; // saved in the header, to detect changes to mimeapps.list
+
+    // Only mimeapps.list changed since the existing ksycoca was built: the resource
+    // dirs are not listed again and the old timestamps of the files are trusted
+    bool m_associationsOnly = false;
+    bool m_appending = false; // save() appends to the file the entries were read from
+    bool m_databaseKept = false; // commitDatabase() only refreshed the timestamps
+    QVector<QPair<qint64, qint64>> m_timestampRanges; // written by save(), relative to the header
 
     bool m_globalDatabase;
     bool m_menuTest;
@@ -70,6 +70,20 @@ QStringList KCTimeDict::remainingResourceList() const
     return resources.toList();
 }
 
+QStringList KCTimeDict::paths(const QByteArray &resource) const
+{
+    const QString prefix = QString::fromLatin1(resource) + QLatin1Char('|');
+    QStringList paths;
+    Hash::const_iterator it = m_hash.constBegin();
+    const Hash::const_iterator end = m_hash.constEnd();
+    for (; it != end; ++it) {
+        if (it.key().startsWith(prefix)) {
+            paths.append(it.key().mid(prefix.length()));
+        }
+    }
+    return paths;
+}
+
 void KCTimeDict::load(QDataStream &str)
 {
     QString key;
@@ -85,10 +99,10 @@ void KCTimeDict::load(QDataStream &str)
 
 void KCTimeDict::save(QDataStream &str) const
 {
-    Hash::const_iterator it = m_hash.constBegin();
-    const Hash::const_iterator end = m_hash.constEnd();
-    for (; it != end; ++it) {
-        str << it.key() << it.value();
+    QStringList keys = m_hash.keys();
+    keys.sort(); // for a deterministic output
+    for (const QString &key : qAsConst(keys)) {
+        str << key << m_hash.value(key);
     }
     str << QString() << quint32(0);
 }
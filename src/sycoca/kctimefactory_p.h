@@ -37,6 +37,8 @@ public:
         return m_hash.isEmpty();
     }
     QStringList remainingResourceList() const;
+    // The paths of all the files of @p resource
+    QStringList paths(const QByteArray &resource) const;
 
     void load(QDataStream &str);
     void save(QDataStream &str) const;
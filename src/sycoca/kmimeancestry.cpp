@@ -0,0 +1,142 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include "kmimeancestry_p.h"
+
+#include <QMimeDatabase>
+
+namespace
+{
+enum VisitState { Unvisited, Visiting, Visited };
+
+struct AncestryBuilder
+{
+    const QHash<QString, int> &indexes;
+    const QVector<QStringList> &parents;
+    QVector<int> &depths;
+    QVector<QBitArray> &ancestors;
+    QStringList &sorted;
+    const QStringList &names;
+    QVector<char> state;
+
+    // Depth-first, so that the parents are sorted before their children.
+    // A cycle (broken mime data) is cut where it loops back.
+    void visit(int index)
+    {
+        state[index] = Visiting;
+        QBitArray closure(names.count());
+        closure.setBit(index);
+        int depth = 0;
+        for (const QString &parent : parents.at(index)) {
+            const int parentIndex = indexes.value(parent, -1);
+            if (parentIndex == -1) { // unknown parent, no offers to inherit but still a parent
+                depth = qMax(depth, 1);
+                continue;
+            }
+            if (state.at(parentIndex) == Unvisited) {
+                visit(parentIndex);
+            }
+            if (state.at(parentIndex) == Visiting) {
+                continue;
+            }
+            depth = qMax(depth, depths.at(parentIndex) + 1);
+            closure |= ancestors.at(parentIndex);
+        }
+        depths[index] = depth;
+        ancestors[index] = closure;
+        sorted.append(names.at(index));
+        state[index] = Visited;
+    }
+};
+}
+
+KMimeAncestry::KMimeAncestry()
+{
+    QMimeDatabase db;
+    const QList<QMimeType> allMimeTypes = db.allMimeTypes();
+    const int count = allMimeTypes.count();
+
+    QStringList names;
+    names.reserve(count);
+    for (const QMimeType &mime : allMimeTypes) {
+        m_indexes.insert(mime.name(), names.count());
+        names.append(mime.name());
+    }
+    for (int i = 0; i < count; ++i) {
+        const QStringList aliases = allMimeTypes.at(i).aliases();
+        for (const QString &alias : aliases) {
+            if (!m_indexes.contains(alias)) { // a real mimetype wins over an alias
+                m_indexes.insert(alias, i);
+            }
+        }
+    }
+
+    m_parents.resize(count);
+    for (int i = 0; i < count; ++i) {
+        const QStringList parents = allMimeTypes.at(i).parentMimeTypes();
+        QStringList &resolved = m_parents[i];
+        resolved.reserve(parents.count());
+        for (const QString &parent : parents) {
+            // Workaround issue in shared-mime-info and/or Qt, which sometimes return an alias as parent
+            const int parentIndex = m_indexes.value(parent, -1);
+            resolved.append(parentIndex == -1 ? QString() : names.at(parentIndex));
+        }
+    }
+
+    m_depths.resize(count);
+    m_ancestors.resize(count);
+    m_sorted.reserve(count);
+    AncestryBuilder builder = { m_indexes, m_parents, m_depths, m_ancestors, m_sorted, names, QVector<char>(count, Unvisited) };
+    for (int i = 0; i < count; ++i) {
+        if (builder.state.at(i) == Unvisited) {
+            builder.visit(i);
+        }
+    }
+}
+
+int KMimeAncestry::indexOf(const QString &mimeType) const
+{
+    return m_indexes.value(mimeType, -1);
+}
+
+QStringList KMimeAncestry::mimeTypes() const
+{
+    return m_sorted;
+}
+
+QStringList KMimeAncestry::parents(const QString &mimeType) const
+{
+    const int index = indexOf(mimeType);
+    return index == -1 ? QStringList() : m_parents.at(index);
+}
+
+int KMimeAncestry::depth(const QString &mimeType) const
+{
+    const int index = indexOf(mimeType);
+    return index == -1 ? 0 : m_depths.at(index);
+}
+
+bool KMimeAncestry::inherits(const QString &mimeType, const QString &ancestor) const
+{
+    const int index = indexOf(mimeType);
+    if (index == -1) {
+        return mimeType == ancestor;
+    }
+    const int ancestorIndex = indexOf(ancestor);
+    return ancestorIndex != -1 && m_ancestors.at(index).testBit(ancestorIndex);
+}
@@ -0,0 +1,73 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef KMIMEANCESTRY_P_H
+#define KMIMEANCESTRY_P_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * The inheritance graph of all the mimetypes known to QMimeDatabase,
+ * computed once per ksycoca build instead of querying QMimeDatabase
+ * for every parent of every mimetype.
+ * Read-only once constructed, so it can be used from several threads.
+ * @internal
+ */
+class KMimeAncestry
+{
+public:
+    KMimeAncestry();
+
+    /**
+     * All the (canonical) mimetypes, parents before their children
+     */
+    QStringList mimeTypes() const;
+
+    /**
+     * The direct parents of @p mimeType, with the aliases resolved,
+     * in the order of QMimeType::parentMimeTypes().
+     * A parent unknown to QMimeDatabase is an empty string.
+     */
+    QStringList parents(const QString &mimeType) const;
+
+    /**
+     * 0 for a mimetype without parents (or unknown), otherwise
+     * 1 + the depth of its deepest parent.
+     */
+    int depth(const QString &mimeType) const;
+
+    /**
+     * Same as QMimeType::inherits(): true if @p mimeType is @p ancestor,
+     * inherits from it, or @p ancestor is one of its aliases.
+     */
+    bool inherits(const QString &mimeType, const QString &ancestor) const;
+
+private:
+    int indexOf(const QString &mimeType) const;
+
+    QHash<QString, int> m_indexes; // canonical names and aliases -> index
+    QStringList m_sorted; // topologically sorted
+    QVector<QStringList> m_parents;
+    QVector<int> m_depths;
+    QVector<QBitArray> m_ancestors; // including the mimetype itself
+};
+
+#endif
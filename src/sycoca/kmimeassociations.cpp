@@ -27,6 +27,7 @@
 #include <QFile>
 #include <qstandardpaths.h>
 #include <qmimedatabase.h>
+#include "ksycocautils_p.h"
 #include "sycocadebug.h"
 
 KMimeAssociations::KMimeAssociations(KOfferHash &offerHash, KServiceFactory *serviceFactory)
@@ -49,7 +50,7 @@ text/plain=gnome-gedit.desktop;gnu-emacs.desktop;
 
 */
 
-void KMimeAssociations::parseAllMimeAppsList()
+QStringList KMimeAssociations::mimeAppsFiles(bool includeMissing)
 {
     QStringList mimeappsFileNames;
     // make the list of possible filenames from the spec ($desktop-mimeapps.list, then mimeapps.list)
@@ -66,12 +67,23 @@ void KMimeAssociations::parseAllMimeAppsList()
     foreach (const QString &dir, mimeappsDirs) {
         foreach (const QString &file, mimeappsFileNames) {
             const QString filePath = dir + QLatin1Char('/') + file;
-            if (QFile::exists(filePath)) {
+            if (includeMissing || QFile::exists(filePath)) {
                 mimeappsFiles.append(filePath);
             }
         }
     }
     //qDebug() << "FILE LIST:" << mimeappsFiles;
+    return mimeappsFiles;
+}
+
+QStringList KMimeAssociations::fileStamps()
+{
+    return KSycocaUtilsPrivate::fileStamps(mimeAppsFiles());
+}
+
+void KMimeAssociations::parseAllMimeAppsList()
+{
+    const QStringList mimeappsFiles = mimeAppsFiles();
 
     int basePreference = 1000; // start high :)
     QListIterator<QString> mimeappsIter(mimeappsFiles);
@@ -143,42 +155,75 @@ void KMimeAssociations::parseRemovedAssociations(const KConfigGroup &group, cons
     }
 }
 
-void KOfferHash::addServiceOffer(const QString &serviceType, const KServiceOffer &offer)
+QList<KServiceOffer> ServiceTypeOffersData::offers() const
+{
+    if (!m_tombstones) {
+        return m_offers;
+    }
+    QList<KServiceOffer> offers;
+    offers.reserve(offerCount());
+    for (const KServiceOffer &offer : m_offers) {
+        if (offer.service()) {
+            offers.append(offer);
+        }
+    }
+    return offers;
+}
+
+void ServiceTypeOffersData::addOffer(const KServiceOffer &offer)
 {
-    KService::Ptr service = offer.service();
-    //qDebug() << "Adding" << service->entryPath() << "to" << serviceType << offer.preference();
-    ServiceTypeOffersData &data = m_serviceTypeData[serviceType]; // find or create
-    QList<KServiceOffer> &offers = data.offers;
-    QSet<KService::Ptr> &offerSet = data.offerSet;
-    if (!offerSet.contains(service)) {
-        offers.append(offer);
-        offerSet.insert(service);
+    const KService::Ptr service = offer.service();
+    const auto it = m_offerIndexes.constFind(service);
+    if (it == m_offerIndexes.constEnd()) {
+        m_offerIndexes.insert(service, m_offers.count());
+        m_offers.append(offer);
     } else {
         //qDebug() << service->entryPath() << "already in" << serviceType;
         // This happens when mimeapps.list mentions a service (to make it preferred)
         // Update initialPreference to qMax(existing offer, new offer)
-        QMutableListIterator<KServiceOffer> sfit(data.offers);
-        while (sfit.hasNext()) {
-            if (sfit.next().service() == service) { // we can compare KService::Ptrs because they are from the memory hash
-                sfit.value().setPreference(qMax(sfit.value().preference(), offer.preference()));
-            }
-        }
+        KServiceOffer &existing = m_offers[it.value()];
+        existing.setPreference(qMax(existing.preference(), offer.preference()));
     }
 }
 
-void KOfferHash::removeServiceOffer(const QString &serviceType, const KService::Ptr &service)
+void ServiceTypeOffersData::removeOffer(const KService::Ptr &service)
 {
-    ServiceTypeOffersData &data = m_serviceTypeData[serviceType]; // find or create
-    data.removedOffers.insert(service);
-    data.offerSet.remove(service);
-    QMutableListIterator<KServiceOffer> sfit(data.offers);
-    while (sfit.hasNext()) {
-        if (sfit.next().service()->storageId() == service->storageId()) {
-            sfit.remove();
-        }
+    removedOffers.insert(service);
+    const auto it = m_offerIndexes.find(service);
+    if (it == m_offerIndexes.end()) {
+        return;
+    }
+    // Leave a tombstone, so that the indexes of the following offers stay valid
+    m_offers[it.value()] = KServiceOffer();
+    m_offerIndexes.erase(it);
+    ++m_tombstones;
+    if (m_tombstones > m_offers.count() / 2) {
+        compact();
+    }
+}
+
+void ServiceTypeOffersData::compact()
+{
+    m_offers = offers();
+    m_tombstones = 0;
+    m_offerIndexes.clear();
+    for (int i = 0; i < m_offers.count(); ++i) {
+        m_offerIndexes.insert(m_offers.at(i).service(), i);
     }
 }
 
+void KOfferHash::addServiceOffer(const QString &serviceType, const KServiceOffer &offer)
+{
+    //qDebug() << "Adding" << offer.service()->entryPath() << "to" << serviceType << offer.preference();
+    // Services can be compared by pointer because they are from the memory hash
+    m_serviceTypeData[serviceType].addOffer(offer); // find or create
+}
+
+void KOfferHash::removeServiceOffer(const QString &serviceType, const KService::Ptr &service)
+{
+    m_serviceTypeData[serviceType].removeOffer(service); // find or create
+}
+
 bool KOfferHash::hasRemovedOffer(const QString &serviceType, const KService::Ptr &service) const
 {
     QHash<QString, ServiceTypeOffersData>::const_iterator it = m_serviceTypeData.find(serviceType);
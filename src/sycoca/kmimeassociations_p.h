@@ -28,10 +28,36 @@
 class KConfigGroup;
 class KServiceFactory;
 
-struct ServiceTypeOffersData {
-    QList<KServiceOffer> offers; // service + initial preference + allow as default
-    QSet<KService::Ptr> offerSet; // for quick contains() check
+class ServiceTypeOffersData
+{
+public:
+    /**
+     * @return the offers (service + initial preference + allow as default),
+     * in the order they were added, without the removed ones
+     */
+    QList<KServiceOffer> offers() const;
+
+    int offerCount() const
+    {
+        return m_offers.count() - m_tombstones;
+    }
+
+    /**
+     * Adds @p offer, or if its service is already there, raises the
+     * preference of the existing offer to the one of @p offer
+     */
+    void addOffer(const KServiceOffer &offer);
+
+    void removeOffer(const KService::Ptr &service);
+
     QSet<KService::Ptr> removedOffers; // remember removed offers explicitly
+
+private:
+    void compact();
+
+    QList<KServiceOffer> m_offers; // the removed ones are left as tombstones, with a null service
+    QHash<KService::Ptr, int> m_offerIndexes; // service -> index in m_offers
+    int m_tombstones = 0;
 };
 
 class KOfferHash
@@ -42,7 +68,7 @@ public:
     {
         QHash<QString, ServiceTypeOffersData>::const_iterator it = m_serviceTypeData.find(serviceType);
         if (it != m_serviceTypeData.end()) {
-            return (*it).offers;
+            return (*it).offers();
         }
         return QList<KServiceOffer>();
     }
@@ -70,6 +96,13 @@ public:
     // Read mimeapps.list files
     void parseAllMimeAppsList();
 
+    // The mimeapps.list files, in the order of the spec (local first).
+    // With includeMissing, also those which don't exist (yet), e.g. to watch them.
+    static QStringList mimeAppsFiles(bool includeMissing = false);
+
+    // The mimeapps.list files with a checksum of their contents, to find out whether they changed
+    static QStringList fileStamps();
+
     void parseMimeAppsList(const QString &file, int basePreference);
 
 private:
@@ -28,6 +28,7 @@
 #include "sycocadebug.h"
 
 #include <qstandardpaths.h>
+#include <QAtomicInt>
 #include <QDataStream>
 #include <QCoreApplication>
 #include <QFile>
@@ -60,7 +61,7 @@
  * However running apps should still be able to read it, so
  * only add to the data, never remove/modify.
  */
-#define KSYCOCA_VERSION 303
+#define KSYCOCA_VERSION 312
 
 #if HAVE_MADVISE || HAVE_MMAP
 #include <sys/mman.h> // This #include was checked when looking for posix_madvise
@@ -85,14 +86,35 @@ QDataStream &operator>>(QDataStream &in, KSycocaHeader &h) {
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(KSycocaPrivate::BehaviorsIfNotFound)
 
+static QBasicAtomicInt s_rebuildPolicy = Q_BASIC_ATOMIC_INITIALIZER(KSycoca::BlockingRebuild);
+
+// Rebuilds the database for KSycoca::BackgroundRebuild. The builder reads the
+// current database through the KSycoca instance of this thread, not the one of
+// the thread which keeps using it meanwhile.
+class KSycocaRebuildThread : public QThread
+{
+public:
+    bool success = false;
+
+protected:
+    void run() override
+    {
+        KBuildSycoca builder;
+        success = builder.recreate();
+    }
+};
+
 KSycocaPrivate::KSycocaPrivate(KSycoca *q)
     : databaseStatus(DatabaseNotOpen),
       readError(false),
       timeStamp(0),
       m_databasePath(),
       updateSig(0),
+      m_databaseGeneration(0),
       m_haveListeners(false),
       m_globalDatabase(false),
+      m_rebuildThread(nullptr),
+      m_rebuildCount(0),
       q(q),
       sycoca_size(0),
       sycoca_mmap(nullptr),
@@ -140,6 +162,10 @@ bool KSycocaPrivate::tryMmap()
         return false;
     }
     fcntl(m_mmapFile->handle(), F_SETFD, FD_CLOEXEC);
+    // Before the size: the segment of the trailer is then mapped, even if
+    // kbuildsycoca publishes another one right now
+    m_trailer = KSycocaTrailer();
+    m_trailer.read(m_mmapFile);
     sycoca_size = m_mmapFile->size();
     void *mmapRet = mmap(nullptr, sycoca_size,
                        PROT_READ, MAP_SHARED,
@@ -278,6 +304,7 @@ KSycocaAbstractDevice *KSycocaPrivate::device()
     Q_ASSERT(!m_databasePath.isEmpty());
 
     KSycocaAbstractDevice *device = m_device;
+    bool trailerRead = false;
     if (m_sycocaStrategy == StrategyDummyBuffer) {
         device = new KSycocaBufferDevice;
         device->device()->open(QIODevice::ReadOnly); // can't fail
@@ -288,6 +315,8 @@ KSycocaAbstractDevice *KSycocaPrivate::device()
                                            sycoca_size);
             if (!device->device()->open(QIODevice::ReadOnly)) {
                 delete device; device = nullptr;
+            } else {
+                trailerRead = true; // by tryMmap()
             }
         }
 #endif
@@ -309,6 +338,10 @@ KSycocaAbstractDevice *KSycocaPrivate::device()
     }
     if (device) {
         m_device = device;
+        if (!trailerRead) {
+            m_trailer = KSycocaTrailer();
+            m_trailer.read(device->device());
+        }
     }
     return m_device;
 }
@@ -398,6 +431,10 @@ KSycoca *KSycoca::self()
 
 KSycoca::~KSycoca()
 {
+    if (d->m_rebuildThread) {
+        d->m_rebuildThread->wait();
+        delete d->m_rebuildThread;
+    }
     d->closeDatabase();
     delete d;
     //if (ksycocaInstance.exists()
@@ -440,6 +477,7 @@ void KSycocaPrivate::closeDatabase()
     databaseStatus = DatabaseNotOpen;
     m_databasePath.clear();
     timeStamp = 0;
+    ++m_databaseGeneration;
 }
 
 void KSycoca::addFactory(KSycocaFactory *factory)
@@ -472,12 +510,72 @@ KSycocaFactoryList *KSycoca::factories()
     return d->factories();
 }
 
-// Warning, checkVersion rewinds to the beginning of stream().
+bool KSycocaTrailer::read(QIODevice *device)
+{
+    const qint64 size = device->size();
+    if (size < PointerPos + Size || !device->seek(PointerPos - 4)) {
+        return false;
+    }
+    QDataStream str(device);
+    qint32 pointerId, pointer;
+    str >> pointerId >> pointer;
+    if (str.status() != QDataStream::Ok || pointerId != PointerId
+            || pointer <= PointerPos || pointer > size - Size || !device->seek(pointer)) {
+        return false;
+    }
+    qint32 offset, base, count;
+    QByteArray contentDigest(DigestSize, 0);
+    quint32 magic;
+    str >> offset >> base >> count;
+    str.readRawData(contentDigest.data(), DigestSize);
+    str >> magic;
+    if (str.status() != QDataStream::Ok || magic != Magic
+            || offset < 0 || offset >= pointer || base <= 0 || base > size || count < 0) {
+        return false;
+    }
+    headerOffset = offset;
+    baseSize = base;
+    segmentCount = count;
+    digest = contentDigest == QByteArray(DigestSize, 0) ? QByteArray() : contentDigest;
+    return true;
+}
+
+void KSycocaTrailer::write(QDataStream &str) const
+{
+    str << headerOffset << baseSize << segmentCount;
+    const QByteArray contentDigest = digest.size() == DigestSize ? digest : QByteArray(DigestSize, 0);
+    str.writeRawData(contentDigest.constData(), DigestSize);
+    str << quint32(Magic);
+}
+
+bool KSycocaStamps::read(const QString &databasePath)
+{
+    QFile file(filePath(databasePath));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream str(&file);
+    str.setVersion(QDataStream::Qt_5_3);
+    qint32 version;
+    str >> version;
+    if (version != KSycoca::version()) {
+        return false;
+    }
+    str >> headerOffset >> digest >> timeStamp >> resourceDirs;
+    return str.status() == QDataStream::Ok;
+}
+
+void KSycocaStamps::write(QDataStream &str) const
+{
+    str << qint32(KSycoca::version()) << headerOffset << digest << timeStamp << resourceDirs;
+}
+
+// Warning, checkVersion rewinds stream() to the global header.
 bool KSycocaPrivate::checkVersion()
 {
     QDataStream *m_str = device()->stream();
     Q_ASSERT(m_str);
-    m_str->device()->seek(0);
+    m_str->device()->seek(m_trailer.headerOffset);
     qint32 aVersion;
     *m_str >> aVersion;
     if (aVersion < KSYCOCA_VERSION) {
@@ -593,9 +691,22 @@ KSycocaHeader KSycocaPrivate::readSycocaHeader()
         *str >> mtime;
         allResourceDirs.insert(directoryList.at(i), mtime);
     }
+    *str >> header.mimeAppsStamps;
 
     str->device()->seek(oldPos);
 
+    // Newer than those in the header if kbuildsycoca found nothing to change since
+    m_stampsLastModified = QFileInfo(KSycocaStamps::filePath(m_databasePath)).lastModified();
+    KSycocaStamps stamps;
+    if (stamps.read(m_databasePath) && stamps.appliesTo(m_trailer)) {
+        header.timeStamp = stamps.timeStamp;
+        for (auto it = stamps.resourceDirs.constBegin(); it != stamps.resourceDirs.constEnd(); ++it) {
+            if (allResourceDirs.contains(it.key())) {
+                allResourceDirs.insert(it.key(), it.value());
+            }
+        }
+    }
+
     timeStamp = header.timeStamp;
 
     // for the useless public accessors. KF6: remove these two lines, the accessors and the vars.
@@ -659,15 +770,74 @@ private:
     QDateTime m_now;
 };
 
+// How long a stale database is left to kbuildsycoca5 --daemon
+static const int s_daemonGracePeriod = KBuildSycoca::DaemonMaxDelay + 10000;
+
 void KSycocaPrivate::checkDirectories()
 {
+    if (m_rebuildThread) {
+        if (!m_rebuildThread->isFinished()) {
+            return; // keep using the current database until the new one is ready
+        }
+        // Without an event loop in this thread, QThread::finished isn't delivered
+        finishRebuild();
+    }
     if (needsRebuild()) {
+        // kbuildsycoca5 --daemon saw the same change and is publishing a new database,
+        // which ensureCacheValid() then picks up like any other update. Unless it missed
+        // the change or hangs: it rebuilds within DaemonMaxDelay, plus the time of the build.
+        if (!m_staleSince.isValid()) {
+            m_staleSince.start();
+        }
+        if (KBuildSycoca::isDaemonRunning(m_databasePath)) {
+            if (m_staleSince.elapsed() < s_daemonGracePeriod) {
+                qCDebug(SYCOCA) << "Leaving the rebuild to" << KBUILDSYCOCA_EXENAME << "--daemon";
+                return;
+            }
+            qCWarning(SYCOCA) << KBUILDSYCOCA_EXENAME << "--daemon didn't update the database in time, rebuilding it";
+        }
+        m_staleSince.invalidate();
+        if (KSycoca::rebuildPolicy() == KSycoca::BackgroundRebuild && databaseStatus == DatabaseOK) {
+            qCDebug(SYCOCA) << "Rebuilding ksycoca in the background";
+            m_rebuildThread = new KSycocaRebuildThread;
+            // The queued signal may arrive after the thread was reaped by checkDirectories()
+            const quint32 rebuild = ++m_rebuildCount;
+            QObject::connect(m_rebuildThread, &QThread::finished, q, [this, rebuild]() {
+                if (m_rebuildThread && m_rebuildCount == rebuild) {
+                    finishRebuild();
+                }
+            });
+            m_rebuildThread->start(QThread::LowPriority);
+            return;
+        }
         buildSycoca();
+    } else {
+        m_staleSince.invalidate();
+    }
+}
+
+void KSycocaPrivate::finishRebuild()
+{
+    m_rebuildThread->wait(); // QThread::finished is emitted right before the end
+    const bool success = m_rebuildThread->success;
+    delete m_rebuildThread;
+    m_rebuildThread = nullptr;
+    qCDebug(SYCOCA) << "Background rebuild of ksycoca done, success:" << success;
+
+    // Same as in ensureCacheValid(): the next query opens the new database
+    if (success && databaseStatus == DatabaseOK
+            && QFileInfo(m_databasePath).lastModified() != m_dbLastModified) {
+        closeDatabase();
     }
+    emit q->rebuildFinished(success);
 }
 
 bool KSycocaPrivate::needsRebuild()
 {
+    // kbuildsycoca refreshed the timestamps without touching the database
+    if (timeStamp && QFileInfo(KSycocaStamps::filePath(m_databasePath)).lastModified() != m_stampsLastModified) {
+        timeStamp = 0;
+    }
     if (!timeStamp && databaseStatus == DatabaseOK) {
         (void) readSycocaHeader();
     }
@@ -811,6 +981,16 @@ void KSycoca::clearCaches()
         ksycocaInstance()->sycoca()->d->closeDatabase();
 }
 
+void KSycoca::setRebuildPolicy(RebuildPolicy policy)
+{
+    s_rebuildPolicy.store(policy);
+}
+
+KSycoca::RebuildPolicy KSycoca::rebuildPolicy()
+{
+    return static_cast<RebuildPolicy>(s_rebuildPolicy.load());
+}
+
 extern KSERVICE_EXPORT int ksycoca_ms_between_checks;
 KSERVICE_EXPORT int ksycoca_ms_between_checks = 1500;
 
@@ -192,10 +192,45 @@ public:
      *
      * KBuildSycocaProgressDialog can also be used instead of this method, in GUI apps.
      *
+     * With the BackgroundRebuild policy, an out of date database is only rebuilt
+     * in the background: wait for rebuildFinished() before using it then.
+     *
      * @since 5.15
      */
     void ensureCacheValid(); // Warning for kservice code: this can delete all the factories.
 
+    /**
+     * What a query does when it finds the database out of date.
+     * @see setRebuildPolicy()
+     * @since 5.53
+     */
+    enum RebuildPolicy {
+        /**
+         * The query waits for the database to be rebuilt, then uses the new one (default).
+         */
+        BlockingRebuild,
+        /**
+         * The database is rebuilt in a separate thread, and the queries keep using
+         * the current one until rebuildFinished() is emitted. Useful in the GUI thread,
+         * where a rebuild would otherwise freeze the application for a while.
+         * Without any database to use, a query still waits for one to be built.
+         */
+        BackgroundRebuild
+    };
+
+    /**
+     * Sets how the database gets rebuilt when it's out of date, in all threads
+     * of this process. Best called once, before the first use of KSycoca.
+     * @since 5.53
+     */
+    static void setRebuildPolicy(RebuildPolicy policy);
+
+    /**
+     * @return how the database gets rebuilt when it's out of date
+     * @since 5.53
+     */
+    static RebuildPolicy rebuildPolicy();
+
 Q_SIGNALS:
     /**
      * Connect to this to get notified when the database changes.
@@ -221,6 +256,16 @@ Q_SIGNALS:
      */
     void databaseChanged(const QStringList &changedResources); // KF6: deprecate
 
+    /**
+     * Emitted when the rebuild started in the background, because of the
+     * BackgroundRebuild policy, is done. The next query uses the new database,
+     * and databaseChanged() is emitted as well if anybody is connected to it.
+     *
+     * @param success false if the database couldn't be rebuilt, the current one is kept then
+     * @since 5.53
+     */
+    void rebuildFinished(bool success);
+
 protected:
     // @internal used by kbuildsycoca
     KSycocaFactoryList *factories();
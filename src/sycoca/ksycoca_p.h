@@ -27,12 +27,14 @@
 #include <QDateTime>
 #include <kdirwatch.h>
 class QFile;
+class QIODevice;
 class QDataStream;
 class KSycocaAbstractDevice;
 class KMimeTypeFactory;
 class KServiceTypeFactory;
 class KServiceFactory;
 class KServiceGroupFactory;
+class KSycocaRebuildThread;
 
 // This is for the part of the global header that we don't need to store,
 // i.e. it's just a struct for returning temp data from readSycocaHeader().
@@ -42,10 +44,72 @@ struct KSycocaHeader {
     QString language;
     qint64 timeStamp; // in ms
     quint32 updateSignature;
+    QStringList mimeAppsStamps; // see KMimeAssociations::fileStamps
 };
 
 QDataStream &operator>>(QDataStream &in, KSycocaHeader &h);
 
+/**
+ * Points to the global header to use.
+ * A full build writes one image, starting with the global header. An incremental
+ * build may instead append a segment to the existing file: the new and modified
+ * entries, then all the indexes and a new global header, the unchanged entries
+ * staying where they are. Each image and segment ends with a trailer.
+ *
+ * The first global header of the file has the offset of the current trailer at
+ * PointerPos, right after the version, as a factory offset with the pseudo id
+ * PointerId (skipped by the readers like an unknown factory). kbuildsycoca only
+ * changes it once the segment is completely written: the readers see either the
+ * previous generation or the new one, never a partial segment.
+ */
+struct KSycocaTrailer {
+    enum { Magic = 0x4b535344, DigestSize = 16, Size = 16 + DigestSize,
+           PointerId = 0x7fff, // not the id of any KSycocaFactory
+           PointerPos = 8
+         };
+    qint32 headerOffset = 0;
+    qint32 baseSize = 0; // size of the image written by the last full build
+    qint32 segmentCount = 0; // appended since
+    QByteArray digest; // of the content, timestamps left out: see KBuildSycoca::contentDigest
+
+    /**
+     * Reads the trailer @p device points to. If there is none, i.e. an older file,
+     * the header at offset 0 is used.
+     * @return false if there is none
+     */
+    bool read(QIODevice *device);
+    void write(QDataStream &str) const;
+};
+
+/**
+ * The timestamps of the header, as refreshed by kbuildsycoca when the content of
+ * the database didn't change: they go into a small file next to it, see filePath(),
+ * and the database itself isn't touched. They only apply to the database whose
+ * trailer has the same digest and header offset.
+ */
+struct KSycocaStamps {
+    qint32 headerOffset = 0;
+    QByteArray digest;
+    qint64 timeStamp = 0; // in ms
+    QMap<QString, qint64> resourceDirs; // path, modification time in "ms since epoch"
+
+    static QString filePath(const QString &databasePath)
+    {
+        return databasePath + QLatin1String(".stamps");
+    }
+
+    /**
+     * @return false if there is no such file, or not a valid one
+     */
+    bool read(const QString &databasePath);
+    void write(QDataStream &str) const;
+
+    bool appliesTo(const KSycocaTrailer &trailer) const
+    {
+        return !digest.isEmpty() && digest == trailer.digest && headerOffset == trailer.headerOffset;
+    }
+};
+
 /**
  * \internal
  * Exported for unittests
@@ -86,6 +150,12 @@ public:
      */
     bool buildSycoca();
 
+    /**
+     * Called once the thread started for KSycoca::BackgroundRebuild is done:
+     * switches to the new database at the next query, and emits rebuildFinished()
+     */
+    void finishRebuild();
+
     KSycocaHeader readSycocaHeader();
 
     KSycocaAbstractDevice *device();
@@ -114,6 +184,8 @@ public:
     QStringList changeList;
     QString language;
     quint32 updateSig;
+    quint32 m_databaseGeneration; // bumped by closeDatabase(), see KTraderResultCache
+    KSycocaTrailer m_trailer; // of the database opened by device()
     QMap<QString, qint64> allResourceDirs; // path, modification time in "ms since epoch"
 
     void addFactory(KSycocaFactory *factory)
@@ -126,7 +198,9 @@ public:
     }
 
     QElapsedTimer m_lastCheck;
+    QElapsedTimer m_staleSince; // while kbuildsycoca5 --daemon is expected to rebuild, see checkDirectories()
     QDateTime m_dbLastModified;
+    QDateTime m_stampsLastModified; // of the KSycocaStamps file read by readSycocaHeader()
 
     // Using KDirWatch because it will reliably tell us every time ksycoca is recreated.
     // QFileSystemWatcher's inotify implementation easily gets confused between "removed" and "changed",
@@ -135,6 +209,8 @@ public:
     KDirWatch m_fileWatcher;
     bool m_haveListeners;
     bool m_globalDatabase;
+    KSycocaRebuildThread *m_rebuildThread; // see KSycoca::BackgroundRebuild
+    quint32 m_rebuildCount;
 
     KSycoca *q;
 private:
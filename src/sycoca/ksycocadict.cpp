@@ -17,6 +17,7 @@
  **/
 
 #include "ksycocadict_p.h"
+#include "ksycocaprofiler_p.h"
 #include "sycocadebug.h"
 #include <kservice.h>
 #include "ksycocaentry.h"
@@ -26,6 +27,8 @@
 #include <QDebug>
 #include <QVector>
 
+#include <algorithm>
+
 namespace
 {
 struct string_entry {
@@ -351,7 +354,16 @@ KSycocaDict::save(QDataStream &str)
         return;
     }
 
+    // The order of the duplicate lists follows the order of the keys: make it
+    // independent of the order the entries were added in
+    std::stable_sort(d->stringlist.begin(), d->stringlist.end(), [](const string_entry *a, const string_entry *b) {
+        return a->keyStr < b->keyStr;
+    });
+
     d->offset = str.device()->pos();
+    const qint64 startPos = d->offset;
+    KSycocaProfilePhase phase("dictSave");
+    phase.setValue("entries", count());
 
     //qCDebug(SYCOCA) << "KSycocaDict:" << count() << "entries.";
 
@@ -477,65 +489,87 @@ KSycocaDict::save(QDataStream &str)
         }
     }
 
+    if (KSycocaProfiler::active()) {
+        int duplicateChains = 0;
+        int longestChain = 0;
+        for (unsigned int i = 0; i < sz; i++) {
+            if (hashTable[i].duplicates) {
+                ++duplicateChains;
+                longestChain = qMax(longestChain, hashTable[i].duplicates->count());
+            }
+        }
+        phase.setValue("diversityRounds", d->hashList.count());
+        phase.setValue("tableSize", sz);
+        phase.setValue("duplicateChains", duplicateChains);
+        phase.setValue("longestChain", longestChain);
+    }
+
     str << d->hashTableSize;
     str << d->hashList;
 
     d->offset = str.device()->pos(); // d->offset points to start of hashTable
     //qCDebug(SYCOCA) << QString("Start of Hash Table, offset = %1").arg(d->offset,8,16);
 
-    // Write the hashtable + the duplicates twice.
     // The duplicates are after the normal hashtable, but the offset of each
-    // duplicate entry is written into the normal hashtable.
-    for (int pass = 1; pass <= 2; pass++) {
-        str.device()->seek(d->offset);
-        //qCDebug(SYCOCA) << QString("Writing hash table (pass #%1)").arg(pass);
-        for (uint i = 0; i < d->hashTableSize; i++) {
-            qint32 tmpid;
-            if (!hashTable[i].entry) {
-                tmpid = 0;
-            } else if (!hashTable[i].duplicates) {
-                tmpid = hashTable[i].entry->payload->offset();    // Positive ID
-            } else {
-                tmpid = - hashTable[i].duplicate_offset;    // Negative ID
-            }
-            str << tmpid;
-            //qCDebug(SYCOCA) << QString("Hash table : %1").arg(tmpid,8,16);
+    // duplicate list is written into the normal hashtable: it is left at 0
+    // at first, and fixed up once the duplicate lists are written.
+    //qCDebug(SYCOCA) << "Writing hash table";
+    for (uint i = 0; i < d->hashTableSize; i++) {
+        qint32 tmpid;
+        if (!hashTable[i].entry || hashTable[i].duplicates) {
+            tmpid = 0;
+        } else {
+            tmpid = hashTable[i].entry->payload->offset();    // Positive ID
         }
-        //qCDebug(SYCOCA) << QString("End of Hash Table, offset = %1").arg(str.device()->at(),8,16);
-
-        //qCDebug(SYCOCA) << QString("Writing duplicate lists (pass #%1)").arg(pass);
-        for (uint i = 0; i < d->hashTableSize; i++) {
-            const QList<string_entry *> *dups = hashTable[i].duplicates;
-            if (dups) {
-                hashTable[i].duplicate_offset = str.device()->pos();
-
-                /*qCDebug(SYCOCA) << QString("Duplicate lists: Offset = %1 list_size = %2")                           .arg(hashTable[i].duplicate_offset,8,16).arg(dups->count());
-                */
-                Q_FOREACH (string_entry* dup, *dups) {
-                    const qint32 offset = dup->payload->offset();
-                    if (!offset) {
-                        const QString storageId = dup->payload->storageId();
-                        qCDebug(SYCOCA) << "about to assert! dict=" << this << "storageId=" << storageId << dup->payload.data();
-                        if (dup->payload->isType(KST_KService)) {
-                            KService::Ptr service(static_cast<KService*>(dup->payload.data()));
-                            qCDebug(SYCOCA) << service->storageId() << service->entryPath();
-                        }
-                        // save() must have been called on the entry
-                        Q_ASSERT_X(offset, "KSycocaDict::save",
-                                   QByteArray("entry offset is 0, save() was not called on "
-                                              + dup->payload->storageId().toLatin1()
-                                              + " entryPath="
-                                              + dup->payload->entryPath().toLatin1()).constData()
-                                  );
+        str << tmpid;
+        //qCDebug(SYCOCA) << QString("Hash table : %1").arg(tmpid,8,16);
+    }
+    //qCDebug(SYCOCA) << QString("End of Hash Table, offset = %1").arg(str.device()->at(),8,16);
+
+    //qCDebug(SYCOCA) << "Writing duplicate lists";
+    for (uint i = 0; i < d->hashTableSize; i++) {
+        const QList<string_entry *> *dups = hashTable[i].duplicates;
+        if (dups) {
+            hashTable[i].duplicate_offset = str.device()->pos();
+
+            /*qCDebug(SYCOCA) << QString("Duplicate lists: Offset = %1 list_size = %2")                           .arg(hashTable[i].duplicate_offset,8,16).arg(dups->count());
+            */
+            Q_FOREACH (string_entry* dup, *dups) {
+                const qint32 offset = dup->payload->offset();
+                if (!offset) {
+                    const QString storageId = dup->payload->storageId();
+                    qCDebug(SYCOCA) << "about to assert! dict=" << this << "storageId=" << storageId << dup->payload.data();
+                    if (dup->payload->isType(KST_KService)) {
+                        KService::Ptr service(static_cast<KService*>(dup->payload.data()));
+                        qCDebug(SYCOCA) << service->storageId() << service->entryPath();
                     }
-                    str << offset;                       // Positive ID
-                    str << dup->keyStr;                // Key (QString)
+                    // save() must have been called on the entry
+                    Q_ASSERT_X(offset, "KSycocaDict::save",
+                               QByteArray("entry offset is 0, save() was not called on "
+                                          + dup->payload->storageId().toLatin1()
+                                          + " entryPath="
+                                          + dup->payload->entryPath().toLatin1()).constData()
+                              );
                 }
-                str << qint32(0);               // End of list marker (0)
+                str << offset;                       // Positive ID
+                str << dup->keyStr;                // Key (QString)
             }
+            str << qint32(0);               // End of list marker (0)
+        }
+    }
+    //qCDebug(SYCOCA) << QString("End of Dict, offset = %1").arg(str.device()->at(),8,16);
+
+    // Fix up the hashtable (in memory when kbuildsycoca writes the database)
+    const qint64 endOfDict = str.device()->pos();
+    for (uint i = 0; i < d->hashTableSize; i++) {
+        if (hashTable[i].duplicates) {
+            str.device()->seek(d->offset + qint64(i) * qint64(sizeof(qint32)));
+            str << qint32(- hashTable[i].duplicate_offset);    // Negative ID
         }
-        //qCDebug(SYCOCA) << QString("End of Dict, offset = %1").arg(str.device()->at(),8,16);
     }
+    str.device()->seek(endOfDict);
+
+    phase.setValue("bytes", str.device()->pos() - startPos);
 
     //qCDebug(SYCOCA) << "Cleaning up hash table.";
     for (uint i = 0; i < d->hashTableSize; i++) {
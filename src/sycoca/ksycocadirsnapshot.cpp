@@ -0,0 +1,217 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#include "ksycocadirsnapshot_p.h"
+#include "kbuildsycoca_p.h"
+#include "ksycocafactory_p.h"
+#include "ksycocautils_p.h"
+#include "sycocadebug.h"
+
+#include <QDateTime>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+namespace
+{
+// Lists one resource dir, possibly in a worker thread
+void scanTree(KSycocaDirSnapshot::Tree &tree)
+{
+    const QFileInfo rootInfo(tree.root);
+    tree.stamp = qMax(qint64(0), rootInfo.lastModified().toMSecsSinceEpoch());
+    if (!rootInfo.isDir()) {
+        return;
+    }
+    tree.canonicalRoot = rootInfo.canonicalFilePath();
+    // Same rule as KSycocaUtilsPrivate::visitResourceDirectory
+    const bool recursiveStamp = !tree.root.contains(QLatin1String("/applications"))
+                                && !tree.root.contains(QLatin1String("/kservicetypes5"));
+    // Same filters as the QDirIterator this replaces in KBuildSycoca::build
+    QDirIterator it(tree.root, QDir::AllEntries | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString filePath = it.next();
+        const QFileInfo info = it.fileInfo();
+        const QString relPath = filePath.mid(tree.root.length() + 1);
+        quint32 mtime = 0;
+        if (info.isDir()) {
+            if (recursiveStamp && !info.isSymLink() && !info.isBundle()) {
+                tree.stamp = qMax(tree.stamp, info.lastModified().toMSecsSinceEpoch());
+            }
+        } else if (info.isReadable() && info.isFile()) {
+            mtime = info.lastModified().toTime_t();
+        }
+        tree.entries.insert(relPath, mtime);
+    }
+}
+}
+
+void KSycocaDirSnapshot::scan(const QStringList &subdirs)
+{
+    const int first = m_trees.count();
+    for (const QString &subdir : subdirs) {
+        if (m_subdirs.contains(subdir)) {
+            continue;
+        }
+        m_subdirs.insert(subdir);
+        const QStringList roots = KSycocaFactory::allDirectories(subdir);
+        for (const QString &root : roots) {
+            Tree tree;
+            tree.subdir = subdir;
+            tree.root = root;
+            m_trees.append(tree);
+        }
+    }
+    const int count = m_trees.count() - first;
+    if (count == 0) {
+        return;
+    }
+
+    // One dir per chunk, as long as the pool has threads for them
+    KSycocaDirSnapshot::Tree *trees = m_trees.data() + first;
+    KSycocaUtilsPrivate::parallelForChunks(count, 2, [trees](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            scanTree(trees[i]);
+        }
+    });
+
+    QMutexLocker locker(&m_mutex);
+    for (int i = first; i < m_trees.count(); ++i) {
+        // A dir visited for the timestamp check keeps its stamp, so that the build
+        // and the check agree even if the dir changed in between
+        if (!m_dirStamps.contains(m_trees.at(i).root)) {
+            m_dirStamps.insert(m_trees.at(i).root, m_trees.at(i).stamp);
+        }
+    }
+}
+
+QSet<QString> KSycocaDirSnapshot::relativeFiles(const QString &subdir)
+{
+    scan(QStringList(subdir));
+    QSet<QString> files;
+    for (const Tree &tree : qAsConst(m_trees)) {
+        if (tree.subdir == subdir) {
+            for (auto it = tree.entries.constBegin(); it != tree.entries.constEnd(); ++it) {
+                files.insert(it.key());
+            }
+        }
+    }
+    return files;
+}
+
+QStringList KSycocaDirSnapshot::filePaths(const QString &subdir) const
+{
+    QStringList paths;
+    for (const Tree &tree : m_trees) {
+        if (tree.subdir != subdir || tree.canonicalRoot.isEmpty()) {
+            continue;
+        }
+        const QString prefix = tree.canonicalRoot + QLatin1Char('/');
+        for (auto it = tree.entries.constBegin(); it != tree.entries.constEnd(); ++it) {
+            if (it.value()) {
+                paths.append(prefix + it.key());
+            }
+        }
+    }
+    return paths;
+}
+
+quint32 KSycocaDirSnapshot::resourceHash(const QString &subdir, const QString &filename) const
+{
+    quint32 hash = 0;
+    if (QDir::isRelativePath(filename)) {
+        if (m_subdirs.contains(subdir)) {
+            for (const Tree &tree : m_trees) {
+                if (tree.subdir == subdir) {
+                    hash += tree.entries.value(filename);
+                }
+            }
+        }
+    } else {
+        for (const Tree &tree : m_trees) {
+            if (!tree.canonicalRoot.isEmpty() && filename.startsWith(tree.canonicalRoot + QLatin1Char('/'))) {
+                hash = tree.entries.value(filename.mid(tree.canonicalRoot.length() + 1));
+            } else if (filename.startsWith(tree.root + QLatin1Char('/'))) {
+                hash = tree.entries.value(filename.mid(tree.root.length() + 1));
+            }
+            if (hash) {
+                break;
+            }
+        }
+    }
+    if (hash) {
+        return hash;
+    }
+
+    // Unknown to the snapshot: let calcResourceHash look (and warn if it doesn't exist)
+    const QString key = subdir + QLatin1Char('|') + filename;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_resourceHashes.constFind(key);
+        if (it != m_resourceHashes.constEnd()) {
+            return *it;
+        }
+    }
+    hash = KBuildSycoca::calcResourceHash(subdir, filename);
+    QMutexLocker locker(&m_mutex);
+    m_resourceHashes.insert(key, hash);
+    return hash;
+}
+
+qint64 KSycocaDirSnapshot::dirStamp(const QString &dir) const
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_dirStamps.constFind(dir);
+        if (it != m_dirStamps.constEnd()) {
+            return *it;
+        }
+    }
+    // Not holding the lock while visiting: another thread may do the same meanwhile
+    qint64 stamp = 0;
+    KSycocaUtilsPrivate::visitResourceDirectory(dir, [&stamp] (const QFileInfo &info) {
+        stamp = qMax(stamp, info.lastModified().toMSecsSinceEpoch());
+        return true;
+    });
+    QMutexLocker locker(&m_mutex);
+    auto it = m_dirStamps.constFind(dir);
+    if (it != m_dirStamps.constEnd()) { // the first stamp stays, see scan()
+        return *it;
+    }
+    m_dirStamps.insert(dir, stamp);
+    return stamp;
+}
+
+bool KSycocaDirSnapshot::hasChangedSince(const QMap<QString, qint64> &dirs) const
+{
+    for (auto it = dirs.constBegin(); it != dirs.constEnd(); ++it) {
+        const qint64 stamp = dirStamp(it.key());
+        if (stamp > it.value()) {
+            qCDebug(SYCOCA) << "timestamp changed:" << it.key() << QDateTime::fromMSecsSinceEpoch(stamp) << ">" << QDateTime::fromMSecsSinceEpoch(it.value());
+            return true;
+        }
+    }
+    return false;
+}
+
+int KSycocaDirSnapshot::entryCount() const
+{
+    int count = 0;
+    for (const Tree &tree : m_trees) {
+        count += tree.entries.count();
+    }
+    return count;
+}
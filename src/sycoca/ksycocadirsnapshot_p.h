@@ -0,0 +1,101 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#ifndef KSYCOCADIRSNAPSHOT_P_H
+#define KSYCOCADIRSNAPSHOT_P_H
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @internal
+ * One listing of the resource subdirs under every GenericDataLocation dir,
+ * with the modification time of everything in them, taken once per
+ * ksycoca build. The timestamp check, the listing of the files of
+ * each resource and the resource hash of each file are all answered from
+ * it, instead of walking and stat'ing the same trees again and again.
+ *
+ * The const methods can be called from several threads.
+ */
+class KSycocaDirSnapshot
+{
+public:
+    /**
+     * Lists @p subdirs under every GenericDataLocation dir,
+     * one dir per thread of the global thread pool.
+     * Subdirs which are part of the snapshot already are skipped.
+     */
+    void scan(const QStringList &subdirs);
+
+    /**
+     * The files (and dirs) under @p subdir, relative to it, merged over all
+     * the GenericDataLocation dirs.
+     * Lists @p subdir now if it wasn't part of the snapshot.
+     */
+    QSet<QString> relativeFiles(const QString &subdir);
+
+    /**
+     * The absolute paths of the files under @p subdir, with the dirs canonicalized
+     * the way VFolderMenu does it.
+     */
+    QStringList filePaths(const QString &subdir) const;
+
+    /**
+     * Same as KBuildSycoca::calcResourceHash(), which it falls back to for files
+     * outside of the snapshot. Those results are remembered too.
+     */
+    quint32 resourceHash(const QString &subdir, const QString &filename) const;
+
+    /**
+     * The latest modification time (in ms since epoch) of @p dir and, for the dirs
+     * that need it, of its subdirs: see KSycocaUtilsPrivate::visitResourceDirectory.
+     * Dirs outside of the snapshot are visited once, then remembered.
+     */
+    qint64 dirStamp(const QString &dir) const;
+
+    /**
+     * @return true if any of @p dirs was modified after the time stored with it
+     */
+    bool hasChangedSince(const QMap<QString, qint64> &dirs) const;
+
+    /**
+     * The number of files and dirs listed so far
+     */
+    int entryCount() const;
+
+    struct Tree {
+        QString subdir;
+        QString root; // as in KSycocaFactory::allDirectories()
+        QString canonicalRoot;
+        qint64 stamp = 0;
+        QHash<QString, quint32> entries; // relative path -> mtime in s, 0 for dirs and unreadable files
+    };
+
+private:
+    QVector<Tree> m_trees;
+    QSet<QString> m_subdirs;
+    // What was looked up outside of the trees, guarded by m_mutex
+    mutable QMutex m_mutex;
+    mutable QHash<QString, qint64> m_dirStamps;
+    mutable QHash<QString, quint32> m_resourceHashes; // "subdir|filename" -> hash
+};
+
+#endif
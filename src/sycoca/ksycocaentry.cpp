@@ -23,7 +23,7 @@
 #include <ksycoca.h>
 
 KSycocaEntryPrivate::KSycocaEntryPrivate(QDataStream &_str, int iOffset)
-    : offset(iOffset), deleted(false)
+    : offset(iOffset), rawSize(0), deleted(false)
 {
     _str >> path;
 }
@@ -91,6 +91,7 @@ int KSycocaEntry::offset() const
 void KSycocaEntryPrivate::save(QDataStream &s)
 {
     offset = s.device()->pos(); // store position in member variable
+    rawSize = 0;
     s << qint32(sycocaType()) << path;
 }
 
@@ -29,7 +29,7 @@ class KSycocaEntryPrivate
 {
 public:
     explicit KSycocaEntryPrivate(const QString &path_)
-        : offset(0),
+        : offset(0), rawSize(0),
           deleted(false), path(path_)
     {}
 
@@ -41,6 +41,28 @@ public:
     // first if you override this function.
     virtual void save(QDataStream &s);
 
+    /**
+     * Writes the entry by copying @p raw, its encoding as read from
+     * the previous database (see rawSize), fixing up what changed since.
+     * Used by incremental builds, to skip re-encoding unchanged entries.
+     * @return false if the entry can't be copied, save() is then called instead
+     */
+    virtual bool saveRaw(QDataStream &s, const QByteArray &raw)
+    {
+        Q_UNUSED(s)
+        Q_UNUSED(raw)
+        return false;
+    }
+
+    /**
+     * How many bytes at the end of the raw encoding saveRaw() writes anew,
+     * the others are copied as they are.
+     */
+    virtual int rawTailSize() const
+    {
+        return 0;
+    }
+
     virtual bool isType(KSycocaType t) const
     {
         return (t == KST_KSycocaEntry);
@@ -75,6 +97,9 @@ public:
     }
 
     int offset;
+    // Size of the entry in the database it was read from, 0 if it wasn't read
+    // from one or was modified since
+    qint32 rawSize;
     bool deleted;
     QString path;
 };
@@ -27,7 +27,8 @@
 #include <QDebug>
 
 #include <QThread>
-#include <QHash>
+#include <QMap>
+#include <QIODevice>
 
 class KSycocaFactoryPrivate
 {
@@ -43,6 +44,8 @@ public:
     int m_beginEntryOffset = 0;
     int m_endEntryOffset = 0;
     KSycocaDict *m_sycocaDict = nullptr;
+    QIODevice *m_previousDatabase = nullptr;
+    bool m_appending = false;
 };
 
 KSycocaFactory::KSycocaFactory(KSycocaFactoryId factory_id, KSycoca *sycoca)
@@ -113,7 +116,9 @@ KSycocaFactory::save(QDataStream &str)
     // Write all entries.
     int entryCount = 0;
     Q_FOREACH(KSycocaEntry::Ptr entry, *m_entryDict) {
-        entry->d_ptr->save(str);
+        if (!saveRawEntry(str, entry)) {
+            entry->d_ptr->save(str);
+        }
         entryCount++;
     }
 
@@ -139,6 +144,107 @@ KSycocaFactory::save(QDataStream &str)
     str.device()->seek(endOfFactoryData);
 }
 
+void KSycocaFactory::setPreviousDatabase(QIODevice *device, bool appending)
+{
+    d->m_previousDatabase = device;
+    d->m_appending = device && appending;
+}
+
+QVector<QPair<int, qint32>> KSycocaFactory::entryLocations() const
+{
+    QVector<QPair<int, qint32>> locations;
+    if (m_entryDict) {
+        locations.reserve(m_entryDict->count());
+        for (const KSycocaEntry::Ptr &entry : qAsConst(*m_entryDict)) {
+            locations.append(qMakePair(entry->d_ptr->offset, entry->d_ptr->rawSize));
+        }
+    }
+    return locations;
+}
+
+void KSycocaFactory::setEntryLocations(const QVector<QPair<int, qint32>> &locations)
+{
+    if (!m_entryDict || m_entryDict->count() != locations.count()) {
+        return;
+    }
+    int i = 0;
+    for (const KSycocaEntry::Ptr &entry : qAsConst(*m_entryDict)) {
+        entry->d_ptr->offset = locations.at(i).first;
+        entry->d_ptr->rawSize = locations.at(i).second;
+        ++i;
+    }
+}
+
+bool KSycocaFactory::entriesUnchanged(QIODevice *device)
+{
+    if (!m_entryDict || !device) {
+        return false;
+    }
+    for (const KSycocaEntry::Ptr &entry : qAsConst(*m_entryDict)) {
+        KSycocaEntryPrivate *entryPriv = entry->d_ptr;
+        const int offset = entryPriv->offset;
+        const qint32 rawSize = entryPriv->rawSize;
+        if (rawSize <= 0 || !device->seek(offset)) { // a new entry
+            return false;
+        }
+        QByteArray encoded;
+        QDataStream encoder(&encoded, QIODevice::WriteOnly);
+        encoder.setVersion(QDataStream::Qt_5_3);
+        entryPriv->save(encoder);
+        // save() moved it to the start of encoded
+        entryPriv->offset = offset;
+        entryPriv->rawSize = rawSize;
+        if (encoded != device->read(rawSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KSycocaFactory::saveRawEntry(QDataStream &str, const KSycocaEntry::Ptr &entry)
+{
+    KSycocaEntryPrivate *entryPriv = entry->d_ptr;
+    QIODevice *device = d->m_previousDatabase;
+    const int oldOffset = entryPriv->offset;
+    const qint32 rawSize = entryPriv->rawSize;
+    if (!device || rawSize <= 0) {
+        return false;
+    }
+
+    if (d->m_appending) {
+        // Appending to the same file: an entry which encodes to the same bytes stays
+        // where it is. Only its tail can differ, the rest doesn't need to be read.
+        const int tailSize = qMin(entryPriv->rawTailSize(), int(rawSize));
+        if (!device->seek(oldOffset + rawSize - tailSize)) {
+            return false;
+        }
+        const QByteArray tail = device->read(tailSize);
+        QByteArray encoded;
+        QDataStream encoder(&encoded, QIODevice::WriteOnly);
+        encoder.setVersion(str.version());
+        const bool saved = tail.size() == tailSize && entryPriv->saveRaw(encoder, tail);
+        // saveRaw() moved it into encoded
+        entryPriv->offset = oldOffset;
+        entryPriv->rawSize = rawSize;
+        if (!saved) {
+            return false;
+        }
+        if (encoded == tail) {
+            entryPriv->rawSize = 0;
+            return true;
+        }
+    }
+
+    if (!device->seek(oldOffset)) {
+        return false;
+    }
+    const QByteArray raw = device->read(rawSize);
+    if (raw.size() != rawSize) {
+        return false;
+    }
+    return entryPriv->saveRaw(str, raw);
+}
+
 void
 KSycocaFactory::addEntry(const KSycocaEntry::Ptr &newEntry)
 {
@@ -214,6 +320,8 @@ KSycocaEntry::List KSycocaFactory::allEntries() const
     for (int i = 0; i < entryCount; i++) {
         KSycocaEntry *newEntry = createEntry(offsetList[i]);
         if (newEntry) {
+            // Remember where the entry ends, for KSycocaFactory::setPreviousDatabase
+            newEntry->d_ptr->rawSize = str->device()->pos() - offsetList[i];
             list.append(KSycocaEntry::Ptr(newEntry));
         }
     }
@@ -238,7 +346,19 @@ const KSycocaDict *KSycocaFactory::sycocaDict() const
 
 bool KSycocaFactory::isEmpty() const
 {
-    return d->m_beginEntryOffset == d->m_endEntryOffset;
+    if (m_entryDict) {
+        return m_entryDict->isEmpty();
+    }
+    // Not m_beginEntryOffset == m_endEntryOffset: the entries of an appended
+    // segment can all be in the previous ones, see KSycocaTrailer
+    QDataStream *str = stream();
+    if (!str) {
+        return true;
+    }
+    str->device()->seek(d->m_endEntryOffset);
+    qint32 entryCount;
+    (*str) >> entryCount;
+    return entryCount == 0;
 }
 
 QDataStream *KSycocaFactory::stream() const
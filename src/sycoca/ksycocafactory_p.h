@@ -24,14 +24,19 @@
 
 #include <ksycoca.h> // for KSycoca::self()
 
+#include <QPair>
+#include <QVector>
+
 class QString;
+class QIODevice;
 class KSycoca;
 class KSycocaDict;
 class KSycocaResourceList;
 template <typename T> class QList;
-template <typename KT, typename VT> class QHash;
+template <typename Key, typename T> class QMap;
 
-typedef QHash<QString, KSycocaEntry::Ptr> KSycocaEntryDict;
+// A QMap, so that the entries are saved in the same order from one build to the next
+typedef QMap<QString, KSycocaEntry::Ptr> KSycocaEntryDict;
 class KSycocaFactoryPrivate;
 /**
  * @internal
@@ -115,6 +120,33 @@ public:
      */
     virtual void saveHeader(QDataStream &str);
 
+    /**
+     * Lets save() copy the entries which were read from @p device, the previous
+     * database, and weren't modified since, instead of encoding them again.
+     * @param device the previous database, or nullptr to encode all entries
+     * @param appending true if save() appends to that same file, see KSycocaTrailer:
+     * the entries which are still the same, byte for byte, are then left where they are
+     * @internal to kbuildsycoca
+     */
+    void setPreviousDatabase(QIODevice *device, bool appending = false);
+
+    /**
+     * Where the entries are, i.e. where they were read from until save() moves them.
+     * Lets kbuildsycoca save them more than once, e.g. into a full image and into
+     * a segment appended to the previous database, see KSycocaTrailer.
+     * @internal to kbuildsycoca
+     */
+    QVector<QPair<int, qint32>> entryLocations() const;
+    void setEntryLocations(const QVector<QPair<int, qint32>> &locations);
+
+    /**
+     * @return true if each entry still encodes to the bytes it was read from in
+     * @p device, the previous database. Only meaningful for the factories whose
+     * entries don't refer to other parts of the database, like the service groups.
+     * @internal to kbuildsycoca
+     */
+    bool entriesUnchanged(QIODevice *device);
+
     /**
      * @return the resources for which this factory is responsible.
      * @internal to kbuildsycoca
@@ -146,6 +178,8 @@ protected:
     static QStringList allDirectories(const QString &subdir);
 
 private:
+    bool saveRawEntry(QDataStream &str, const KSycocaEntry::Ptr &entry);
+
     QDataStream *m_str = nullptr;
     KSycoca *m_sycoca = nullptr;
     KSycocaFactoryPrivate *const d;
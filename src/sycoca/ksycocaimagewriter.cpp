@@ -0,0 +1,165 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#include "ksycocaimagewriter_p.h"
+#include "sycocadebug.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <qsavefile.h>
+
+#include <qplatformdefs.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+KSycocaImageWriter::KSycocaImageWriter(qint64 base, qint64 sizeHint)
+    : m_base(base)
+{
+    m_image.reserve(int(sizeHint));
+    open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    seek(m_base);
+}
+
+qint64 KSycocaImageWriter::size() const
+{
+    return m_base + m_image.size();
+}
+
+qint64 KSycocaImageWriter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 KSycocaImageWriter::writeData(const char *data, qint64 size)
+{
+    const qint64 offset = pos() - m_base;
+    if (offset < 0) {
+        return -1;
+    }
+    if (offset + size > m_image.size()) {
+        m_image.resize(int(offset + size)); // grows geometrically
+    }
+    memcpy(m_image.data() + offset, data, size_t(size));
+    return size;
+}
+
+#ifdef Q_OS_UNIX
+static bool syncFile(int fd, KSycocaImageWriter::SyncPolicy policy)
+{
+    if (policy == KSycocaImageWriter::NoSync) {
+        return true;
+    }
+#ifdef Q_OS_LINUX
+    return ::fdatasync(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+static void syncDirectory(const QString &path)
+{
+    const int fd = QT_OPEN(QFile::encodeName(QFileInfo(path).absolutePath()).constData(), O_RDONLY);
+    if (fd != -1) {
+        ::fsync(fd);
+        QT_CLOSE(fd);
+    }
+}
+#endif
+
+bool KSycocaImageWriter::replaceFile(const QString &path, SyncPolicy policy)
+{
+    Q_ASSERT(m_base == 0);
+#ifdef Q_OS_UNIX
+    // kbuildsycoca holds the lock of the database, so the name is ours
+    QFile newFile(path + QLatin1String(".new"));
+    bool openedOK = newFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    if (!openedOK && newFile.exists()) { // e.g. left behind by a crash under another user
+        QFile::remove(newFile.fileName());
+        openedOK = newFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+    if (!openedOK) {
+        qCWarning(SYCOCA) << "ERROR creating database" << newFile.fileName() << ":" << newFile.errorString();
+        return false;
+    }
+    if (newFile.write(m_image) != m_image.size() || !syncFile(newFile.handle(), policy)) {
+        qCWarning(SYCOCA) << "ERROR writing database" << newFile.fileName() << ". Disk full?";
+        newFile.remove();
+        return false;
+    }
+    newFile.close();
+    if (::rename(QFile::encodeName(newFile.fileName()).constData(), QFile::encodeName(path).constData()) != 0) {
+        qCWarning(SYCOCA) << "ERROR renaming" << newFile.fileName() << "to" << path << ":" << qt_error_string(errno);
+        newFile.remove();
+        return false;
+    }
+    if (policy == SyncAll) {
+        syncDirectory(path);
+    }
+    return true;
+#else
+    // QSaveFile syncs and renames the way the platform allows
+    Q_UNUSED(policy);
+    QSaveFile database(path);
+    if (!database.open(QIODevice::WriteOnly)) {
+        qCWarning(SYCOCA) << "ERROR creating database" << path << ":" << database.errorString();
+        return false;
+    }
+    database.write(m_image);
+    if (!database.commit()) {
+        qCWarning(SYCOCA) << "ERROR writing database" << path << ". Disk full?";
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool KSycocaImageWriter::appendTo(QFile &file, SyncPolicy policy)
+{
+    if (file.size() != m_base || !file.seek(m_base)) {
+        qCWarning(SYCOCA) << "ERROR appending to database" << file.fileName() << ": modified meanwhile";
+        return false;
+    }
+    bool ok = file.write(m_image) == m_image.size() && file.flush();
+#ifdef Q_OS_UNIX
+    ok = ok && syncFile(file.handle(), policy);
+#else
+    Q_UNUSED(policy);
+#endif
+    if (!ok) {
+        qCWarning(SYCOCA) << "ERROR appending to database" << file.fileName() << ":" << file.errorString();
+        file.resize(m_base);
+        return false;
+    }
+    return true;
+}
+
+bool KSycocaImageWriter::overwrite(QFile &file, qint64 pos, const QByteArray &data, SyncPolicy policy)
+{
+    bool ok = file.seek(pos) && file.write(data) == data.size() && file.flush();
+#ifdef Q_OS_UNIX
+    ok = ok && syncFile(file.handle(), policy);
+#else
+    Q_UNUSED(policy);
+#endif
+    if (!ok) {
+        qCWarning(SYCOCA) << "ERROR updating database" << file.fileName() << ":" << file.errorString();
+    }
+    return ok;
+}
@@ -0,0 +1,92 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#ifndef KSYCOCAIMAGEWRITER_P_H
+#define KSYCOCAIMAGEWRITER_P_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+class QFile;
+
+/**
+ * @internal
+ * The device KBuildSycoca::save() writes to: the whole image of the database,
+ * assembled in memory. The headers and tables which the factories and dicts
+ * fix up once their offsets are known are patched in the buffer, and the file
+ * is then written with a single write().
+ *
+ * The positions are those of the file: for a segment appended to an existing
+ * database, they start at @p base, the size of the file.
+ */
+class KSycocaImageWriter : public QIODevice
+{
+public:
+    /**
+     * How long the commit waits for the disk
+     */
+    enum SyncPolicy {
+        NoSync, ///< Not at all: after a power loss the database can be empty, and gets rebuilt
+        SyncData, ///< Until the data of the file is on disk, before it replaces the old file (default)
+        SyncAll ///< Also until the rename is on disk
+    };
+
+    /**
+     * @param sizeHint the expected size of the image, e.g. the size of the previous database
+     */
+    explicit KSycocaImageWriter(qint64 base = 0, qint64 sizeHint = 0);
+
+    qint64 size() const override;
+
+    /**
+     * The bytes written so far, from base on
+     */
+    const QByteArray &imageData() const
+    {
+        return m_image;
+    }
+
+    /**
+     * Writes the image to a new file next to @p path, synced according to @p policy,
+     * then renames it to @p path: readers see either the old database or the new one.
+     * Only for a full image (base 0).
+     */
+    bool replaceFile(const QString &path, SyncPolicy policy);
+
+    /**
+     * Appends the image to @p file, opened for writing, which must still be
+     * base bytes long. On error the file is truncated back to that size.
+     */
+    bool appendTo(QFile &file, SyncPolicy policy);
+
+    /**
+     * Writes @p data over the bytes at @p pos in @p file, opened for writing,
+     * in one write, then syncs it according to @p policy.
+     * Used to point the readers to an appended segment, see KSycocaTrailer.
+     */
+    static bool overwrite(QFile &file, qint64 pos, const QByteArray &data, SyncPolicy policy);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    const qint64 m_base;
+    QByteArray m_image;
+};
+
+#endif
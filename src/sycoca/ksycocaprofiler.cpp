@@ -0,0 +1,182 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#include "ksycocaprofiler_p.h"
+#include "sycocadebug.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadStorage>
+
+#include <time.h>
+
+// Per thread: the background rebuilds and the worker threads of the pool
+// mustn't record into a profiler of another thread.
+// A struct, since QThreadStorage would delete a pointer when the thread exits.
+struct ActiveProfiler {
+    KSycocaProfiler *profiler = nullptr;
+};
+static QThreadStorage<ActiveProfiler> s_activeProfiler;
+
+// CPU time of the whole process, worker threads included, in ns
+static qint64 processCpuTime()
+{
+#if defined(CLOCK_PROCESS_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return qint64(clock()) * (1000000000 / CLOCKS_PER_SEC);
+}
+
+KSycocaProfiler::KSycocaProfiler(const QString &outputFile)
+    : m_outputFile(outputFile)
+{
+    if (!m_outputFile.isEmpty()) {
+        m_timer.start();
+        s_activeProfiler.localData().profiler = this;
+    }
+}
+
+KSycocaProfiler::~KSycocaProfiler()
+{
+    if (!s_activeProfiler.hasLocalData() || s_activeProfiler.localData().profiler != this) {
+        return;
+    }
+    s_activeProfiler.localData().profiler = nullptr;
+
+    QFile file(m_outputFile);
+    bool opened;
+    if (m_outputFile == QLatin1String("-")) {
+        opened = file.open(stdout, QIODevice::WriteOnly);
+    } else {
+        opened = file.open(QIODevice::WriteOnly);
+    }
+    if (!opened || file.write(toJson()) == -1) {
+        qCWarning(SYCOCA) << "Couldn't write the profile to" << m_outputFile << ":" << file.errorString();
+    }
+}
+
+KSycocaProfiler *KSycocaProfiler::active()
+{
+    return s_activeProfiler.hasLocalData() ? s_activeProfiler.localData().profiler : nullptr;
+}
+
+int KSycocaProfiler::beginPhase(const QByteArray &name, const QString &detail)
+{
+    Phase phase;
+    phase.name = name;
+    phase.detail = detail;
+    phase.depth = m_depth++;
+    phase.start = m_timer.nsecsElapsed();
+    m_phases.append(phase);
+    m_cpuStarts.append(processCpuTime());
+    return m_phases.count() - 1;
+}
+
+void KSycocaProfiler::endPhase(int index)
+{
+    Phase &phase = m_phases[index];
+    phase.wall = m_timer.nsecsElapsed() - phase.start;
+    phase.cpu = processCpuTime() - m_cpuStarts.at(index);
+    --m_depth;
+}
+
+void KSycocaProfiler::setValue(int index, const QByteArray &key, qint64 value)
+{
+    QVector<QPair<QByteArray, qint64>> &values = m_phases[index].values;
+    for (auto &pair : values) {
+        if (pair.first == key) {
+            pair.second = value;
+            return;
+        }
+    }
+    values.append(qMakePair(key, value));
+}
+
+QByteArray KSycocaProfiler::toJson() const
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray phases;
+    QJsonArray traceEvents;
+    for (const Phase &phase : m_phases) {
+        const QString name = QString::fromLatin1(phase.name);
+        QJsonObject args;
+        if (!phase.detail.isEmpty()) {
+            args.insert(QStringLiteral("detail"), phase.detail);
+        }
+        args.insert(QStringLiteral("cpu_us"), phase.cpu / 1000);
+        for (const auto &pair : phase.values) {
+            args.insert(QString::fromLatin1(pair.first), pair.second);
+        }
+
+        QJsonObject summary = args;
+        summary.insert(QStringLiteral("name"), name);
+        summary.insert(QStringLiteral("depth"), phase.depth);
+        summary.insert(QStringLiteral("start_us"), phase.start / 1000);
+        summary.insert(QStringLiteral("wall_us"), phase.wall / 1000);
+        phases.append(summary);
+
+        // A "complete" event, see the Trace Event Format document
+        QJsonObject event;
+        event.insert(QStringLiteral("name"), phase.detail.isEmpty() ? name : name + QLatin1Char(' ') + phase.detail);
+        event.insert(QStringLiteral("cat"), QStringLiteral("kbuildsycoca"));
+        event.insert(QStringLiteral("ph"), QStringLiteral("X"));
+        event.insert(QStringLiteral("ts"), double(phase.start) / 1000);
+        event.insert(QStringLiteral("dur"), double(phase.wall) / 1000);
+        event.insert(QStringLiteral("pid"), pid);
+        event.insert(QStringLiteral("tid"), 1);
+        event.insert(QStringLiteral("args"), args);
+        traceEvents.append(event);
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("phases"), phases);
+    root.insert(QStringLiteral("traceEvents"), traceEvents);
+    root.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+    return QJsonDocument(root).toJson();
+}
+
+KSycocaProfilePhase::KSycocaProfilePhase(const QByteArray &name, const QString &detail)
+    : m_profiler(KSycocaProfiler::active()),
+      m_index(m_profiler ? m_profiler->beginPhase(name, detail) : -1)
+{
+}
+
+KSycocaProfilePhase::~KSycocaProfilePhase()
+{
+    finish();
+}
+
+void KSycocaProfilePhase::finish()
+{
+    if (m_profiler) {
+        m_profiler->endPhase(m_index);
+        m_profiler = nullptr;
+    }
+}
+
+void KSycocaProfilePhase::setValue(const QByteArray &key, qint64 value)
+{
+    if (m_profiler) {
+        m_profiler->setValue(m_index, key, value);
+    }
+}
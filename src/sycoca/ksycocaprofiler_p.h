@@ -0,0 +1,100 @@
+/*  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation;
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ **/
+
+#ifndef KSYCOCAPROFILER_P_H
+#define KSYCOCAPROFILER_P_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+/**
+ * @internal
+ * Records the wall and CPU time of the phases of a ksycoca build,
+ * for kbuildsycoca5 --profile. When destroyed, writes them to the output file
+ * as JSON, which is also in the Chrome trace event format (chrome://tracing, Perfetto).
+ *
+ * Only the thread which builds the database records phases; the time its
+ * worker threads spend is part of the CPU time of the phase which started them.
+ */
+class KSycocaProfiler
+{
+public:
+    /**
+     * @param outputFile where to write the profile, "-" for stdout.
+     * If empty, nothing is recorded.
+     */
+    explicit KSycocaProfiler(const QString &outputFile);
+    ~KSycocaProfiler();
+
+    /**
+     * @return the profiler of the build in progress in the current thread,
+     * nullptr if it isn't profiled
+     */
+    static KSycocaProfiler *active();
+
+    struct Phase {
+        QByteArray name;
+        QString detail; // e.g. the resource or the factory
+        int depth = 0;
+        qint64 start = 0; // in ns since the profiler was created
+        qint64 wall = 0; // in ns
+        qint64 cpu = 0; // in ns, of the whole process
+        QVector<QPair<QByteArray, qint64>> values; // file counts, bytes...
+    };
+
+    int beginPhase(const QByteArray &name, const QString &detail);
+    void endPhase(int index);
+    void setValue(int index, const QByteArray &key, qint64 value);
+
+    QByteArray toJson() const;
+
+private:
+    QString m_outputFile;
+    QElapsedTimer m_timer;
+    QVector<Phase> m_phases;
+    QVector<qint64> m_cpuStarts; // of the phases
+    int m_depth = 0;
+};
+
+/**
+ * @internal
+ * Records one phase with the active KSycocaProfiler, from construction to destruction.
+ * Does nothing if the build isn't profiled.
+ */
+class KSycocaProfilePhase
+{
+public:
+    explicit KSycocaProfilePhase(const QByteArray &name, const QString &detail = QString());
+    ~KSycocaProfilePhase();
+
+    void setValue(const QByteArray &key, qint64 value);
+
+    /**
+     * Ends the phase before the destructor does
+     */
+    void finish();
+
+private:
+    Q_DISABLE_COPY(KSycocaProfilePhase)
+    KSycocaProfiler *m_profiler;
+    int m_index;
+};
+
+#endif
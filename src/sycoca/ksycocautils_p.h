@@ -20,12 +20,17 @@
 #ifndef KSYCOCAUTILS_P_H
 #define KSYCOCAUTILS_P_H
 
+#include <QCryptographicHash>
+#include <QFile>
 #include <QFileInfo>
 #include <QString>
+#include <QStringList>
 #include <QDir>
 #include <QDateTime>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
 
-class QStringList;
 class QDataStream;
 
 namespace KSycocaUtilsPrivate
@@ -71,6 +76,83 @@ bool visitResourceDirectory(const QString &dirname, Visitor visitor)
     return true;
 }
 
+// The name and a checksum of each of @p files, to find out whether they changed since.
+// Not the modification time, a file can be written several times within its resolution.
+inline QStringList fileStamps(const QStringList &files)
+{
+    QStringList stamps;
+    for (const QString &file : files) {
+        QFile f(file);
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        if (f.open(QIODevice::ReadOnly)) {
+            hash.addData(&f);
+        }
+        stamps << file << QString::fromLatin1(hash.result().toHex());
+    }
+    return stamps;
+}
+
+// helper class for parallelForChunks
+template<typename Function>
+class ChunkRunnable : public QRunnable
+{
+public:
+    ChunkRunnable(Function &fn, int begin, int end, QSemaphore *done)
+        : m_fn(fn), m_begin(begin), m_end(end), m_done(done)
+    {
+    }
+
+    void run() override
+    {
+        m_fn(m_begin, m_end);
+        if (m_done) {
+            m_done->release();
+        }
+    }
+
+private:
+    Function &m_fn;
+    int m_begin;
+    int m_end;
+    QSemaphore *m_done;
+};
+
+// The number of chunks parallelForChunks splits @p count items into:
+// 1 below @p threshold, where dispatching to other threads costs more than it saves.
+inline int chunkCount(int count, int threshold)
+{
+    return count >= threshold
+           ? qBound(1, count / qMax(1, threshold / 4), QThreadPool::globalInstance()->maxThreadCount()) : 1;
+}
+
+// Calls fn(begin, end) for consecutive ranges covering [0, count), see chunkCount(),
+// and returns once they are all done. The ranges run on the global thread pool, but the
+// calling thread takes the first one itself, and the ones the pool can't start right
+// away: waiting for queued ones could deadlock if we are running in the pool already.
+// fn is called from several threads at once.
+template<typename Function>
+void parallelForChunks(int count, int threshold, Function fn)
+{
+    const int chunks = chunkCount(count, threshold);
+    if (chunks == 1) {
+        fn(0, count);
+        return;
+    }
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QSemaphore done;
+    int others = 0;
+    const int chunkSize = (count + chunks - 1) / chunks;
+    for (int begin = chunkSize; begin < count; begin += chunkSize, ++others) {
+        ChunkRunnable<Function> *runnable = new ChunkRunnable<Function>(fn, begin, qMin(begin + chunkSize, count), &done);
+        if (!pool->tryStart(runnable)) {
+            runnable->run();
+            delete runnable;
+        }
+    }
+    fn(0, chunkSize);
+    done.acquire(others);
+}
+
 }
 
 #endif /* KSYCOCAUTILS_P_H */